@@ -0,0 +1,154 @@
+#include "Frozen.hpp"
+#include "SpatialPooler.hpp"
+#include "TemporalMemory.hpp"
+#include "Boost.hpp"
+
+using namespace et;
+
+// Calls f(synapse, target) for every connected synapse. Compared in the permanence's own type, same as the kernels do
+template <typename Func>
+static void visitConnected(const Tensor& connections, const Tensor& permanences, float connected_permanence, Func f)
+{
+	et_check(connections.shape() == permanences.shape());
+	std::vector<int32_t> targets = connections.toHost<int32_t>();
+	auto visit = [&](const auto& perms) {
+		for(size_t i=0;i<targets.size();i++) {
+			if(targets[i] != -1 && perms[i] > connected_permanence)
+				f(i, targets[i]);
+		}
+	};
+	if(permanences.dtype() == DType::UNorm8)
+		visit(permanences.toHost<unorm8>());
+	else
+		visit(permanences.cast(DType::Float).toHost<float>());
+}
+
+FrozenSpatialPooler::FrozenSpatialPooler(const SpatialPooler& sp)
+	: active_threshold_(sp.active_threshold_), global_density_(sp.global_density_), boost_factor_(sp.boost_factor_)
+	, inhibition_radius_(sp.inhibition_radius_), input_shape_(sp.input_shape_), output_shape_(sp.output_shape_)
+	, average_activity_(sp.average_activity_.copy())
+{
+	const Tensor& connections = sp.connections_;
+	size_t synapses_per_cell = connections.shape().back();
+	size_t row_size = (input_shape_.volume()+63)/64*64;
+
+	// Built as bools then packed. Freezing is a one time cost
+	std::vector<uint8_t> mask(output_shape_.volume()*row_size, 0);
+	visitConnected(connections, sp.permanences_, sp.connected_permanence_, [&](size_t synapse, int32_t target) {
+		mask[synapse/synapses_per_cell*row_size + target] = 1;
+	});
+	masks_ = Tensor(output_shape_ + intmax_t(row_size), (const bool*)mask.data(), connections.backend()).cast(DType::Bit);
+}
+
+Tensor FrozenSpatialPooler::compute(const Tensor& x) const
+{
+	if(x.shape() != input_shape_) {
+		Shape sample_shape = x.shape();
+		if(sample_shape.size() != 0)
+			sample_shape.erase(sample_shape.begin());
+		et_check(sample_shape == input_shape_, "Input tensor shape " + to_string(x.shape()) +" does not match expected shape "
+			+ to_string(input_shape_) + " or [batch] + " + to_string(input_shape_));
+
+		Tensor activity = batchMaskCellActivity(x, masks_, active_threshold_);
+		if(boost_factor_ != 0)
+			activity = boost(activity, average_activity_, global_density_, boost_factor_);
+		if(inhibition_radius_ == 0)
+			return batchGlobalInhibition(activity, global_density_);
+
+		svector<Tensor> res;
+		for(intmax_t i=0;i<activity.shape()[0];i++) {
+			Tensor y = localInhibition(activity.view({i}).realize(), global_density_, inhibition_radius_);
+			res.push_back(y.reshape(Shape{1} + output_shape_));
+		}
+		return cat(res, 0);
+	}
+
+	Tensor activity = maskCellActivity(x, masks_, active_threshold_);
+	if(boost_factor_ != 0)
+		activity = boost(activity, average_activity_, global_density_, boost_factor_);
+
+	return inhibition_radius_ == 0 ? globalInhibition(activity, global_density_)
+		: localInhibition(activity, global_density_, inhibition_radius_);
+}
+
+void FrozenSpatialPooler::loadState(const StateDict& states)
+{
+	input_shape_ = std::any_cast<Shape>(states.at("input_shape"));
+	output_shape_ = std::any_cast<Shape>(states.at("output_shape"));
+	masks_ = std::any_cast<Tensor>(states.at("masks"));
+	active_threshold_ = std::any_cast<int>(states.at("active_threshold"));
+	global_density_ = std::any_cast<float>(states.at("global_density"));
+	average_activity_ = std::any_cast<Tensor>(states.at("average_activity"));
+	boost_factor_ = std::any_cast<float>(states.at("boost_factor"));
+	inhibition_radius_ = std::any_cast<int>(states.at("inhibition_radius"));
+}
+
+FrozenSpatialPooler FrozenSpatialPooler::to(Backend* b) const
+{
+	FrozenSpatialPooler sp = *this;
+	sp.masks_ = masks_.to(b);
+	sp.average_activity_ = average_activity_.to(b);
+	return sp;
+}
+
+FrozenTemporalMemory::FrozenTemporalMemory(const TemporalMemory& tm)
+	: input_shape_(tm.input_shape_), active_threshold_(tm.active_threshold_)
+{
+	Tensor connections = tm.connections();
+	size_t synapses_per_cell = connections.shape().back();
+	Shape cell_shape = connections.shape();
+	cell_shape.pop_back();
+
+	std::vector<int32_t> rows(cell_shape.volume()*2, 0);
+	std::vector<int32_t> indices;
+	// Synapses are visited in order, so the synapses of a cell are contiguous
+	visitConnected(connections, tm.permanences(), tm.connected_permanence_, [&](size_t synapse, int32_t target) {
+		size_t cell = synapse/synapses_per_cell;
+		if(rows[cell*2+1] == 0)
+			rows[cell*2] = indices.size();
+		rows[cell*2+1] += 1;
+		indices.push_back(target);
+	});
+	// Tensors can't be empty
+	if(indices.empty())
+		indices.push_back(0);
+
+	rows_ = Tensor(cell_shape + intmax_t(2), rows.data(), connections.backend());
+	indices_ = Tensor({intmax_t(indices.size())}, indices.data(), connections.backend());
+}
+
+std::pair<Tensor, Tensor> FrozenTemporalMemory::compute(const Tensor& x, const Tensor& last_state) const
+{
+	et_check(x.shape() == input_shape_, "Input tensor shape " + to_string(x.shape()) +" does not match expected shape "
+		+ to_string(input_shape_));
+
+	Tensor active_cells = burst(x, last_state.has_value() ? last_state
+		: zeros(x.shape()+cellsPerColumn(), x.dtype(), x.backend()));
+	Tensor activity = indexCellActivity(active_cells, rows_, indices_, active_threshold_);
+	return {cast(activity, active_cells.dtype()), active_cells};
+}
+
+size_t FrozenTemporalMemory::numSynapses() const
+{
+	std::vector<int32_t> rows = rows_.toHost<int32_t>();
+	size_t n = 0;
+	for(size_t i=1;i<rows.size();i+=2)
+		n += rows[i];
+	return n;
+}
+
+void FrozenTemporalMemory::loadState(const StateDict& states)
+{
+	input_shape_ = std::any_cast<Shape>(states.at("input_shape"));
+	active_threshold_ = std::any_cast<int>(states.at("active_threshold"));
+	rows_ = std::any_cast<Tensor>(states.at("rows"));
+	indices_ = std::any_cast<Tensor>(states.at("indices"));
+}
+
+FrozenTemporalMemory FrozenTemporalMemory::to(Backend* b) const
+{
+	FrozenTemporalMemory tm = *this;
+	tm.rows_ = rows_.to(b);
+	tm.indices_ = indices_.to(b);
+	return tm;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Etaler/Core/Shape.hpp"
+#include "Etaler/Core/Backend.hpp"
+#include "Etaler/Core/Error.hpp"
+#include "Etaler/Core/Tensor.hpp"
+#include "Etaler/Core/Serialize.hpp"
+
+#include "Etaler_export.h"
+
+namespace et
+{
+
+struct SpatialPooler;
+struct TemporalMemory;
+
+// Inference only snapshot of a SpatialPooler, created by SpatialPooler::freeze(). The connected synapses of each column
+// are stored as a bitmap of the input. Computing the overlap is a popcount of the input AND the bitmap, no permanences
+// are read. Boosting uses the average activity at the time of freezing
+struct ETALER_EXPORT FrozenSpatialPooler
+{
+	FrozenSpatialPooler() = default;
+	explicit FrozenSpatialPooler(const SpatialPooler& sp);
+
+	// Same as SpatialPooler::compute(). x can also be a batch of inputs
+	Tensor compute(const Tensor& x) const;
+
+	// Bit tensor of shape output_shape + n. n is the input size rounded up to a multiple of 64
+	Tensor masks() const {return masks_;}
+	size_t activeThreshold() const { return active_threshold_; }
+	float globalDensity() const { return global_density_; }
+	float boostFactor() const { return boost_factor_; }
+	size_t inhibitionRadius() const { return inhibition_radius_; }
+
+	StateDict states() const
+	{
+		return {{"input_shape", input_shape_}, {"output_shape", output_shape_}, {"masks", masks_}
+			, {"active_threshold", (int)active_threshold_}, {"global_density", global_density_}
+			, {"average_activity", average_activity_}, {"boost_factor", boost_factor_}
+			, {"inhibition_radius", (int)inhibition_radius_}};
+	}
+
+	void loadState(const StateDict& states);
+	FrozenSpatialPooler to(Backend* b) const;
+
+//protected:
+	size_t active_threshold_ = 5;
+	float global_density_ = 0.1;
+	float boost_factor_ = 0;
+	size_t inhibition_radius_ = 0;
+
+	Shape input_shape_;
+	Shape output_shape_;
+	Tensor masks_;
+	Tensor average_activity_;
+};
+
+// Inference only snapshot of a TemporalMemory, created by TemporalMemory::freeze(). Only the connected synapses are kept,
+// as a list of the cells they connect to for each cell (see indexCellActivity()). Unlike a bitmap, this stays small for the
+// large number of cells a TM has
+struct ETALER_EXPORT FrozenTemporalMemory
+{
+	FrozenTemporalMemory() = default;
+	explicit FrozenTemporalMemory(const TemporalMemory& tm);
+
+	// Same as TemporalMemory::compute(). Batches are not supported
+	std::pair<Tensor, Tensor> compute(const Tensor& x, const Tensor& last_state) const;
+
+	size_t cellsPerColumn() const {return rows_.shape()[rows_.dimensions()-2];}
+	size_t activeThreshold() const { return active_threshold_; }
+	size_t numSynapses() const;
+
+	StateDict states() const
+	{
+		return {{"input_shape", input_shape_}, {"active_threshold", (int)active_threshold_}
+			, {"rows", rows_}, {"indices", indices_}};
+	}
+
+	void loadState(const StateDict& states);
+	FrozenTemporalMemory to(Backend* b) const;
+
+//protected:
+	Shape input_shape_;
+	size_t active_threshold_ = 2;
+	Tensor rows_; // Int32 of shape input_shape + {cells_per_column, 2}. {offset, size} into indices
+	Tensor indices_;
+};
+
+}
@@ -0,0 +1,45 @@
+#include "OverlapCache.hpp"
+
+using namespace et;
+
+Tensor OverlapCache::cellActivity(const Tensor& x, const Tensor& reverse_index, const Tensor& permanences
+	, float connected_permanence, size_t active_threshold)
+{
+	Tensor input = x.dtype() == DType::Bool ? x : x.cast(DType::Bool);
+	Shape cell_shape = permanences.shape();
+	cell_shape.pop_back();
+
+	// Start over from an empty input. The first call then visits every active bit, same as invertedCellActivity()
+	if(overlaps_.has_value() == false || last_input_.shape() != input.shape() || overlaps_.shape() != cell_shape
+		|| connected_permanence_ != connected_permanence) {
+		last_input_ = zeros(input.shape(), DType::Bool, input.backend());
+		overlaps_ = zeros(cell_shape, DType::Int32, permanences.backend());
+		connected_permanence_ = connected_permanence;
+	}
+
+	Tensor turned_on = flatnonzero(input && !last_input_);
+	Tensor turned_off = flatnonzero(last_input_ && !input);
+	last_input_ = input.copy();
+	return updateOverlaps(turned_on, turned_off, reverse_index, permanences, connected_permanence, active_threshold, overlaps_);
+}
+
+void OverlapCache::invalidate(const Tensor& cells, const Tensor& connections, const Tensor& permanences)
+{
+	if(has_value() == false)
+		return;
+	recomputeOverlaps(last_input_, cells, connections, permanences, connected_permanence_, overlaps_);
+}
+
+const Tensor& OverlapCache::reverseIndex(const Tensor& connections, const Shape& input_shape)
+{
+	if(reverse_index_.has_value() == false)
+		reverse_index_ = reverseSynapseIndex(connections, input_shape);
+	return reverse_index_;
+}
+
+void OverlapCache::clear()
+{
+	last_input_ = Tensor();
+	overlaps_ = Tensor();
+	reverse_index_ = Tensor();
+}
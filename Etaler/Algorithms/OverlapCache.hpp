@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Etaler/Core/Shape.hpp"
+#include "Etaler/Core/Backend.hpp"
+#include "Etaler/Core/Error.hpp"
+#include "Etaler/Core/Tensor.hpp"
+
+#include "Etaler_export.h"
+
+namespace et
+{
+
+//Remembers the last input and the overlap of every cell with it. When the input changes slowly (ex: a scalar encoder
+//following a sensor) most bits stay the same, so only the synapses from the bits that turned on or off need to be visited.
+//The permanences of the cells that learned must be reported through invalidate() for the overlaps to stay correct.
+//A cache follows a single stream of inputs into a single model. It is owned by the caller, not the model, so each stream
+//(or thread) computing with a shared model needs it's own.
+struct ETALER_EXPORT OverlapCache
+{
+	//Same as invertedCellActivity(x, ...). But incremental from the last call
+	Tensor cellActivity(const Tensor& x, const Tensor& reverse_index, const Tensor& permanences
+		, float connected_permanence, size_t active_threshold);
+
+	//Recomputes the overlaps of cells (a boolean mask) after their permanences have changed
+	void invalidate(const Tensor& cells, const Tensor& connections, const Tensor& permanences);
+
+	//The reverse index of connections. Built by the first call, for models not keeping one
+	const Tensor& reverseIndex(const Tensor& connections, const Shape& input_shape);
+
+	void clear();
+	bool has_value() const {return overlaps_.has_value();}
+
+protected:
+	Tensor last_input_;
+	Tensor overlaps_;
+	Tensor reverse_index_;
+	float connected_permanence_ = 0;
+};
+
+}
@@ -0,0 +1,172 @@
+#include "Pipeline.hpp"
+
+#include <tbb/flow_graph.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+using namespace et;
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+
+//A timestep travelling trough the graph
+struct PipelineMessage
+{
+	size_t t = 0;
+	Tensor x;
+	Clock::time_point start;
+};
+
+double secondsSince(Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void record(StageStats& stats, double seconds)
+{
+	stats.calls++;
+	stats.busy_seconds += seconds;
+	stats.max_seconds = std::max(stats.max_seconds, seconds);
+}
+
+}
+
+Pipeline& Pipeline::addStage(const std::string& name, StageFunction f)
+{
+	et_check(f != nullptr, "Stage " + name + " has no function");
+	stages_.push_back(std::move(f));
+	StageStats stats;
+	stats.name = name;
+	stats_.push_back(stats);
+	return *this;
+}
+
+Pipeline& Pipeline::addSpatialPooler(const std::string& name, SpatialPooler& sp, bool learn)
+{
+	regions_.push_back({&sp, learn});
+	return addStage(name, [&sp, learn](const Tensor& x) {
+		Tensor y = sp.compute(x);
+		if(learn)
+			sp.learn(x, y);
+		return y;
+	});
+}
+
+Pipeline& Pipeline::addTemporalMemory(const std::string& name, TemporalMemory& tm, bool learn)
+{
+	// Two state buffers swapped every timestep. So bursting doesn't allocate
+	auto last_active = std::make_shared<Tensor>();
+	auto active = std::make_shared<Tensor>();
+	regions_.push_back({&tm, learn});
+	return addStage(name, [&tm, learn, last_active, active](const Tensor& x) {
+		Tensor pred = tm.compute(x, *last_active, *active);
+		if(learn && last_active->has_value())
+			tm.learn(*active, *last_active);
+		std::swap(*last_active, *active);
+		return pred;
+	});
+}
+
+Pipeline& Pipeline::addClassifier(const std::string& name, const SDRClassifer& classifer, float density)
+{
+	return addStage(name, [&classifer, density](const Tensor& x) {
+		Tensor sdr = x.shape() == classifer.inputShape() ? x : x.sum(x.dimensions()-1, DType::Bool);
+		return Tensor((int)classifer.compute(sdr, density));
+	});
+}
+
+std::vector<Tensor> Pipeline::run(const std::vector<Tensor>& inputs)
+{
+	return runPipelines({this}, {inputs}).front();
+}
+
+void Pipeline::resetStats()
+{
+	for(auto& stats : stats_) {
+		std::string name = stats.name;
+		stats = StageStats();
+		stats.name = name;
+	}
+	total_stats_ = StageStats();
+	total_stats_.name = "total";
+}
+
+std::vector<std::vector<Tensor>> et::runPipelines(const std::vector<Pipeline*>& pipelines
+	, const std::vector<std::vector<Tensor>>& inputs)
+{
+	using namespace tbb::flow;
+	using Node = function_node<PipelineMessage, PipelineMessage>;
+	et_check(pipelines.size() == inputs.size(), "Expecting one list of inputs per pipeline. Got "
+		+ std::to_string(inputs.size()) + " for " + std::to_string(pipelines.size()) + " pipelines");
+	for(size_t i=0;i<pipelines.size();i++) {
+		et_check(pipelines[i] != nullptr);
+		et_check(std::count(pipelines.begin(), pipelines.end(), pipelines[i]) == 1, "A pipeline can only run once at a time");
+	}
+	// Every stage runs on it's own node. A region learning in one stage can't be read or learned by another at the same time
+	std::vector<std::pair<const void*, bool>> regions;
+	for(const Pipeline* p : pipelines)
+		regions.insert(regions.end(), p->regions_.begin(), p->regions_.end());
+	for(const auto& [region, learn] : regions) {
+		et_check(learn == false || std::count_if(regions.begin(), regions.end(), [region=region](const auto& r) {return r.first == region;}) == 1
+			, "A SpatialPooler or TemporalMemory that learns can only be in one stage of the pipelines running together");
+	}
+
+	std::vector<std::vector<Tensor>> results(pipelines.size());
+	graph g;
+	std::vector<std::unique_ptr<input_node<PipelineMessage>>> sources;
+	std::vector<std::unique_ptr<Node>> nodes;
+	for(size_t i=0;i<pipelines.size();i++) {
+		Pipeline& p = *pipelines[i];
+		const std::vector<Tensor>& xs = inputs[i];
+		results[i].resize(xs.size());
+
+		sources.push_back(std::make_unique<input_node<PipelineMessage>>(g, [&xs, t=size_t(0)](tbb::flow_control& fc) mutable {
+			if(t == xs.size()) {
+				fc.stop();
+				return PipelineMessage();
+			}
+			PipelineMessage msg{t, xs[t], Clock::now()};
+			t++;
+			return msg;
+		}));
+
+		// Serial nodes with a queue runs the timesteps one at a time and in the order they arrive. So stages can keep states
+		sender<PipelineMessage>* last = sources.back().get();
+		for(size_t j=0;j<p.stages_.size();j++) {
+			auto& f = p.stages_[j];
+			auto& stats = p.stats_[j];
+			nodes.push_back(std::make_unique<Node>(g, serial, [&f, &stats](PipelineMessage msg) {
+				auto start = Clock::now();
+				msg.x = f(msg.x);
+				record(stats, secondsSince(start));
+				return msg;
+			}));
+			make_edge(*last, *nodes.back());
+			last = nodes.back().get();
+		}
+
+		nodes.push_back(std::make_unique<Node>(g, serial, [&p, &out=results[i]](PipelineMessage msg) {
+			record(p.total_stats_, secondsSince(msg.start));
+			out[msg.t] = std::move(msg.x);
+			return msg;
+		}));
+		make_edge(*last, *nodes.back());
+	}
+
+	auto start = Clock::now();
+	for(auto& source : sources)
+		source->activate();
+	g.wait_for_all();
+
+	double wall_seconds = secondsSince(start);
+	for(auto p : pipelines) {
+		for(auto& stats : p->stats_)
+			stats.wall_seconds += wall_seconds;
+		p->total_stats_.wall_seconds += wall_seconds;
+	}
+	return results;
+}
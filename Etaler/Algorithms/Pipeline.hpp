@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Etaler/Core/Tensor.hpp"
+
+#include "SpatialPooler.hpp"
+#include "TemporalMemory.hpp"
+#include "SDRClassifer.hpp"
+
+#include "Etaler_export.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace et
+{
+
+//Counters of a stage in a Pipeline. They accumulate over runs until resetStats() is called
+struct StageStats
+{
+	std::string name;
+	size_t calls = 0; //Number of timesteps processed
+	double busy_seconds = 0; //Time spent inside the stage
+	double max_seconds = 0; //Longest single timestep
+	double wall_seconds = 0; //Wall time of the runs the stage took part in
+
+	double meanLatency() const { return calls == 0 ? 0 : busy_seconds/calls; }
+	//Timesteps per second
+	double throughput() const { return wall_seconds == 0 ? 0 : calls/wall_seconds; }
+};
+
+//A chain of regions (encoder -> SP -> TM -> classifier, etc..) processing a stream of inputs. Every stage runs on its own
+//node of a TBB flow graph. So while a stage works on timestep t, the stage before it can already work on timestep t+1.
+//Each stage still sees the timesteps one at a time and in order, thus stages may keep state between timesteps (ex: the TM).
+//The regions added are held by reference and must outlive the pipeline. Stages run concurrently, so a SpatialPooler or
+//TemporalMemory that learns can't be in any other stage of the pipelines running together (checked by runPipelines()).
+//Stages that don't learn only read the region and may share it. Regions used by the functions of addStage() can't be
+//checked and must be safe to use from several threads.
+struct ETALER_EXPORT Pipeline
+{
+	using StageFunction = std::function<Tensor(const Tensor&)>;
+
+	Pipeline& addStage(const std::string& name, StageFunction f);
+	//Outputs the active columns
+	Pipeline& addSpatialPooler(const std::string& name, SpatialPooler& sp, bool learn=true);
+	//Outputs the predictive cells. The last active cells are kept by the stage
+	Pipeline& addTemporalMemory(const std::string& name, TemporalMemory& tm, bool learn=true);
+	//Outputs the class id as an Int32 tensor. Cell states are reduced to columns first
+	Pipeline& addClassifier(const std::string& name, const SDRClassifer& classifer, float density);
+
+	//Feeds the inputs through the stages. Returns the output of the last stage for each input
+	std::vector<Tensor> run(const std::vector<Tensor>& inputs);
+
+	size_t numStages() const { return stages_.size(); }
+	const std::vector<StageStats>& stats() const { return stats_; }
+	//End to end counters. Latency is from a timestep entering the first stage to it leaving the last
+	const StageStats& totalStats() const { return total_stats_; }
+	void resetStats();
+
+protected:
+	friend ETALER_EXPORT std::vector<std::vector<Tensor>> runPipelines(const std::vector<Pipeline*>& pipelines
+		, const std::vector<std::vector<Tensor>>& inputs);
+	std::vector<StageFunction> stages_;
+	std::vector<StageStats> stats_;
+	StageStats total_stats_ = {"total"};
+	//The SpatialPoolers and TemporalMemorys used by the stages. And if the stage learns
+	std::vector<std::pair<const void*, bool>> regions_;
+};
+
+//Runs independent pipelines (ex: one per stream) concurrently in a single flow graph. inputs[i] is fed to pipelines[i].
+//A pipeline must not appear more than once, and a learning SpatialPooler or TemporalMemory must not be in more than one stage
+ETALER_EXPORT std::vector<std::vector<Tensor>> runPipelines(const std::vector<Pipeline*>& pipelines
+	, const std::vector<std::vector<Tensor>>& inputs);
+
+}
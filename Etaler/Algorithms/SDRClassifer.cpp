@@ -0,0 +1,272 @@
+#include "SDRClassifer.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <thread>
+
+using namespace et;
+
+struct alignas(64) SDRClassifer::Shard
+{
+	std::mutex mutex;
+	std::vector<int32_t> counts; // Allocated on first use
+	std::vector<int> num_patterns;
+	std::vector<uint8_t> dirty;
+};
+
+struct SDRClassifer::Snapshot
+{
+	Snapshot(Tensor mask, float density, uint64_t generation)
+		: mask(std::move(mask)), density(density), generation(generation)
+	{}
+
+	// The mask as a Bit tensor with each class padded to whole 64 bit words. Built on first use since only topk() needs it
+	const Tensor& packedMask() const
+	{
+		std::call_once(packed_once, [this]() {
+			intmax_t num_classes = mask.shape()[0];
+			intmax_t volume = mask.shape()[1];
+			Tensor padded = zeros({num_classes, (volume+63)/64*64}, DType::Bool, mask.backend());
+			padded.view({all(), range(volume)}) = mask;
+			packed_mask = padded.cast(DType::Bit);
+		});
+		return packed_mask;
+	}
+
+	Tensor mask; // Bool of shape {num_classes, input_shape.volume()}
+	float density;
+	uint64_t generation;
+
+private:
+	mutable std::once_flag packed_once;
+	mutable Tensor packed_mask;
+};
+
+// Threads are spread over the shards in the order they first add a pattern
+static size_t threadShardIndex()
+{
+	static std::atomic<size_t> next_index{0};
+	thread_local size_t index = next_index++;
+	return index;
+}
+
+SDRClassifer::SDRClassifer(Shape input_shape, size_t num_classes, Backend* backend)
+	: input_shape_(input_shape), num_classes_(num_classes), backend_(backend)
+	, num_shards_(std::max(std::thread::hardware_concurrency(), 1u))
+{
+	reset();
+}
+
+SDRClassifer::SDRClassifer(const SDRClassifer& other)
+	: num_shards_(other.num_shards_)
+{
+	*this = other;
+}
+
+SDRClassifer& SDRClassifer::operator= (const SDRClassifer& other)
+{
+	if(this == &other)
+		return *this;
+	input_shape_ = other.input_shape_;
+	num_classes_ = other.num_classes_;
+	backend_ = other.backend_;
+	reset();
+
+	std::lock_guard lock(other.merge_mutex_);
+	other.merge();
+	reference_ = other.reference_;
+	num_patterns_ = other.num_patterns_;
+	return *this;
+}
+
+SDRClassifer::~SDRClassifer() = default;
+
+void SDRClassifer::reset()
+{
+	shards_ = std::make_unique<Shard[]>(num_shards_);
+	reference_.assign(num_classes_*input_shape_.volume(), 0);
+	num_patterns_.assign(num_classes_, 0);
+	dirty_.assign(num_classes_, 1);
+	std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>());
+	generation_++;
+}
+
+void SDRClassifer::addPattern(const Tensor& sdr, size_t class_id)
+{
+	et_check(sdr.shape() == input_shape_, "Expecting a SDR of shape " + to_string(input_shape_) + ", got " + to_string(sdr.shape()));
+	et_check(sdr.dtype() == DType::Bool, "Expecting a SDR of Bool, got " + to_string(sdr.dtype()));
+	et_check(class_id < num_classes_, "Class " + std::to_string(class_id) + " out of range. The classifer has "
+		+ std::to_string(num_classes_) + " classes");
+
+	std::vector<uint8_t> bits = sdr.toHost<uint8_t>();
+	size_t volume = bits.size();
+	Shard& shard = shards_[threadShardIndex()%num_shards_];
+	{
+		std::lock_guard lock(shard.mutex);
+		if(shard.counts.empty()) {
+			shard.counts.assign(num_classes_*volume, 0);
+			shard.num_patterns.assign(num_classes_, 0);
+			shard.dirty.assign(num_classes_, 0);
+		}
+		int32_t* counts = shard.counts.data() + class_id*volume;
+		for(size_t i=0;i<volume;i++)
+			counts[i] += bits[i];
+		shard.num_patterns[class_id]++;
+		shard.dirty[class_id] = 1;
+	}
+	// After the counts are written. So a compute() that sees the new generation also sees the counts
+	generation_++;
+}
+
+void SDRClassifer::merge() const
+{
+	size_t volume = input_shape_.volume();
+	for(size_t i=0;i<num_shards_;i++) {
+		Shard& shard = shards_[i];
+		std::lock_guard lock(shard.mutex);
+		for(size_t c=0;c<shard.dirty.size();c++) {
+			if(shard.dirty[c] == 0)
+				continue;
+			int32_t* src = shard.counts.data() + c*volume;
+			int32_t* dst = reference_.data() + c*volume;
+			for(size_t j=0;j<volume;j++)
+				dst[j] += src[j];
+			std::fill(src, src+volume, 0);
+			num_patterns_[c] += shard.num_patterns[c];
+			shard.num_patterns[c] = 0;
+			shard.dirty[c] = 0;
+			dirty_[c] = 1;
+		}
+	}
+}
+
+std::shared_ptr<const SDRClassifer::Snapshot> SDRClassifer::snapshot(float density) const
+{
+	auto is_current = [&](const std::shared_ptr<const Snapshot>& s, uint64_t generation) {
+		return s != nullptr && s->generation == generation && s->density == density;
+	};
+	auto current = std::atomic_load(&snapshot_);
+	if(is_current(current, generation_.load()))
+		return current;
+
+	std::lock_guard lock(merge_mutex_);
+	// Read before merging. Patterns added after this are picked up by the next call
+	uint64_t generation = generation_.load();
+	current = std::atomic_load(&snapshot_);
+	if(is_current(current, generation))
+		return current;
+
+	merge();
+	const intmax_t volume = input_shape_.volume();
+	Tensor mask;
+	if(current == nullptr || current->density != density) {
+		mask = zeros({intmax_t(num_classes_), volume}, DType::Bool, backend_);
+		std::fill(dirty_.begin(), dirty_.end(), 1);
+	}
+	else // Other threads may still be using the old masks
+		mask = current->mask.copy();
+
+	for(size_t c=0;c<num_classes_;c++) {
+		if(dirty_[c] == 0)
+			continue;
+		Tensor counts = Tensor({volume}, reference_.data()+c*volume, backend_);
+		mask.view({intmax_t(c)}) = globalInhibition(counts, density);
+		dirty_[c] = 0;
+	}
+
+	auto res = std::make_shared<const Snapshot>(mask, density, generation);
+	std::atomic_store(&snapshot_, std::shared_ptr<const Snapshot>(res));
+	return res;
+}
+
+size_t SDRClassifer::compute(const Tensor& x, float density) const
+{
+	et_check(x.size() == (size_t)input_shape_.volume(), "Expecting an input of shape " + to_string(input_shape_) + ", got " + to_string(x.shape()));
+	et_check(num_classes_ != 0, "The classifer has no classes");
+
+	auto s = snapshot(density);
+	const auto overlap = logical_and(s->mask, x.reshape({1, intmax_t(x.size())}))
+		.sum(1)
+		.toHost<int>();
+
+	et_assert(overlap.size() == num_classes_);
+	auto it = std::max_element(overlap.begin(), overlap.end());
+	return std::distance(overlap.begin(), it);
+}
+
+std::pair<Tensor, Tensor> SDRClassifer::topk(const Tensor& x, float density, size_t k) const
+{
+	bool batched = x.shape() != input_shape_;
+	if(batched) {
+		Shape sample_shape = x.shape();
+		if(sample_shape.size() != 0)
+			sample_shape.erase(sample_shape.begin());
+		et_check(sample_shape == input_shape_, "Input tensor shape " + to_string(x.shape()) +" does not match expected shape "
+			+ to_string(input_shape_) + " or [batch] + " + to_string(input_shape_));
+	}
+	et_check(k != 0 && k <= num_classes_, "Cannot pick the top " + std::to_string(k) + " of " + std::to_string(num_classes_) + " classes");
+
+	auto s = snapshot(density);
+	Tensor input = batched ? x : x.reshape(Shape{1} + input_shape_);
+	const std::vector<int32_t> overlaps = batchMaskCellActivity(input, s->packedMask(), 0).toHost<int32_t>();
+
+	// Ties go to the lower class id, same as compute()
+	size_t num_samples = input.shape()[0];
+	std::vector<int32_t> ids(num_samples*k);
+	std::vector<int32_t> scores(num_samples*k);
+	std::vector<int32_t> order(num_classes_);
+	for(size_t i=0;i<num_samples;i++) {
+		const int32_t* overlap = overlaps.data() + i*num_classes_;
+		std::iota(order.begin(), order.end(), 0);
+		std::partial_sort(order.begin(), order.begin()+k, order.end(), [overlap](int32_t a, int32_t b) {
+			return overlap[a] > overlap[b] || (overlap[a] == overlap[b] && a < b);
+		});
+		for(size_t j=0;j<k;j++) {
+			ids[i*k+j] = order[j];
+			scores[i*k+j] = overlap[order[j]];
+		}
+	}
+
+	Shape result_shape = {intmax_t(num_samples), intmax_t(k)};
+	return {Tensor(result_shape, ids.data(), x.backend()), Tensor(result_shape, scores.data(), x.backend())};
+}
+
+std::vector<int> SDRClassifer::numPatterns() const
+{
+	std::lock_guard lock(merge_mutex_);
+	merge();
+	return num_patterns_;
+}
+
+Tensor SDRClassifer::reference() const
+{
+	std::lock_guard lock(merge_mutex_);
+	merge();
+	return Tensor(Shape{intmax_t(num_classes_)}+input_shape_, reference_.data(), backend_);
+}
+
+StateDict SDRClassifer::states() const
+{
+	return {{"input_shape", input_shape_}, {"reference", reference()}, {"num_patterns", numPatterns()}};
+}
+
+void SDRClassifer::loadState(const StateDict& states)
+{
+	input_shape_ = std::any_cast<Shape>(states.at("input_shape"));
+	Tensor reference = std::any_cast<Tensor>(states.at("reference"));
+	std::vector<int> num_patterns = std::any_cast<std::vector<int>>(states.at("num_patterns"));
+	et_check(reference.shape() == Shape{intmax_t(num_patterns.size())}+input_shape_, "Reference of shape " + to_string(reference.shape())
+		+ " does not match the input shape and number of classes");
+
+	num_classes_ = num_patterns.size();
+	reset();
+	reference_ = reference.toHost<int32_t>();
+	num_patterns_ = num_patterns;
+}
+
+SDRClassifer SDRClassifer::to(Backend* b) const
+{
+	SDRClassifer c = *this;
+	c.backend_ = b;
+	return c;
+}
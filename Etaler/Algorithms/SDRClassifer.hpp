@@ -2,106 +2,76 @@
 
 #include <Etaler/Core/Tensor.hpp>
 #include <Etaler/Core/Serialize.hpp>
+#include <Etaler/Core/DefaultBackend.hpp>
 
 #include "Etaler_export.h"
 
-#include <vector>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 namespace et
 {
 
+// Safe to use from multiple threads. addPattern() only adds to one of several shards of counters, picked by the calling
+// thread, so writers rarely wait on each other. compute() merges the shards when patterns have been added and rebuilds
+// the masks of the classes that changed. The input is then compared against all classes in one batched operation.
+// Readers never block each other once the masks are up to date. loadState() and assignment are not thread safe
 struct ETALER_EXPORT SDRClassifer
 {
-	SDRClassifer() = default;
-	SDRClassifer(Shape input_shape, size_t num_classes)
-		: input_shape_(input_shape), reference_(zeros(Shape{(intmax_t)num_classes}+input_shape
-			, DType::Int32))
-		, num_patterns_(num_classes)
-	{
-	}
-
-	size_t numCategories() const
-	{
-		return num_patterns_.size();
-	}
-
-	void addPattern(const Tensor& sdr, size_t class_id)
-	{
-		et_assert(sdr.shape() == input_shape_);
-		et_assert(sdr.dtype() == DType::Bool);
-		et_assert(class_id < num_patterns_.size());
-
-		dirty_flag_ = true;
-		reference_.view({(intmax_t)class_id}) = reference_.view({(intmax_t)class_id}) + sdr;
-		num_patterns_[class_id]++;
-	}
-
-	size_t compute(const Tensor& x, float density) const
-	{
-		const intmax_t num_classes = num_patterns_.size();
-
-		// Grab a reference to ensure the current `mask_` isn't released in the case of race condition.
-		// Then check if new patterns have been added. If so, recalculate the mask
-		Tensor mask = mask_;
-		if(dirty_flag_ == true || density_ != density) {
-			mask_ = zeros_like(reference_.reshape({num_classes, input_shape_.volume()})).cast(DType::Bool);
-			for(intmax_t i=0;i<num_classes;i++)
-				mask_.view({i}) = globalInhibition(reference_.view({i}).flatten(), density);
-			mask = mask_;
-			density_ = density;
-			dirty_flag_ = false;
-		}
-
-		assert(mask_.has_value());
-		const auto overlap = logical_and(mask, x.reshape(Shape{1}+intmax_t(x.size())))
-			.reshape({intmax_t(num_classes), input_shape_.volume()})
-			.sum(1)
-			.toHost<int>();
-
-		et_assert(overlap.size() == size_t(num_classes));
-		auto it = std::max_element(overlap.begin(), overlap.end());
-		return std::distance(overlap.begin(), it);
-	}
-
-	StateDict states() const
-	{
-		return {{"input_shape", input_shape_}, {"reference", reference_}, {"num_patterns", num_patterns_}};
-	}
-
-	void loadState(const StateDict& states)
-	{
-		input_shape_ = std::any_cast<Shape>(states.at("input_shape"));
-		reference_ = std::any_cast<Tensor>(states.at("reference"));
-		num_patterns_ = std::any_cast<std::vector<int>>(states.at("num_patterns"));
-	}
-
-	SDRClassifer to(Backend* b) const
-	{
-		SDRClassifer c = *this;
-		assert(c.reference_.size() == reference_.size());
-		c.reference_ = reference_.to(b);
-		return c;
-	}
-
-	SDRClassifer copy() const
-	{
-		if(reference_.size() == 0)
-			return *this;
-		return to(reference_.backend());
-	}
+	SDRClassifer() : SDRClassifer(Shape(), 0) {}
+	SDRClassifer(Shape input_shape, size_t num_classes, Backend* backend=defaultBackend());
+	SDRClassifer(const SDRClassifer& other);
+	SDRClassifer& operator= (const SDRClassifer& other);
+	~SDRClassifer();
+
+	size_t numCategories() const { return num_classes_; }
+	const Shape& inputShape() const { return input_shape_; }
+
+	void addPattern(const Tensor& sdr, size_t class_id);
+	size_t compute(const Tensor& x, float density) const;
+	// Classifies a batch of SDRs of shape [batch] + input_shape (or a single one) at once, using bit packed masks. Returns the
+	// k best classes of each SDR, best first, and their overlaps with the class. Both are Int32 tensors of shape {batch, k}.
+	// Only supported by the CPU backend for now
+	std::pair<Tensor, Tensor> topk(const Tensor& x, float density, size_t k=1) const;
+
+	// How many patterns are added to each class
+	std::vector<int> numPatterns() const;
+	// How many times each bit is on in the patterns of each class. Of shape [num_classes] + input_shape
+	Tensor reference() const;
+
+	StateDict states() const;
+	void loadState(const StateDict& states);
+
+	SDRClassifer to(Backend* b) const;
+	SDRClassifer copy() const { return *this; }
+
+protected:
+	struct Shard;
+	struct Snapshot;
+
+	// Moves the counts in the shards to reference_. merge_mutex_ must be held
+	void merge() const;
+	std::shared_ptr<const Snapshot> snapshot(float density) const;
+	void reset();
 
 	Shape input_shape_;
-	Tensor reference_;
-	std::vector<int> num_patterns_;
-
-private:
-	// mask_ and dirty_flag_ are variables for caching expensive-to-compute values
-	// that is used in the inference process
-	// NOTE: They *should* be thrad safe. (But the internal functions are parallel anyway)
-	mutable Tensor mask_;
-	mutable bool dirty_flag_ = true;
-	mutable float density_ = -1.f;
+	size_t num_classes_ = 0;
+	Backend* backend_ = nullptr;
+
+	size_t num_shards_ = 0;
+	std::unique_ptr<Shard[]> shards_;
+	std::atomic<uint64_t> generation_{0}; // Increased by every addPattern()
+
+	// The merged counts. Guarded by merge_mutex_
+	mutable std::mutex merge_mutex_;
+	mutable std::vector<int32_t> reference_;
+	mutable std::vector<int> num_patterns_;
+	mutable std::vector<uint8_t> dirty_; // Classes with outdated masks
+
+	// The masks used by compute(). Replaced as a whole (through std::atomic_load/store) so readers never see a partial update
+	mutable std::shared_ptr<const Snapshot> snapshot_;
 };
 
 // SDRClassifer in Etaler is CLAClassifer in NuPIC
@@ -0,0 +1,165 @@
+#include "SparseSynapses.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+using namespace et;
+
+SparseSynapses::SparseSynapses(const Shape& cell_shape, size_t max_synapses_per_cell, DType perm_type, Backend* backend)
+	: max_synapses_per_cell_(max_synapses_per_cell)
+{
+	et_check(max_synapses_per_cell > 0);
+	rows_ = zeros(cell_shape + 3, DType::Int32, backend);
+	//Some initial storage. Grown as synapses are added
+	intmax_t storage_size = std::max(cell_shape.volume(), intmax_t(1));
+	indices_ = zeros({storage_size}, DType::Int32, backend);
+	permanences_ = zeros({storage_size}, perm_type, backend);
+}
+
+SparseSynapses SparseSynapses::fromDense(const Tensor& connections, const Tensor& permanences)
+{
+	et_check(connections.dimensions() >= 2);
+	et_check(connections.shape() == permanences.shape());
+	Shape cell_shape = connections.shape();
+	size_t max_synapses_per_cell = cell_shape.back();
+	cell_shape.pop_back();
+	size_t num_cells = cell_shape.volume();
+
+	std::vector<int32_t> conns = connections.toHost<int32_t>();
+	std::vector<float> perms = permanences.cast(DType::Float).toHost<float>();
+
+	std::vector<int32_t> rows(num_cells*3);
+	std::vector<int32_t> indices;
+	std::vector<float> strengths;
+	std::vector<size_t> order;
+	for(size_t i=0;i<num_cells;i++) {
+		order.clear();
+		for(size_t j=i*max_synapses_per_cell;j<(i+1)*max_synapses_per_cell;j++) {
+			if(conns[j] != -1)
+				order.push_back(j);
+		}
+		std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {return conns[a] < conns[b];});
+
+		rows[i*3] = indices.size();
+		rows[i*3+1] = order.size();
+		rows[i*3+2] = order.size();
+		for(size_t j : order) {
+			indices.push_back(conns[j]);
+			strengths.push_back(perms[j]);
+		}
+	}
+	if(indices.empty() == true) {
+		indices.push_back(-1);
+		strengths.push_back(0);
+	}
+
+	Backend* backend = connections.backend();
+	SparseSynapses s;
+	s.max_synapses_per_cell_ = max_synapses_per_cell;
+	s.rows_ = Tensor(cell_shape + 3, rows.data(), backend);
+	s.indices_ = Tensor({intmax_t(indices.size())}, indices.data(), backend);
+	s.permanences_ = Tensor({intmax_t(strengths.size())}, strengths.data(), backend).cast(permanences.dtype());
+	return s;
+}
+
+std::pair<Tensor, Tensor> SparseSynapses::toDense() const
+{
+	Shape cell_shape = cellShape();
+	size_t num_cells = cell_shape.volume();
+	std::vector<int32_t> rows = rows_.toHost<int32_t>();
+	std::vector<int32_t> indices = indices_.toHost<int32_t>();
+	std::vector<float> strengths = permanences_.cast(DType::Float).toHost<float>();
+
+	std::vector<int32_t> conns(num_cells*max_synapses_per_cell_, -1);
+	std::vector<float> perms(num_cells*max_synapses_per_cell_, 0);
+	for(size_t i=0;i<num_cells;i++) {
+		size_t offset = rows[i*3];
+		size_t size = rows[i*3+1];
+		std::copy(indices.begin()+offset, indices.begin()+offset+size, conns.begin()+i*max_synapses_per_cell_);
+		std::copy(strengths.begin()+offset, strengths.begin()+offset+size, perms.begin()+i*max_synapses_per_cell_);
+	}
+
+	Shape s = cell_shape + intmax_t(max_synapses_per_cell_);
+	return {Tensor(s, conns.data(), backend()), Tensor(s, perms.data(), backend()).cast(permanences_.dtype())};
+}
+
+Tensor SparseSynapses::cellActivity(const Tensor& x, float connected_permanence, size_t active_threshold) const
+{
+	Tensor input = ravel(binaryInput(x));
+	return x.backend()->sparseCellActivity(input.pimpl(), rows_.pimpl(), indices_.pimpl(), permanences_.pimpl()
+		, connected_permanence, active_threshold);
+}
+
+void SparseSynapses::learnCorrilation(const Tensor& x, const Tensor& learn, float perm_inc, float perm_dec)
+{
+	x.backend()->sparseLearnCorrilation(x.pimpl(), learn.pimpl(), rows_.pimpl(), indices_.pimpl(), permanences_.pimpl()
+		, perm_inc, perm_dec);
+}
+
+void SparseSynapses::growSynapses(const Tensor& x, const Tensor& y, float initial_perm)
+{
+	std::shared_ptr<TensorImpl> indices = indices_.shared_pimpl();
+	std::shared_ptr<TensorImpl> permanences = permanences_.shared_pimpl();
+	x.backend()->sparseGrowSynapses(x.pimpl(), y.pimpl(), rows_.pimpl(), indices, permanences, initial_perm, max_synapses_per_cell_);
+	indices_ = Tensor(indices);
+	permanences_ = Tensor(permanences);
+}
+
+void SparseSynapses::decaySynapses(float threshold)
+{
+	backend()->sparseDecaySynapses(rows_.pimpl(), indices_.pimpl(), permanences_.pimpl(), threshold);
+}
+
+Shape SparseSynapses::cellShape() const
+{
+	Shape s = rows_.shape();
+	s.pop_back();
+	return s;
+}
+
+size_t SparseSynapses::numSynapses() const
+{
+	std::vector<int32_t> rows = rows_.toHost<int32_t>();
+	size_t sum = 0;
+	for(size_t i=1;i<rows.size();i+=3)
+		sum += rows[i];
+	return sum;
+}
+
+SparseSynapses SparseSynapses::compact() const
+{
+	std::vector<int32_t> rows = rows_.toHost<int32_t>();
+	std::vector<int32_t> indices = indices_.toHost<int32_t>();
+	std::vector<float> strengths = permanences_.cast(DType::Float).toHost<float>();
+
+	std::vector<int32_t> new_indices;
+	std::vector<float> new_strengths;
+	for(size_t i=0;i<rows.size();i+=3) {
+		size_t offset = rows[i];
+		size_t size = rows[i+1];
+		rows[i] = new_indices.size();
+		rows[i+2] = size;
+		new_indices.insert(new_indices.end(), indices.begin()+offset, indices.begin()+offset+size);
+		new_strengths.insert(new_strengths.end(), strengths.begin()+offset, strengths.begin()+offset+size);
+	}
+	if(new_indices.empty() == true) {
+		new_indices.push_back(-1);
+		new_strengths.push_back(0);
+	}
+
+	SparseSynapses s;
+	s.max_synapses_per_cell_ = max_synapses_per_cell_;
+	s.rows_ = Tensor(rows_.shape(), rows.data(), backend());
+	s.indices_ = Tensor({intmax_t(new_indices.size())}, new_indices.data(), backend());
+	s.permanences_ = Tensor({intmax_t(new_strengths.size())}, new_strengths.data(), backend()).cast(permanences_.dtype());
+	return s;
+}
+
+SparseSynapses SparseSynapses::to(Backend* b) const
+{
+	SparseSynapses s = *this;
+	s.rows_ = rows_.to(b);
+	s.indices_ = indices_.to(b);
+	s.permanences_ = permanences_.to(b);
+	return s;
+}
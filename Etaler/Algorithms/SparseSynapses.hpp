@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Etaler/Core/Shape.hpp"
+#include "Etaler/Core/Backend.hpp"
+#include "Etaler/Core/Error.hpp"
+#include "Etaler/Core/Tensor.hpp"
+#include "Etaler/Core/DefaultBackend.hpp"
+
+#include "Etaler_export.h"
+
+namespace et
+{
+
+//Synapses stored in a compressed sparse row (CSR) layout. The dense layout used by the algorithms stores max_synapses_per_cell
+//slots for every cell, padded with -1. Here each cell only stores the synapses it has. rows holds the {offset, size, capacity}
+//of each cell. The synapses of a cell are indices[offset, offset+size) (sorted), with their permanences at the same place.
+//Cells running out of capacity get their capacity doubled and are moved to the end of the storage, so the memory used follows
+//the number of synapses that actually exist.
+struct ETALER_EXPORT SparseSynapses
+{
+	SparseSynapses() = default;
+	SparseSynapses(const Shape& cell_shape, size_t max_synapses_per_cell, DType perm_type=DType::Float, Backend* backend=defaultBackend());
+
+	//Conversion from and to the dense layout
+	static SparseSynapses fromDense(const Tensor& connections, const Tensor& permanences);
+	std::pair<Tensor, Tensor> toDense() const;
+
+	//Same as the functions of the same name in Tensor.hpp
+	Tensor cellActivity(const Tensor& x, float connected_permanence, size_t active_threshold) const;
+	void learnCorrilation(const Tensor& x, const Tensor& learn, float perm_inc, float perm_dec);
+	void growSynapses(const Tensor& x, const Tensor& y, float initial_perm);
+	void decaySynapses(float threshold);
+
+	Shape cellShape() const;
+	size_t maxSynapsesPerCell() const {return max_synapses_per_cell_;}
+	size_t numSynapses() const;
+	bool has_value() const {return rows_.has_value();}
+	Backend* backend() const {return rows_.backend();}
+
+	//A copy storing only the synapses that exist. Rows are laid out in order with no spare capacity. What is left of moved
+	//rows and removed synapses is dropped
+	SparseSynapses compact() const;
+
+	SparseSynapses to(Backend* b) const;
+	SparseSynapses copy() const {return to(backend());}
+
+	Tensor rows_;
+	Tensor indices_;
+	Tensor permanences_;
+	size_t max_synapses_per_cell_ = 0;
+};
+
+}
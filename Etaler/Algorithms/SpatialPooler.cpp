@@ -1,6 +1,7 @@
 #include "SpatialPooler.hpp"
 #include <Etaler/Core/Random.hpp>
 #include "Boost.hpp"
+#include <Etaler/Core/Expression.hpp>
 
 using namespace et;
 
@@ -25,20 +26,71 @@ SpatialPooler::SpatialPooler(const Shape& input_shape, const Shape& output_shape
 
 Tensor SpatialPooler::compute(const Tensor& x) const
 {
-	et_check(x.shape() == input_shape_, "Input tensor shape " + to_string(x.shape()) +" does not match expected shape " + to_string(input_shape_));
+	if(x.shape() != input_shape_)
+		return computeBatch(x);
+
+	Tensor activity = [&](){
+		if(sparse_input_ == false)
+			return cellActivity(x, connections_, permanences_, connected_permanence_, active_threshold_, false);
 
-	Tensor activity = cellActivity(x, connections_, permanences_
-		, connected_permanence_, active_threshold_, false);
+		et_assert(reverse_index_.has_value());
+		return invertedCellActivity(x, reverse_index_, permanences_, connected_permanence_, active_threshold_);
+	}();
+	return activate(activity);
+}
+
+Tensor SpatialPooler::compute(const Tensor& x, OverlapCache& cache) const
+{
+	// Batches are not cached
+	if(x.shape() != input_shape_)
+		return computeBatch(x);
 
+	const Tensor& reverse_index = reverse_index_.has_value() ? reverse_index_ : cache.reverseIndex(connections_, input_shape_);
+	return activate(cache.cellActivity(x, reverse_index, permanences_, connected_permanence_, active_threshold_));
+}
+
+Tensor SpatialPooler::activate(Tensor activity) const
+{
 	if(boost_factor_ != 0)
 		activity = boost(activity, average_activity_, global_density_, boost_factor_);
 
-	Tensor res = globalInhibition(activity, global_density_);
+	Tensor res = inhibition_radius_ == 0 ? globalInhibition(activity, global_density_)
+		: localInhibition(activity, global_density_, inhibition_radius_);
 	assert(output_shape_ == res.shape());
 
 	return res;
 }
 
+void SpatialPooler::buildReverseIndex()
+{
+	if(sparse_input_ && reverse_index_.has_value() == false)
+		reverse_index_ = reverseSynapseIndex(connections_, input_shape_);
+}
+
+Tensor SpatialPooler::computeBatch(const Tensor& x) const
+{
+	Shape sample_shape = x.shape();
+	if(sample_shape.size() != 0)
+		sample_shape.erase(sample_shape.begin());
+	et_check(sample_shape == input_shape_, "Input tensor shape " + to_string(x.shape()) +" does not match expected shape "
+		+ to_string(input_shape_) + " or [batch] + " + to_string(input_shape_));
+
+	Tensor activity = batchCellActivity(x, connections_, permanences_, connected_permanence_, active_threshold_, false);
+
+	if(boost_factor_ != 0)
+		activity = boost(activity, average_activity_, global_density_, boost_factor_);
+
+	if(inhibition_radius_ == 0)
+		return batchGlobalInhibition(activity, global_density_);
+
+	svector<Tensor> res;
+	for(intmax_t i=0;i<activity.shape()[0];i++) {
+		Tensor y = localInhibition(activity.view({i}).realize(), global_density_, inhibition_radius_);
+		res.push_back(y.reshape(Shape{1} + output_shape_));
+	}
+	return cat(res, 0);
+}
+
 void SpatialPooler::learn(const Tensor& x, const Tensor& y)
 {
 	et_assert(x.shape() == input_shape_);
@@ -46,7 +98,44 @@ void SpatialPooler::learn(const Tensor& x, const Tensor& y)
 	learnCorrilation(x, y, connections_, permanences_, permanence_inc_, permanence_dec_);
 
 	if(boost_factor_ != 0)
-		average_activity_ = average_activity_*0.9f + y * 0.1f;
+		(lazy(average_activity_)*0.9f + lazy(y)*0.1f).realize(average_activity_);
+}
+
+void SpatialPooler::learn(const Tensor& x, const Tensor& y, OverlapCache& cache)
+{
+	learn(x, y);
+	// Only the cells that learned have their permanences changed
+	cache.invalidate(y, connections_, permanences_);
+}
+
+Tensor SpatialPooler::step(const Tensor& x, OverlapCache& cache, bool learn)
+{
+	et_check(x.shape() == input_shape_, "Input tensor shape " + to_string(x.shape()) +" does not match expected shape " + to_string(input_shape_));
+	Tensor y = compute(x, cache);
+	if(learn)
+		this->learn(x, y, cache);
+	return y;
+}
+
+Tensor SpatialPooler::step(const Tensor& x, bool learn)
+{
+	et_check(x.shape() == input_shape_, "Input tensor shape " + to_string(x.shape()) +" does not match expected shape " + to_string(input_shape_));
+
+	// The fused kernel scans every synapse anyway. No point doing that on sparse inputs
+	// And it only does global inhibition
+	if(sparse_input_ == true || inhibition_radius_ != 0) {
+		Tensor y = compute(x);
+		if(learn)
+			this->learn(x, y);
+		return y;
+	}
+
+	Tensor y = spatialPoolerStep(x, connections_, permanences_, boost_factor_ != 0 ? average_activity_ : Tensor()
+		, connected_permanence_, active_threshold_, global_density_, boost_factor_, learn, permanence_inc_, permanence_dec_);
+
+	if(learn && boost_factor_ != 0)
+		(lazy(average_activity_)*0.9f + lazy(y)*0.1f).realize(average_activity_);
+	return y;
 }
 
 void SpatialPooler::loadState(const StateDict& states)
@@ -62,6 +151,10 @@ void SpatialPooler::loadState(const StateDict& states)
 	permanences_ = std::any_cast<Tensor>(states.at("permanences"));
 	average_activity_ = std::any_cast<Tensor>(states.at("average_activity"));
 	boost_factor_ = std::any_cast<float>(states.at("boost_factor"));
+	// States saved by older versions don't have this
+	inhibition_radius_ = states.count("inhibition_radius") == 0 ? 0 : std::any_cast<int>(states.at("inhibition_radius"));
+	reverse_index_ = Tensor();
+	buildReverseIndex();
 }
 
 SpatialPooler SpatialPooler::to(Backend* b) const
@@ -70,6 +163,8 @@ SpatialPooler SpatialPooler::to(Backend* b) const
 	sp.connections_ = connections_.to(b);
 	sp.permanences_ = permanences_.to(b);
 	sp.average_activity_ = average_activity_.to(b);
+	sp.reverse_index_ = Tensor();
+	sp.buildReverseIndex();
 
 	return sp;
 }
@@ -11,6 +11,8 @@
 #include "Etaler/Core/Serialize.hpp"
 #include "Etaler/Core/DefaultBackend.hpp"
 #include "Synapse.hpp"
+#include "OverlapCache.hpp"
+#include "Frozen.hpp"
 
 #include "Etaler_export.h"
 
@@ -23,10 +25,21 @@ struct ETALER_EXPORT SpatialPooler
 	SpatialPooler(const Shape& input_shape, const Shape& output_shape, float potential_pool_pct=0.75, size_t seed=42
 		, float global_density = 0.15, float boost_factor = 0, Backend* b = defaultBackend());
 
+	// x can either be a single SDR of input_shape or a batch of them of shape [batch] + input_shape
 	Tensor compute(const Tensor& x) const;
 
 	void learn(const Tensor& x, const Tensor& y);
 
+	// Same as calling compute() and then learn(). But done in a single pass when the backend supports it
+	Tensor step(const Tensor& x, bool learn=true);
+
+	// Incremental variants for a stream of similar inputs. cache remembers the last input of the stream and the overlap of
+	// every column with it, so only the synapses of the bits that changed are visited. The cache is single stream and
+	// owned by the caller. Learn through learn(x, y, cache) and clear() the cache after changing the SP in any other way
+	Tensor compute(const Tensor& x, OverlapCache& cache) const;
+	void learn(const Tensor& x, const Tensor& y, OverlapCache& cache);
+	Tensor step(const Tensor& x, OverlapCache& cache, bool learn=true);
+
 	void setPermanenceInc(float inc) { permanence_inc_ = inc; }
 	float permanenceInc() const {return permanence_inc_;}
 
@@ -45,16 +58,28 @@ struct ETALER_EXPORT SpatialPooler
 	void setBoostingFactor(float f) { boost_factor_ = f; }
 	float boostFactor() const { return boost_factor_; }
 
+	// 0 means global inhibition. Otherwise columns only compete within this radius. Useful for topological SPs
+	void setInhibitionRadius(size_t radius) { inhibition_radius_ = radius; }
+	size_t inhibitionRadius() const { return inhibition_radius_; }
+
+	// When enabled, compute() only visits the synapses connected to active input bits. Faster for sparse inputs
+	void setSparseInput(bool enable) { sparse_input_ = enable; buildReverseIndex(); }
+	bool sparseInput() const { return sparse_input_; }
+
 	Tensor connections() const {return connections_;}
 	Tensor permanences() const {return permanences_;}
 
+	// Permanences can be stored as Float, Half or UNorm8 (8 bit fixed point)
+	void setPermanenceType(DType dtype) { permanences_ = permanences_.cast(dtype); }
+	DType permanenceType() const { return permanences_.dtype(); }
+
 	StateDict states() const
 	{
 		return {{"input_shape", input_shape_}, {"output_shape", output_shape_}, {"connections", connections_}
 			, {"permanences", permanences_}, {"permanence_inc", permanence_inc_}, {"permanence_dec", permanence_dec_}
 			, {"connected_permanence", connected_permanence_}, {"active_threshold", (int)active_threshold_}
 			, {"global_density", global_density_}, {"average_activity", average_activity_}
-			, {"boost_factor", boost_factor_}};
+			, {"boost_factor", boost_factor_}, {"inhibition_radius", (int)inhibition_radius_}};
 	}
 
 
@@ -67,6 +92,14 @@ struct ETALER_EXPORT SpatialPooler
 	{
 		return to(connections_.backend());
 	}
+
+	// An inference only snapshot. Smaller and faster to compute, but can't learn
+	FrozenSpatialPooler freeze() const { return FrozenSpatialPooler(*this); }
+	Tensor computeBatch(const Tensor& x) const;
+	// Boosting and inhibition of the column activities
+	Tensor activate(Tensor activity) const;
+	// Builds reverse_index_ if an enabled mode needs it and it doesn't exist
+	void buildReverseIndex();
 //protected:
 	float permanence_inc_ = 0.1;
 	float permanence_dec_ = 0.1;
@@ -74,12 +107,19 @@ struct ETALER_EXPORT SpatialPooler
 	size_t active_threshold_ = 5;
 	float global_density_ = 0.1;
 	float boost_factor_ = 0;
+	size_t inhibition_radius_ = 0;
+	bool sparse_input_ = false;
 
 	Shape input_shape_;
 	Shape output_shape_;
 	Tensor connections_;
 	Tensor average_activity_;
 	Tensor permanences_;
+
+	// Built when sparse input is enabled (not in compute(), so concurrent compute() calls only read it). The SpatialPooler
+	// never grows or prunes synapses, so it is only rebuilt where connections_ is replaced: loadState() and to().
+	// Modifying connections() in place leaves it stale
+	Tensor reverse_index_;
 };
 
 
@@ -2,9 +2,15 @@
 
 using namespace et;
 
-TemporalMemory::TemporalMemory(const Shape& input_shape, size_t cells_per_column, size_t max_synapses_per_cell, Backend* backend)
+TemporalMemory::TemporalMemory(const Shape& input_shape, size_t cells_per_column, size_t max_synapses_per_cell, Backend* backend
+	, bool sparse_synapses)
 	:input_shape_(input_shape)
 {
+	if(sparse_synapses) {
+		sparse_synapses_ = SparseSynapses(input_shape + cells_per_column, max_synapses_per_cell, DType::Float, backend);
+		return;
+	}
+
 	Shape connection_shape = input_shape + cells_per_column + max_synapses_per_cell;
 
 	connections_ = constant(connection_shape, -1, backend);
@@ -13,23 +19,54 @@ TemporalMemory::TemporalMemory(const Shape& input_shape, size_t cells_per_column
 
 std::pair<Tensor, Tensor> TemporalMemory::compute(const Tensor& x, const Tensor& last_state)
 {
-	et_check(x.shape() == input_shape_, "Input tensor shape " + to_string(x.shape()) +" does not match expected shape " + to_string(input_shape_));
 	Tensor active_cells;
-	if(last_state.has_value() == true)
-		active_cells = burst(x, last_state);
-	else
-		active_cells = burst(x, zeros(x.shape()+cellsPerColumn(), DType::Bool, x.backend()));
-	Tensor activity = cellActivity(active_cells, connections_, permanences_, connected_permanence_, active_threshold_);
-	Tensor predictive_cells = cast(activity, DType::Bool);
-
+	Tensor predictive_cells = compute(x, last_state, active_cells);
 	return {predictive_cells, active_cells};
+}
 
+Tensor TemporalMemory::compute(const Tensor& x, const Tensor& last_state, Tensor& active_cells)
+{
+	bool batched = x.shape() != input_shape_;
+	if(batched) {
+		Shape sample_shape = x.shape();
+		if(sample_shape.size() != 0)
+			sample_shape.erase(sample_shape.begin());
+		et_check(sample_shape == input_shape_, "Input tensor shape " + to_string(x.shape()) +" does not match expected shape "
+			+ to_string(input_shape_) + " or [batch] + " + to_string(input_shape_));
+	}
+
+	Tensor state = last_state.has_value() ? last_state : zeros(x.shape()+cellsPerColumn(), x.dtype(), x.backend());
+	if(active_cells.has_value() && active_cells.shape() == state.shape() && active_cells.dtype() == state.dtype())
+		burst(x, state, active_cells);
+	else
+		active_cells = burst(x, state);
+	Tensor activity;
+	if(sparse() && batched) {
+		svector<Tensor> activities;
+		for(intmax_t i=0;i<x.shape()[0];i++) {
+			Tensor a = sparse_synapses_.cellActivity(active_cells.view({i}), connected_permanence_, active_threshold_);
+			activities.push_back(a.reshape(Shape{1} + a.shape()));
+		}
+		activity = cat(activities, 0);
+	}
+	else if(sparse())
+		activity = sparse_synapses_.cellActivity(active_cells, connected_permanence_, active_threshold_);
+	else if(batched)
+		activity = batchCellActivity(active_cells, connections_, permanences_, connected_permanence_, active_threshold_);
+	else
+		activity = cellActivity(active_cells, connections_, permanences_, connected_permanence_, active_threshold_);
+	return cast(activity, active_cells.dtype());
 }
 
 void TemporalMemory::learn(const Tensor& active_cells, const Tensor& last_active)
 {
 	Tensor learning_cells = reverseBurst(active_cells);
 
+	if(sparse()) {
+		sparse_synapses_.learnCorrilation(last_active, learning_cells, permanence_inc_, permanence_dec_);
+		sparse_synapses_.growSynapses(last_active, learning_cells, initial_permanence_);
+		return;
+	}
 	learnCorrilation(last_active, learning_cells, connections_, permanences_, permanence_inc_, permanence_dec_);
 	growSynapses(last_active, learning_cells, connections_, permanences_, initial_permanence_);
 
@@ -42,6 +79,16 @@ void TemporalMemory::loadState(const StateDict& states)
 	connected_permanence_ = std::any_cast<float>(states.at("connected_permanence"));
 	active_threshold_ = std::any_cast<int>(states.at("active_threshold"));
 	input_shape_ = std::any_cast<Shape>(states.at("input_shape"));
+	if(states.count("sparse_rows") != 0) {
+		sparse_synapses_.rows_ = std::any_cast<Tensor>(states.at("sparse_rows"));
+		sparse_synapses_.indices_ = std::any_cast<Tensor>(states.at("sparse_indices"));
+		sparse_synapses_.permanences_ = std::any_cast<Tensor>(states.at("sparse_permanences"));
+		sparse_synapses_.max_synapses_per_cell_ = std::any_cast<int>(states.at("max_synapses_per_cell"));
+		connections_ = Tensor();
+		permanences_ = Tensor();
+		return;
+	}
+	sparse_synapses_ = SparseSynapses();
 	connections_ = std::any_cast<Tensor>(states.at("connections"));
 	permanences_ = std::any_cast<Tensor>(states.at("permanences"));
 
@@ -53,6 +100,10 @@ void TemporalMemory::loadState(const StateDict& states)
 TemporalMemory TemporalMemory::to(Backend* b) const
 {
 	TemporalMemory tm = *this;
+	if(sparse()) {
+		tm.sparse_synapses_ = sparse_synapses_.to(b);
+		return tm;
+	}
 	tm.connections_ = connections_.to(b);
 	tm.permanences_ = permanences_.to(b);
 	sortSynapse(tm.connections_, tm.permanences_);
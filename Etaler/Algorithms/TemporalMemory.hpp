@@ -6,6 +6,8 @@
 #include "Etaler/Core/Tensor.hpp"
 #include "Etaler/Core/Serialize.hpp"
 #include "Etaler/Core/DefaultBackend.hpp"
+#include "SparseSynapses.hpp"
+#include "Frozen.hpp"
 
 #include "Etaler_export.h"
 
@@ -15,8 +17,16 @@ namespace et
 struct ETALER_EXPORT TemporalMemory
 {
 	TemporalMemory() = default;
-	TemporalMemory(const Shape& input_shape, size_t cells_per_column, size_t max_synapses_per_cell=64, Backend* backend=defaultBackend());
+	// With sparse_synapses, the synapses are stored in the CSR layout of SparseSynapses instead of dense tensors. Memory then
+	// grows with the synapses actually grown instead of max_synapses_per_cell
+	TemporalMemory(const Shape& input_shape, size_t cells_per_column, size_t max_synapses_per_cell=64, Backend* backend=defaultBackend()
+		, bool sparse_synapses=false);
+	// x can either be of input_shape or a batch of shape [batch] + input_shape. last_state follows with cellsPerColumn()
+	// appended. Each sample in a batch is independent of the others
 	std::pair<Tensor, Tensor> compute(const Tensor& x, const Tensor& last_state);
+	// Same as compute(). But the active cells are written into active_cells, reusing it's buffer when it already has the
+	// right shape and dtype. Returns the predictive cells. Loops can keep two state buffers and swap them every timestep
+	Tensor compute(const Tensor& x, const Tensor& last_state, Tensor& active_cells);
 	void learn(const Tensor& active_cells, const Tensor& last_active);
 
 	void setPermanenceInc(float inc) { permanence_inc_ = inc; }
@@ -31,28 +41,56 @@ struct ETALER_EXPORT TemporalMemory
 	void setActiveThreshold(size_t thr) { active_threshold_ = thr; }
 	size_t activeThreshold() const { return active_threshold_; }
 
-	size_t cellsPerColumn() const {return connections_.shape()[connections_.size()-2];}
-	size_t maxSynapsesPerCell() const {return connections_.shape().back();}
+	size_t cellsPerColumn() const {return sparse() ? sparse_synapses_.cellShape().back() : connections_.shape()[connections_.dimensions()-2];}
+	size_t maxSynapsesPerCell() const {return sparse() ? sparse_synapses_.maxSynapsesPerCell() : connections_.shape().back();}
 
 	float initialPermanence() const {return initial_permanence_;}
 	void setInitialPermanence(float p) {initial_permanence_ = p;}
 
-	Tensor connections() const {return connections_;}
-	Tensor permanences() const {return permanences_;}
+	// Dense copies of the synapses when they are stored sparsely
+	Tensor connections() const {return sparse() ? sparse_synapses_.toDense().first : connections_;}
+	Tensor permanences() const {return sparse() ? sparse_synapses_.toDense().second : permanences_;}
+
+	// Permanences can be stored as Float, Half or UNorm8 (8 bit fixed point)
+	void setPermanenceType(DType dtype)
+	{
+		Tensor& perms = sparse() ? sparse_synapses_.permanences_ : permanences_;
+		perms = perms.cast(dtype);
+	}
+	DType permanenceType() const {return sparse() ? sparse_synapses_.permanences_.dtype() : permanences_.dtype();}
+
+	bool sparse() const {return sparse_synapses_.has_value();}
+	const SparseSynapses& sparseSynapses() const {return sparse_synapses_;}
 
 	StateDict states() const
 	{
-		return {{"input_shape", input_shape_}, {"connections", connections_} , {"permanences", permanences_}
+		StateDict states = {{"input_shape", input_shape_}
 			, {"permanence_inc", permanence_inc_}, {"permanence_dec", permanence_dec_}
 			, {"connected_permanence", connected_permanence_}, {"active_threshold", (int)active_threshold_}};
+		if(sparse()) {
+			// Only the existing synapses are saved. Not the spare capacity of the storage
+			SparseSynapses synapses = sparse_synapses_.compact();
+			states["sparse_rows"] = synapses.rows_;
+			states["sparse_indices"] = synapses.indices_;
+			states["sparse_permanences"] = synapses.permanences_;
+			states["max_synapses_per_cell"] = (int)sparse_synapses_.maxSynapsesPerCell();
+		}
+		else {
+			states["connections"] = connections_;
+			states["permanences"] = permanences_;
+		}
+		return states;
 	}
 
 	TemporalMemory to(Backend* b) const;
 
 	TemporalMemory copy() const
 	{
-		return to(connections_.backend());
-	}	
+		return to(sparse() ? sparse_synapses_.backend() : connections_.backend());
+	}
+
+	// An inference only snapshot. Smaller and faster to compute, but can't learn
+	FrozenTemporalMemory freeze() const { return FrozenTemporalMemory(*this); }
 
 	void loadState(const StateDict& states);
 
@@ -64,6 +102,7 @@ struct ETALER_EXPORT TemporalMemory
 	float initial_permanence_ = 0.21;
 	Tensor connections_;
 	Tensor permanences_;
+	SparseSynapses sparse_synapses_;
 };
 
 }
@@ -0,0 +1,440 @@
+#include "AsyncCPUBackend.hpp"
+
+#include <algorithm>
+
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
+
+using namespace et;
+
+namespace et
+{
+
+struct AsyncTask
+{
+	std::function<void()> run;
+	std::promise<void> promise;
+	std::shared_future<void> done = promise.get_future().share();
+	std::vector<std::shared_ptr<AsyncTask>> dependencies; //Dropped once started
+	std::vector<std::shared_ptr<AsyncTask>> dependents;
+	size_t num_pending_dependencies = 1; //Holds the task back until it is submitted
+	bool finished = false;
+	std::exception_ptr error;
+	std::mutex mutex;
+};
+
+}
+
+//Set while running a queued task. Tasks only start after the ones they depend on, so they never have to wait for data
+static thread_local bool t_in_async_task = false;
+
+//Tasks run in their own arena. So the TBB threads helping the parallel loops of a task are known to be in one
+struct et::AsyncArena
+{
+	struct Observer : public tbb::task_scheduler_observer
+	{
+		Observer(tbb::task_arena& arena) : tbb::task_scheduler_observer(arena) {observe(true);}
+		~Observer() {observe(false);}
+		virtual void on_scheduler_entry(bool) override {t_in_async_task = true;}
+		virtual void on_scheduler_exit(bool) override {t_in_async_task = false;}
+	};
+
+	tbb::task_arena arena;
+	Observer observer{arena};
+};
+
+static bool isFinished(const std::shared_ptr<AsyncTask>& task)
+{
+	std::lock_guard lock(task->mutex);
+	return task->finished;
+}
+
+static AsyncCPUBuffer* asyncBuffer(const TensorImpl* x)
+{
+	return dynamic_cast<AsyncCPUBuffer*>(x->buffer().get());
+}
+
+AsyncCPUBuffer::AsyncCPUBuffer(const Shape& shape, DType dtype, std::shared_ptr<Backend> backend, std::shared_ptr<AsyncTask> producer)
+	: CPUBuffer(shape, dtype, std::move(backend), (void*)nullptr, nullptr), writer_(std::move(producer))
+{}
+
+void* AsyncCPUBuffer::data() const
+{
+	if(t_in_async_task == false)
+		wait();
+	return CPUBuffer::data();
+}
+
+void AsyncCPUBuffer::wait() const
+{
+	std::shared_future<void> written;
+	std::vector<std::shared_future<void>> reads;
+	{
+		std::lock_guard lock(mutex_);
+		if(writer_)
+			written = writer_->done;
+		for(const auto& reader : readers_)
+			reads.push_back(reader->done);
+	}
+	// Errors of the readers don't concern the content of this buffer
+	for(const auto& f : reads)
+		f.wait();
+	if(written.valid())
+		written.get();
+}
+
+void AsyncCPUBuffer::adopt(std::shared_ptr<BufferImpl> result)
+{
+	storage_ = result->data();
+	owner_ = std::move(result);
+}
+
+AsyncCPUBackend::AsyncCPUBackend(size_t num_workers)
+	: arena_(std::make_unique<AsyncArena>())
+{
+	et_check(num_workers > 0);
+	for(size_t i=0;i<num_workers;i++)
+		workers_.emplace_back([this](){workerLoop();});
+}
+
+AsyncCPUBackend::~AsyncCPUBackend()
+{
+	{
+		std::unique_lock lock(queue_mutex_);
+		idle_cv_.wait(lock, [this](){return num_unfinished_ == 0;});
+		stop_ = true;
+	}
+	queue_cv_.notify_all();
+	for(auto& worker : workers_)
+		worker.join();
+}
+
+void AsyncCPUBackend::sync() const
+{
+	std::unique_lock lock(queue_mutex_);
+	idle_cv_.wait(lock, [this](){return num_unfinished_ == 0;});
+	if(error_) {
+		auto e = error_;
+		error_ = nullptr;
+		std::rethrow_exception(e);
+	}
+}
+
+void AsyncCPUBackend::workerLoop()
+{
+	while(true) {
+		std::shared_ptr<AsyncTask> task;
+		{
+			std::unique_lock lock(queue_mutex_);
+			queue_cv_.wait(lock, [this](){return stop_ || ready_.empty() == false;});
+			if(ready_.empty())
+				return;
+			task = std::move(ready_.front());
+			ready_.pop_front();
+		}
+
+		// Tasks depending on a failed task fail with the same error. Their inputs are garbage
+		for(const auto& dependency : task->dependencies) {
+			if(dependency->error)
+				task->error = dependency->error;
+		}
+		task->dependencies.clear();
+		if(task->error == nullptr) {
+			arena_->arena.execute([&](){
+				bool in_task = t_in_async_task;
+				t_in_async_task = true;
+				try {
+					task->run();
+				}
+				catch(...) {
+					task->error = std::current_exception();
+				}
+				t_in_async_task = in_task;
+			});
+		}
+		finish(task);
+	}
+}
+
+void AsyncCPUBackend::launch(std::shared_ptr<AsyncTask> task)
+{
+	{
+		std::lock_guard lock(queue_mutex_);
+		ready_.push_back(std::move(task));
+	}
+	queue_cv_.notify_one();
+}
+
+void AsyncCPUBackend::finish(const std::shared_ptr<AsyncTask>& task)
+{
+	task->run = nullptr; //Release the tensors it holds
+	if(task->error)
+		task->promise.set_exception(task->error);
+	else
+		task->promise.set_value();
+
+	std::vector<std::shared_ptr<AsyncTask>> dependents;
+	{
+		std::lock_guard lock(task->mutex);
+		task->finished = true;
+		std::swap(dependents, task->dependents);
+	}
+	for(auto& dependent : dependents) {
+		bool ready;
+		{
+			std::lock_guard lock(dependent->mutex);
+			ready = --dependent->num_pending_dependencies == 0;
+		}
+		if(ready)
+			launch(std::move(dependent));
+	}
+
+	{
+		std::lock_guard lock(queue_mutex_);
+		if(task->error && error_ == nullptr)
+			error_ = task->error;
+		num_unfinished_ -= 1;
+	}
+	idle_cv_.notify_all();
+}
+
+std::shared_ptr<AsyncTask> AsyncCPUBackend::submit(std::function<void()> f, const TensorList& reads, const std::vector<const TensorImpl*>& writes
+	, std::vector<std::shared_ptr<const TensorImpl>> keep_alive)
+{
+	auto task = std::make_shared<AsyncTask>();
+	task->run = [f=std::move(f), keep_alive=std::move(keep_alive)](){f();};
+
+	// Read after write, write after write and write after read
+	std::vector<std::shared_ptr<AsyncTask>> dependencies;
+	for(const TensorImpl* x : reads) {
+		if(auto buf = asyncBuffer(x)) {
+			std::lock_guard lock(buf->mutex_);
+			if(buf->writer_)
+				dependencies.push_back(buf->writer_);
+			buf->readers_.erase(std::remove_if(buf->readers_.begin(), buf->readers_.end(), isFinished), buf->readers_.end());
+			buf->readers_.push_back(task);
+		}
+	}
+	for(const TensorImpl* x : writes) {
+		if(auto buf = asyncBuffer(x)) {
+			std::lock_guard lock(buf->mutex_);
+			if(buf->writer_)
+				dependencies.push_back(buf->writer_);
+			for(auto& reader : buf->readers_) {
+				if(reader != task)
+					dependencies.push_back(std::move(reader));
+			}
+			buf->readers_.clear();
+			buf->writer_ = task;
+		}
+	}
+
+	{
+		std::lock_guard lock(queue_mutex_);
+		num_unfinished_ += 1;
+	}
+	for(auto& dependency : dependencies) {
+		std::lock_guard lock(dependency->mutex);
+		task->dependencies.push_back(dependency);
+		if(dependency->finished == false) {
+			dependency->dependents.push_back(task);
+			std::lock_guard task_lock(task->mutex);
+			task->num_pending_dependencies += 1;
+		}
+	}
+	bool ready;
+	{
+		std::lock_guard lock(task->mutex);
+		ready = --task->num_pending_dependencies == 0;
+	}
+	if(ready)
+		launch(task);
+	return task;
+}
+
+static std::vector<std::shared_ptr<const TensorImpl>> keepAlive(const std::vector<const TensorImpl*>& tensors)
+{
+	std::vector<std::shared_ptr<const TensorImpl>> res;
+	for(const TensorImpl* x : tensors)
+		res.push_back(x->shared_from_this());
+	return res;
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::enqueue(const Shape& shape, DType dtype, const TensorList& reads
+	, std::function<std::shared_ptr<TensorImpl>()> f)
+{
+	// Ops called by other ops run right away
+	if(t_in_async_task)
+		return f();
+
+	// The task hands its result over to this buffer. No one else can see it before it's writer is set
+	auto buf = std::make_shared<AsyncCPUBuffer>(shape, dtype, shared_from_this(), nullptr);
+	auto task = submit([f=std::move(f), buf, shape, dtype](){
+		auto res = f();
+		et_assert(res->isplain() && res->shape() == shape && res->dtype() == dtype);
+		buf->adopt(res->buffer());
+	}, reads, {}, keepAlive(reads));
+	std::lock_guard lock(buf->mutex_);
+	buf->writer_ = task;
+	return std::make_shared<TensorImpl>(buf, shape, shapeToStride(shape));
+}
+
+void AsyncCPUBackend::enqueue(const TensorList& reads, const std::vector<TensorImpl*>& writes, std::function<void()> f)
+{
+	if(t_in_async_task)
+		return f();
+
+	std::vector<const TensorImpl*> const_writes(writes.begin(), writes.end());
+	TensorList all = reads;
+	all.insert(all.end(), const_writes.begin(), const_writes.end());
+	submit(std::move(f), reads, const_writes, keepAlive(all));
+}
+
+static Shape cellShape(const TensorImpl* synapses)
+{
+	Shape s = synapses->shape();
+	s.pop_back();
+	return s;
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances,
+	float connected_permeance, size_t active_threshold, bool has_unconnected_synapse)
+{
+	return enqueue(cellShape(permeances), DType::Int32, {x, connections, permeances}, [=](){
+		return CPUBackend::cellActivity(x, connections, permeances, connected_permeance, active_threshold, has_unconnected_synapse);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::batchCellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances,
+	float connected_permeance, size_t active_threshold, bool has_unconnected_synapse)
+{
+	et_check(x->dimensions() > 0);
+	Shape s = Shape{x->shape()[0]} + cellShape(permeances);
+	return enqueue(s, DType::Int32, {x, connections, permeances}, [=](){
+		return CPUBackend::batchCellActivity(x, connections, permeances, connected_permeance, active_threshold, has_unconnected_synapse);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::invertedCellActivity(const TensorImpl* active_bits, const TensorImpl* reverse_index,
+	const TensorImpl* permeances, float connected_permeance, size_t active_threshold)
+{
+	return enqueue(cellShape(permeances), DType::Int32, {active_bits, reverse_index, permeances}, [=](){
+		return CPUBackend::invertedCellActivity(active_bits, reverse_index, permeances, connected_permeance, active_threshold);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::sparseCellActivity(const TensorImpl* x, const TensorImpl* rows, const TensorImpl* indices
+	, const TensorImpl* permeances, float connected_permeance, size_t active_threshold)
+{
+	return enqueue(cellShape(rows), DType::Int32, {x, rows, indices, permeances}, [=](){
+		return CPUBackend::sparseCellActivity(x, rows, indices, permeances, connected_permeance, active_threshold);
+	});
+}
+
+void AsyncCPUBackend::learnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* connections,
+	TensorImpl* permeances, float perm_inc, float perm_dec, bool has_unconnected_synapse)
+{
+	enqueue({x, learn, connections}, {permeances}, [=](){
+		CPUBackend::learnCorrilation(x, learn, connections, permeances, perm_inc, perm_dec, has_unconnected_synapse);
+	});
+}
+
+void AsyncCPUBackend::sparseLearnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* rows, const TensorImpl* indices
+	, TensorImpl* permeances, float perm_inc, float perm_dec)
+{
+	enqueue({x, learn, rows, indices}, {permeances}, [=](){
+		CPUBackend::sparseLearnCorrilation(x, learn, rows, indices, permeances, perm_inc, perm_dec);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::globalInhibition(const TensorImpl* x, float fraction)
+{
+	return enqueue(x->shape(), DType::Bool, {x}, [=](){
+		return CPUBackend::globalInhibition(x, fraction);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::batchGlobalInhibition(const TensorImpl* x, float fraction)
+{
+	return enqueue(x->shape(), DType::Bool, {x}, [=](){
+		return CPUBackend::batchGlobalInhibition(x, fraction);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::localInhibition(const TensorImpl* x, float fraction, size_t radius)
+{
+	return enqueue(x->shape(), DType::Bool, {x}, [=](){
+		return CPUBackend::localInhibition(x, fraction, radius);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::cast(const TensorImpl* x, DType toType)
+{
+	return enqueue(x->shape(), toType, {x}, [=](){
+		return CPUBackend::cast(x, toType);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::copy(const TensorImpl* x)
+{
+	return enqueue(x->shape(), x->dtype(), {x}, [=](){
+		return CPUBackend::copy(x);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::realize(const TensorImpl* x)
+{
+	return enqueue(x->shape(), x->dtype(), {x}, [=](){
+		return CPUBackend::realize(x);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::burst(const TensorImpl* x, const TensorImpl* s)
+{
+	return enqueue(s->shape(), DType::Bool, {x, s}, [=](){
+		return CPUBackend::burst(x, s);
+	});
+}
+
+std::shared_ptr<TensorImpl> AsyncCPUBackend::reverseBurst(const TensorImpl* x)
+{
+	return enqueue(x->shape(), DType::Bool, {x}, [=](){
+		return CPUBackend::reverseBurst(x);
+	});
+}
+
+void AsyncCPUBackend::sortSynapse(TensorImpl* connections, TensorImpl* permeances)
+{
+	enqueue({}, {connections, permeances}, [=](){
+		CPUBackend::sortSynapse(connections, permeances);
+	});
+}
+
+void AsyncCPUBackend::growSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* connections
+	, TensorImpl* permeances, float initial_perm)
+{
+	enqueue({x, y}, {connections, permeances}, [=](){
+		CPUBackend::growSynapses(x, y, connections, permeances, initial_perm);
+	});
+}
+
+void AsyncCPUBackend::decaySynapses(TensorImpl* connections, TensorImpl* permeances, float threshold)
+{
+	enqueue({}, {connections, permeances}, [=](){
+		CPUBackend::decaySynapses(connections, permeances, threshold);
+	});
+}
+
+void AsyncCPUBackend::sparseDecaySynapses(TensorImpl* rows, TensorImpl* indices, TensorImpl* permeances, float threshold)
+{
+	enqueue({}, {rows, indices, permeances}, [=](){
+		CPUBackend::sparseDecaySynapses(rows, indices, permeances, threshold);
+	});
+}
+
+void AsyncCPUBackend::assign(TensorImpl* dest, const TensorImpl* src)
+{
+	enqueue({src}, {dest}, [=](){
+		CPUBackend::assign(dest, src);
+	});
+}
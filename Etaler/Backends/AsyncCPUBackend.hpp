@@ -0,0 +1,134 @@
+#pragma once
+
+#include "CPUBackend.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace et
+{
+
+struct AsyncTask;
+struct AsyncArena;
+
+//A CPUBuffer that knows which queued tasks use it. Accessing the data from outside of a task waits for them to finish
+struct ETALER_EXPORT AsyncCPUBuffer : public CPUBuffer
+{
+	AsyncCPUBuffer(const Shape& shape, DType dtype, std::shared_ptr<Backend> backend, std::shared_ptr<CPUAllocator> allocator, const void* src_ptr)
+		: CPUBuffer(shape, dtype, std::move(backend), std::move(allocator), src_ptr)
+	{}
+
+	//A buffer using storage owned by owner. See CPUBackend::wrapTensor()
+	AsyncCPUBuffer(const Shape& shape, DType dtype, std::shared_ptr<Backend> backend, void* storage, std::shared_ptr<void> owner)
+		: CPUBuffer(shape, dtype, std::move(backend), storage, std::move(owner))
+	{}
+
+	//A buffer without storage yet. It's producer hands over the result when finished
+	AsyncCPUBuffer(const Shape& shape, DType dtype, std::shared_ptr<Backend> backend, std::shared_ptr<AsyncTask> producer);
+
+	virtual void* data() const override;
+
+	//Blocks until all tasks reading or writing the buffer are done
+	void wait() const;
+
+protected:
+	friend struct AsyncCPUBackend;
+	void adopt(std::shared_ptr<BufferImpl> result);
+
+	mutable std::mutex mutex_;
+	std::shared_ptr<AsyncTask> writer_;
+	std::vector<std::shared_ptr<AsyncTask>> readers_;
+};
+
+//Runs CPU ops on worker threads instead of the calling thread. Ops returning tensors return immediately when the shape and
+//type of the result is known beforehand, with the result filled in when the op is done. Ops changing tensors in-place always
+//return immediately. Ops are ordered by the buffers they read and write, so independent ops (ex: of different regions)
+//overlap. Reading a tensor's data (including toHost() and ops that still run on the calling thread) waits for the ops
+//using it. Errors thrown by queued ops are rethrown when waiting for their results or by sync().
+struct ETALER_EXPORT AsyncCPUBackend : public CPUBackend
+{
+	AsyncCPUBackend(size_t num_workers=std::max(std::thread::hardware_concurrency(), 2u));
+	virtual ~AsyncCPUBackend();
+
+	virtual std::shared_ptr<TensorImpl> createTensor(const Shape& shape, DType dtype, const void* data=nullptr) override
+	{
+		auto buf = std::make_shared<AsyncCPUBuffer>(shape, dtype, shared_from_this(), allocator_, data);
+		return std::make_shared<TensorImpl>(buf, shape, shapeToStride(shape));
+	}
+
+	virtual std::shared_ptr<TensorImpl> wrapTensor(const Shape& shape, DType dtype, void* data, std::shared_ptr<void> owner) override
+	{
+		auto buf = std::make_shared<AsyncCPUBuffer>(shape, dtype, shared_from_this(), data, std::move(owner));
+		return std::make_shared<TensorImpl>(buf, shape, shapeToStride(shape));
+	}
+
+	//Waits for all queued ops
+	virtual void sync() const override;
+
+	//The out variants of these are CPUBackend's. They run on the calling thread, after the ops using the buffers
+	using CPUBackend::cellActivity;
+	using CPUBackend::cast;
+	using CPUBackend::burst;
+	using CPUBackend::reverseBurst;
+
+	virtual std::shared_ptr<TensorImpl> cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances,
+		float connected_permeance, size_t active_threshold, bool has_unconnected_synapse=true) override;
+	virtual void learnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* connections,
+		TensorImpl* permeances, float perm_inc, float perm_dec, bool has_unconnected_synapse=true) override;
+	virtual std::shared_ptr<TensorImpl> globalInhibition(const TensorImpl* x, float fraction) override;
+	virtual std::shared_ptr<TensorImpl> localInhibition(const TensorImpl* x, float fraction, size_t radius) override;
+	virtual std::shared_ptr<TensorImpl> batchCellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances,
+		float connected_permeance, size_t active_threshold, bool has_unconnected_synapse=true) override;
+	virtual std::shared_ptr<TensorImpl> batchGlobalInhibition(const TensorImpl* x, float fraction) override;
+	virtual std::shared_ptr<TensorImpl> cast(const TensorImpl* x, DType toType) override;
+	virtual std::shared_ptr<TensorImpl> copy(const TensorImpl* x) override;
+	virtual void sortSynapse(TensorImpl* connections, TensorImpl* permeances) override;
+	virtual std::shared_ptr<TensorImpl> burst(const TensorImpl* x, const TensorImpl* s) override;
+	virtual std::shared_ptr<TensorImpl> reverseBurst(const TensorImpl* x) override;
+	virtual void growSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* connections
+		, TensorImpl* permeances, float initial_perm) override;
+	virtual void decaySynapses(TensorImpl* connections, TensorImpl* permeances, float threshold) override;
+	virtual std::shared_ptr<TensorImpl> sparseCellActivity(const TensorImpl* x, const TensorImpl* rows, const TensorImpl* indices
+		, const TensorImpl* permeances, float connected_permeance, size_t active_threshold) override;
+	virtual void sparseLearnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* rows, const TensorImpl* indices
+		, TensorImpl* permeances, float perm_inc, float perm_dec) override;
+	virtual void sparseDecaySynapses(TensorImpl* rows, TensorImpl* indices, TensorImpl* permeances, float threshold) override;
+	virtual std::shared_ptr<TensorImpl> invertedCellActivity(const TensorImpl* active_bits, const TensorImpl* reverse_index,
+		const TensorImpl* permeances, float connected_permeance, size_t active_threshold) override;
+	virtual std::shared_ptr<TensorImpl> realize(const TensorImpl* x) override;
+	virtual void assign(TensorImpl* dest, const TensorImpl* src) override;
+
+	virtual std::string name() const override {return "AsyncCPU";}
+
+protected:
+	using TensorList = std::vector<const TensorImpl*>;
+	//Queues f, which returns a tensor of the given shape and type
+	std::shared_ptr<TensorImpl> enqueue(const Shape& shape, DType dtype, const TensorList& reads
+		, std::function<std::shared_ptr<TensorImpl>()> f);
+	//Queues f, which writes into the tensors in writes
+	void enqueue(const TensorList& reads, const std::vector<TensorImpl*>& writes, std::function<void()> f);
+	std::shared_ptr<AsyncTask> submit(std::function<void()> f, const TensorList& reads, const std::vector<const TensorImpl*>& writes
+		, std::vector<std::shared_ptr<const TensorImpl>> keep_alive);
+	void launch(std::shared_ptr<AsyncTask> task);
+	void finish(const std::shared_ptr<AsyncTask>& task);
+	void workerLoop();
+
+	std::unique_ptr<AsyncArena> arena_;
+	std::vector<std::thread> workers_;
+	mutable std::mutex queue_mutex_;
+	mutable std::condition_variable queue_cv_; //A task is ready or the workers should stop
+	mutable std::condition_variable idle_cv_; //All tasks are done
+	std::deque<std::shared_ptr<AsyncTask>> ready_;
+	size_t num_unfinished_ = 0;
+	mutable std::exception_ptr error_; //The first error not yet reported by sync()
+	bool stop_ = false;
+};
+
+}
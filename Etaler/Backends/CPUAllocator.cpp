@@ -0,0 +1,118 @@
+#include "CPUAllocator.hpp"
+
+#include <Etaler/Core/Error.hpp>
+#include <Etaler/Core/Profiler.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#ifdef _MSC_VER
+	#include <malloc.h>
+#endif
+
+using namespace et;
+
+// MSVC doesn't provide std::aligned_alloc
+static void* alignedAlloc(size_t alignment, size_t size)
+{
+#ifdef _MSC_VER
+	return _aligned_malloc(size, alignment);
+#else
+	return std::aligned_alloc(alignment, size);
+#endif
+}
+
+static void alignedFree(void* ptr)
+{
+#ifdef _MSC_VER
+	_aligned_free(ptr);
+#else
+	std::free(ptr);
+#endif
+}
+
+CPUAllocator::~CPUAllocator()
+{
+	emptyCache();
+}
+
+size_t CPUAllocator::roundSize(size_t size)
+{
+	//Small blocks are rounded to the alignment, large ones to pages so close sizes share a free list
+	constexpr size_t page_size = 4096;
+	if(size <= page_size)
+		return std::max((size+alignment-1)/alignment*alignment, alignment);
+	return (size+page_size-1)/page_size*page_size;
+}
+
+void* CPUAllocator::allocate(size_t size)
+{
+	size = roundSize(size);
+	profileAllocation(size);
+	{
+		std::lock_guard lock(mutex_);
+		auto it = free_blocks_.find(size);
+		if(it != free_blocks_.end() && it->second.empty() == false) {
+			void* ptr = it->second.back();
+			it->second.pop_back();
+			stats_.hits++;
+			stats_.bytes_cached -= size;
+			return ptr;
+		}
+		stats_.misses++;
+	}
+
+	void* ptr = alignedAlloc(alignment, size);
+	if(ptr == nullptr) {
+		//Give the cached memory back and try again before giving up
+		emptyCache();
+		ptr = alignedAlloc(alignment, size);
+	}
+	if(ptr == nullptr)
+		throw EtError("CPUAllocator failed to allocate " + std::to_string(size) + " bytes");
+	return ptr;
+}
+
+void CPUAllocator::deallocate(void* ptr, size_t size)
+{
+	if(ptr == nullptr)
+		return;
+	size = roundSize(size);
+	{
+		std::lock_guard lock(mutex_);
+		if(stats_.bytes_cached + size <= cache_limit_) {
+			free_blocks_[size].push_back(ptr);
+			stats_.bytes_cached += size;
+			return;
+		}
+	}
+	alignedFree(ptr);
+}
+
+void CPUAllocator::emptyCache()
+{
+	std::lock_guard lock(mutex_);
+	for(auto& [size, blocks] : free_blocks_) {
+		for(void* ptr : blocks)
+			alignedFree(ptr);
+	}
+	free_blocks_.clear();
+	stats_.bytes_cached = 0;
+}
+
+void CPUAllocator::setCacheLimit(size_t bytes)
+{
+	{
+		std::lock_guard lock(mutex_);
+		cache_limit_ = bytes;
+		if(stats_.bytes_cached <= cache_limit_)
+			return;
+	}
+	emptyCache();
+}
+
+CPUAllocatorStats CPUAllocator::stats() const
+{
+	std::lock_guard lock(mutex_);
+	return stats_;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "Etaler_export.h"
+
+namespace et
+{
+
+struct ETALER_EXPORT CPUAllocatorStats
+{
+	size_t hits = 0;
+	size_t misses = 0;
+	size_t bytes_cached = 0;
+};
+
+//A caching allocator for CPU tensors. Freed blocks are kept in per size-class free lists and handed out
+//again to requests of the same (rounded) size instead of going back to the system.
+struct ETALER_EXPORT CPUAllocator
+{
+	static constexpr size_t alignment = 64;
+
+	CPUAllocator(size_t cache_limit = size_t(256)*1024*1024) : cache_limit_(cache_limit) {}
+	~CPUAllocator();
+	CPUAllocator(const CPUAllocator&) = delete;
+	CPUAllocator& operator=(const CPUAllocator&) = delete;
+
+	//Returns a block of at least size bytes aligned to alignment. The content is uninitialized
+	void* allocate(size_t size);
+	//size must be the same as the one passed to allocate()
+	void deallocate(void* ptr, size_t size);
+
+	//Frees all cached blocks back to the system
+	void emptyCache();
+	//Maximum amount of bytes kept in the cache. Blocks freed beyond the limit are released immediately
+	void setCacheLimit(size_t bytes);
+	size_t cacheLimit() const { return cache_limit_; }
+	CPUAllocatorStats stats() const;
+
+	static size_t roundSize(size_t size);
+
+protected:
+	mutable std::mutex mutex_;
+	std::unordered_map<size_t, std::vector<void*>> free_blocks_;
+	size_t cache_limit_;
+	CPUAllocatorStats stats_;
+};
+
+}
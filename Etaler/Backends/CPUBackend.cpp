@@ -2,17 +2,34 @@
 #include "Etaler/Core/Views.hpp"
 #include "Etaler/Core/Random.hpp"
 #include "Etaler/Core/TypeList.hpp"
+#include "Etaler/Core/Expression.hpp"
+#include "Etaler/Core/Profiler.hpp"
 
 #include <numeric>
 #include <cmath>
+#include <bitset>
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
 
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
-#include <tbb/parallel_sort.h>
 #include <tbb/parallel_reduce.h>
+#include <tbb/task_arena.h>
+
+// Hand written AVX2/AVX-512 kernels. Compiled with per-function target attributes and selected at runtime.
+// So the library still runs on CPUs without them
+#if defined(ETALER_ENABLE_SIMD) && (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+	#define ETALER_X86_SIMD_KERNELS
+	#include <immintrin.h>
+#endif
 
 using namespace et;
 
+// Records the op (named after the function it is in) when profiling is enabled
+#define ET_PROFILE_OP_SHAPE(shape, dtype) ProfileScope et_profile_scope(__func__, shape, dtype \
+	, profilingEnabled() ? tbb::this_task_arena::max_concurrency() : 1)
+#define ET_PROFILE_OP(x) ProfileScope et_profile_scope(__func__, x, profilingEnabled() ? tbb::this_task_arena::max_concurrency() : 1)
 
 //Helper functions
 template <typename T>
@@ -55,10 +72,14 @@ void apply_permutation(
 void* CPUBuffer::data() const
 {
 	assert(dtype() != DType::Unknown);
-	return std::visit([](const auto& v){return (void*)v;}, storage_);
+	return storage_;
 }
 
 using DefaultTypeList = type_list_t<int32_t, float, bool, half>;
+//Types that can be stored, copied and casted. But not computed with
+using StorageTypeList = type_list_t<int32_t, float, bool, half, unorm8>;
+//Types permanences can be stored in
+using PermTypeList = type_list_t<float, half, unorm8>;
 
 template <typename TypeList = DefaultTypeList, typename Func = void>
 inline void dispatch(DType dtype, Func f)
@@ -88,38 +109,324 @@ inline void dispatch2d(DType t1, DType t2, Func f)
 	});
 }
 
-CPUBuffer::~CPUBuffer()
+//Helpers for DType::Bit. Element i is stored in bit i%64 of word i/64. Bits past the end of a tensor are always 0
+namespace et::detail
+{
+inline size_t popcount(uint64_t v)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(v);
+#else
+	return std::bitset<64>(v).count();
+#endif
+}
+
+//The lowest n bits set. n can be anything in [0, 64]
+inline uint64_t lowMask(size_t n)
+{
+	return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+}
+
+inline bool getBit(const uint64_t* words, size_t i)
+{
+	return (words[i/64] >> (i%64)) & 1;
+}
+
+inline void setBit(uint64_t* words, size_t i, bool v)
+{
+	uint64_t mask = uint64_t(1) << (i%64);
+	words[i/64] = v ? (words[i/64] | mask) : (words[i/64] & ~mask);
+}
+
+//Number of set bits in the element range [begin, end)
+inline size_t countBits(const uint64_t* words, size_t begin, size_t end)
 {
-	std::visit([](auto& ptr){delete [] ptr;}, storage_);
+	if(begin >= end)
+		return 0;
+	size_t first = begin/64;
+	size_t last = (end-1)/64;
+	if(first == last)
+		return popcount((words[first] >> (begin%64)) & lowMask(end-begin));
+	size_t n = popcount(words[first] >> (begin%64));
+	for(size_t i=first+1;i<last;i++)
+		n += popcount(words[i]);
+	return n + popcount(words[last] & lowMask(end-last*64));
+}
+
+//Calls f(word_index, bit_begin, bit_end) for every word of a n element Bit tensor in parallel
+template <typename Func>
+inline void parallelForWords(size_t n, Func f)
+{
+	size_t num_words = (n+63)/64;
+	tbb::parallel_for(size_t(0), num_words, [&](size_t w) {
+		f(w, w*64, std::min(w*64+64, n));
+	});
+}
+
+//Allows kernels to read Bool and Bit tensors with the same code
+struct BitReader
+{
+	const uint64_t* words;
+	bool operator[] (size_t i) const {return getBit(words, i);}
+};
+
+template <typename Func>
+inline void visitBinary(const TensorImpl* x, Func f)
+{
+	if(x->dtype() == DType::Bit)
+		f(BitReader{(const uint64_t*)x->data()});
+	else
+		f((const bool*)x->data());
+}
+
+//Runs the kernel f(y) producing an op's result of the given shape and dtype. Without out, y is a new tensor that is
+//returned. Otherwise y is out when it can be written directly: out is plain, has the dtype and no input shares memory
+//with it. Except the same tensor for ops that only read the element they write (elementwise). Or else y is a temporary
+//that is assigned to out afterwards
+template <typename Func>
+inline std::shared_ptr<TensorImpl> writeOutput(const Shape& shape, DType dtype, TensorImpl* out
+	, std::initializer_list<const TensorImpl*> inputs, bool elementwise, Backend* backend, Func f)
+{
+	if(out != nullptr) {
+		requireProperties(out, backend, shape);
+		bool direct = out->isplain() && out->dtype() == dtype && std::all_of(inputs.begin(), inputs.end(), [&](const TensorImpl* x) {
+			return x->buffer() != out->buffer() || (elementwise && x->isplain() && x->shape() == out->shape());
+		});
+		if(direct) {
+			f(out);
+			return nullptr;
+		}
+	}
+
+	auto y = backend->createTensor(shape, dtype);
+	f(y.get());
+	if(out == nullptr)
+		return y;
+	backend->assign(out, y.get());
+	return nullptr;
+}
+
 }
 
 namespace et::detail
 {
+//The inner loop of cellActivity for a single cell: count synapses that are both connected and connected to an on bit.
+//The input is packed 32 bits per word, so the SIMD gathers can never read past the end of it. Like the loop in
+//cellActivity, counting stops at the first -1
 template <typename PermType>
-static std::shared_ptr<TensorImpl> cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
-	, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse, CPUBackend* backend)
+static size_t rowOverlapTail(const int32_t* synapses, const PermType* perms, size_t begin, size_t n
+	, const uint32_t* bits, float connected_permeance)
 {
-	//Checks the input are sane
-	requireProperties(x, backend, DType::Bool, IsPlain());
-	requireProperties(connections, backend, DType::Int32, IsPlain(), permeances->shape());
-	requireProperties(permeances, backend, typeToDType<PermType>(), IsPlain());
-	et_check(connections->dimensions() >= 2);
+	size_t sum = 0;
+	for(size_t j=begin;j<n;j++) {
+		int32_t target = synapses[j];
+		if(target == -1)
+			break;
+		if(((bits[target/32] >> (target%32)) & 1) && perms[j] > connected_permeance)
+			sum += 1;
+	}
+	return sum;
+}
 
-	Shape s = connections->shape();
-	s.pop_back();
-	auto y = backend->createTensor(s, DType::Int32);
+template <typename PermType>
+static size_t rowOverlapScalar(const int32_t* synapses, const PermType* perms, size_t n, const uint32_t* bits, float connected_permeance)
+{
+	return rowOverlapTail(synapses, perms, 0, n, bits, connected_permeance);
+}
+
+template <typename PermType>
+using RowOverlapFunc = size_t (*)(const int32_t*, const PermType*, size_t, const uint32_t*, float);
+
+//Packs n elements starting at begin of a Bool/Bit reader into 32 bit words
+template <typename Input>
+inline void packBits(const Input& input, size_t begin, size_t n, uint32_t* out)
+{
+	for(size_t w=0;w<(n+31)/32;w++) {
+		uint32_t word = 0;
+		for(size_t i=w*32;i<std::min(w*32+32, n);i++)
+			word |= uint32_t(input[begin+i]) << (i%32);
+		out[w] = word;
+	}
+}
+}
+
+#ifdef ETALER_X86_SIMD_KERNELS
+namespace et::detail
+{
+template <typename PermType>
+__attribute__((target("avx2,f16c")))
+static size_t rowOverlapAVX2(const int32_t* synapses, const PermType* perms, size_t n, const uint32_t* bits, float connected_permeance)
+{
+	const __m256i ones = _mm256_set1_epi32(1);
+	const __m256i none = _mm256_set1_epi32(-1);
+	const __m256i lane_id = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256 threshold = _mm256_set1_ps(connected_permeance);
+	const __m256i int_threshold = _mm256_set1_epi32(unorm8::threshold(connected_permeance));
+
+	size_t sum = 0;
+	size_t j = 0;
+	for(;j+8<=n;j+=8) {
+		__m256i idx = _mm256_loadu_si256((const __m256i*)(synapses+j));
+		unsigned end_lanes = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(idx, none)));
+		int num_valid = end_lanes == 0 ? 8 : __builtin_ctz(end_lanes);
+		__m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(num_valid), lane_id);
+
+		__m256i words = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int*)bits, _mm256_srli_epi32(idx, 5), valid, 4);
+		__m256i on = _mm256_and_si256(_mm256_srlv_epi32(words, _mm256_and_si256(idx, _mm256_set1_epi32(31))), ones);
+
+		__m256i connected;
+		if constexpr(std::is_same_v<PermType, unorm8>) {
+			__m256i strength = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(perms+j)));
+			connected = _mm256_cmpgt_epi32(strength, int_threshold);
+		}
+		else {
+			__m256 strength;
+			if constexpr(std::is_same_v<PermType, float>)
+				strength = _mm256_loadu_ps(perms+j);
+			else
+				strength = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(perms+j)));
+			connected = _mm256_castps_si256(_mm256_cmp_ps(strength, threshold, _CMP_GT_OQ));
+		}
+
+		__m256i hit = _mm256_and_si256(_mm256_cmpeq_epi32(on, ones), _mm256_and_si256(connected, valid));
+		sum += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(hit)));
+		if(end_lanes != 0)
+			return sum;
+	}
+	return sum + rowOverlapTail(synapses, perms, j, n, bits, connected_permeance);
+}
+
+//The zero masked forms of the intrinsics are used with all lanes on. GCC implements the plain ones by merging into an
+//undefined register, which it reports as maybe uninitialized when they are inlined (even at link time with LTO)
+template <typename PermType>
+__attribute__((target("avx512f")))
+static size_t rowOverlapAVX512(const int32_t* synapses, const PermType* perms, size_t n, const uint32_t* bits, float connected_permeance)
+{
+	const __m512i ones = _mm512_set1_epi32(1);
+	const __m512i none = _mm512_set1_epi32(-1);
+	const __m512 threshold = _mm512_set1_ps(connected_permeance);
+	const __m512i int_threshold = _mm512_set1_epi32(unorm8::threshold(connected_permeance));
+
+	size_t sum = 0;
+	size_t j = 0;
+	for(;j+16<=n;j+=16) {
+		__m512i idx = _mm512_loadu_si512(synapses+j);
+		unsigned end_lanes = _mm512_cmpeq_epi32_mask(idx, none);
+		__mmask16 valid = end_lanes == 0 ? 0xffff : ((end_lanes & (~end_lanes+1)) - 1);
+
+		__m512i words = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), valid, _mm512_maskz_srli_epi32(0xffff, idx, 5), bits, 4);
+		__mmask16 on = _mm512_test_epi32_mask(words, _mm512_maskz_sllv_epi32(0xffff, ones, _mm512_and_si512(idx, _mm512_set1_epi32(31))));
+
+		__mmask16 connected;
+		if constexpr(std::is_same_v<PermType, unorm8>) {
+			__m512i strength = _mm512_maskz_cvtepu8_epi32(0xffff, _mm_loadu_si128((const __m128i*)(perms+j)));
+			connected = _mm512_cmpgt_epi32_mask(strength, int_threshold);
+		}
+		else {
+			__m512 strength;
+			if constexpr(std::is_same_v<PermType, float>)
+				strength = _mm512_loadu_ps(perms+j);
+			else
+				strength = _mm512_maskz_cvtph_ps(0xffff, _mm256_loadu_si256((const __m256i*)(perms+j)));
+			connected = _mm512_cmp_ps_mask(strength, threshold, _CMP_GT_OQ);
+		}
+
+		sum += __builtin_popcount(valid & on & connected);
+		if(end_lanes != 0)
+			return sum;
+	}
+	return sum + rowOverlapTail(synapses, perms, j, n, bits, connected_permeance);
+}
+
+//Picks the widest kernel the running CPU supports. nullptr if there is none
+template <typename PermType>
+static RowOverlapFunc<PermType> selectRowOverlap()
+{
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		return rowOverlapAVX512<PermType>;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+		return rowOverlapAVX2<PermType>;
+	return nullptr;
+}
+
+}
+#endif
+
+intmax_t et::detail::rowOverlap(const std::string& kernel, const int32_t* synapses, const void* perms, DType perm_type
+	, size_t n, const uint32_t* bits, float connected_permeance)
+{
+	intmax_t result = -1;
+	dispatch<PermTypeList>(perm_type, [&](auto v) {
+		using PermType = decltype(v);
+		RowOverlapFunc<PermType> f = nullptr;
+		if(kernel == "scalar")
+			f = rowOverlapScalar<PermType>;
+#ifdef ETALER_X86_SIMD_KERNELS
+		__builtin_cpu_init();
+		if(kernel == "avx2" && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+			f = rowOverlapAVX2<PermType>;
+		if(kernel == "avx512" && __builtin_cpu_supports("avx512f"))
+			f = rowOverlapAVX512<PermType>;
+#endif
+		if(f != nullptr)
+			result = f(synapses, (const PermType*)perms, n, bits, connected_permeance);
+	});
+	return result;
+}
 
+CPUBuffer::~CPUBuffer()
+{
+	if(allocator_)
+		allocator_->deallocate(storage_, dtypeToBufferSize(dtype(), size()));
+}
 
-	const bool* input = (const bool*)x->data();
+namespace et::detail
+{
+//Writes the activity of every cell into result. The inputs are expected to be checked by the caller
+template <typename PermType>
+static void overlapScores(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
+	, float connected_permeance, size_t active_threshold, int32_t* result)
+{
 	const int32_t* synapses = (const int32_t*)connections->data();
 	const PermType* synapse_strengths = (PermType*)permeances->data();
-	int32_t* result = (int32_t*)y->data();
 
 	size_t max_connections_per_cell = connections->shape().back();
 	size_t num_cells = connections->size()/max_connections_per_cell;
 
 
 	size_t block_size = std::min(size_t(128), (size_t)num_cells);
+
+#ifdef ETALER_X86_SIMD_KERNELS
+	static const RowOverlapFunc<PermType> row_overlap = selectRowOverlap<PermType>();
+	if(row_overlap != nullptr) {
+		// Bit tensors are already packed (x86 is little endian, so uint64_t words read fine as uint32_t pairs)
+		std::vector<uint32_t> packed;
+		const uint32_t* bits = (const uint32_t*)x->data();
+		if(x->dtype() == DType::Bool) {
+			const bool* input = (const bool*)x->data();
+			packed.resize((x->size()+31)/32);
+			tbb::parallel_for(size_t(0), packed.size(), [&](size_t w) {
+				uint32_t word = 0;
+				for(size_t i=w*32;i<std::min(w*32+32, x->size());i++)
+					word |= uint32_t(input[i]) << (i%32);
+				packed[w] = word;
+			});
+			bits = packed.data();
+		}
+
+		tbb::parallel_for(tbb::blocked_range<size_t>(size_t(0), num_cells, block_size), [&](const auto& r) {
+			for(size_t i=r.begin();i!=r.end();i++) {
+				size_t offset = i*max_connections_per_cell;
+				size_t sum = row_overlap(synapses+offset, synapse_strengths+offset, max_connections_per_cell, bits, connected_permeance);
+				result[i] = sum >= active_threshold ? sum : 0;
+			}
+		});
+		return;
+	}
+#endif
+
+	visitBinary(x, [&](auto input) {
 	tbb::parallel_for(tbb::blocked_range<size_t>(size_t(0), num_cells, block_size), [&](const auto& r) {
 		for(size_t i=r.begin();i!=r.end();i++) {
 			size_t sum = 0;
@@ -145,47 +452,386 @@ static std::shared_ptr<TensorImpl> cellActivity(const TensorImpl* x, const Tenso
 				result[i] = 0;
 		}
 	});
+	});
+}
+
+template <typename PermType>
+static std::shared_ptr<TensorImpl> cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
+	, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse, TensorImpl* out, CPUBackend* backend)
+{
+	//Checks the input are sane
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(connections, backend, DType::Int32, IsPlain(), permeances->shape());
+	requireProperties(permeances, backend, typeToDType<PermType>(), IsPlain());
+	et_check(connections->dimensions() >= 2);
+
+	Shape s = connections->shape();
+	s.pop_back();
+	return writeOutput(s, DType::Int32, out, {x, connections, permeances}, false, backend, [&](TensorImpl* y) {
+		overlapScores<PermType>(x, connections, permeances, connected_permeance, active_threshold, (int32_t*)y->data());
+	});
+}
+
+template <typename PermType>
+static std::shared_ptr<TensorImpl> batchCellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
+	, float connected_permeance, size_t active_threshold, CPUBackend* backend)
+{
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(connections, backend, DType::Int32, IsPlain(), permeances->shape());
+	requireProperties(permeances, backend, typeToDType<PermType>(), IsPlain());
+	et_check(connections->dimensions() >= 2);
+	et_check(x->dimensions() >= 1);
+
+	Shape cell_shape = connections->shape();
+	cell_shape.pop_back();
+	size_t batch_size = x->shape()[0];
+	size_t input_size = batch_size == 0 ? 0 : x->size()/batch_size;
+	auto y = backend->createTensor(Shape{intmax_t(batch_size)} + cell_shape, DType::Int32);
+
+	const int32_t* synapses = (const int32_t*)connections->data();
+	const PermType* synapse_strengths = (const PermType*)permeances->data();
+	int32_t* result = (int32_t*)y->data();
+
+	size_t max_connections_per_cell = connections->shape().back();
+	size_t num_cells = cell_shape.volume();
+
+	static const RowOverlapFunc<PermType> row_overlap = [](){
+#ifdef ETALER_X86_SIMD_KERNELS
+		if(auto f = selectRowOverlap<PermType>(); f != nullptr)
+			return f;
+#endif
+		return RowOverlapFunc<PermType>(rowOverlapScalar<PermType>);
+	}();
+
+	// Every sample is packed into bits. Then each cell is evaluated against the whole batch while its synapses are in cache
+	size_t words_per_sample = (input_size+31)/32;
+	std::vector<uint32_t> packed(words_per_sample*batch_size);
+	visitBinary(x, [&](auto input) {
+		tbb::parallel_for(size_t(0), batch_size, [&](size_t b) {
+			packBits(input, b*input_size, input_size, packed.data()+b*words_per_sample);
+		});
+	});
+
+	size_t block_size = std::max(size_t(1), std::min(size_t(128), num_cells));
+	tbb::parallel_for(tbb::blocked_range<size_t>(size_t(0), num_cells, block_size), [&](const auto& r) {
+		for(size_t i=r.begin();i!=r.end();i++) {
+			size_t offset = i*max_connections_per_cell;
+			for(size_t b=0;b<batch_size;b++) {
+				size_t sum = row_overlap(synapses+offset, synapse_strengths+offset, max_connections_per_cell
+					, packed.data()+b*words_per_sample, connected_permeance);
+				result[b*num_cells+i] = sum >= active_threshold ? sum : 0;
+			}
+		}
+	});
+	return y;
+}
+
+//A row of the reverse synapse index. Where it ends is resolved once, so the blocks in applyFanout() only do binary searches
+struct FanoutRow
+{
+	const uint32_t* begin;
+	const uint32_t* end;
+	int32_t delta;
+};
+
+static void addFanoutRows(const TensorImpl* bits, const TensorImpl* reverse_index, int32_t delta, std::vector<FanoutRow>& rows)
+{
+	const int32_t* ids = (const int32_t*)bits->data();
+	const uint32_t* index = (const uint32_t*)reverse_index->data(); //HACK: -1s are at the end of each row
+	size_t max_fanout = reverse_index->shape().back();
+	size_t num_inputs = reverse_index->size()/max_fanout;
+	for(size_t i=0;i<bits->size();i++) {
+		et_assert(ids[i] >= 0 && (size_t)ids[i] < num_inputs);
+		const uint32_t* row = index+ids[i]*max_fanout;
+		rows.push_back({row, std::lower_bound(row, row+max_fanout, uint32_t(-1)), delta});
+	}
+}
+
+//Adds each row's delta to the overlap of the cells it has a connected synapse to. Then writes the activity of the cells into
+//result (which can be the same as overlap)
+template <typename PermType>
+static void applyFanout(const std::vector<FanoutRow>& rows, const PermType* synapse_strengths, size_t max_connections_per_cell
+	, size_t num_cells, float connected_permeance, size_t active_threshold, int32_t* overlap, int32_t* result)
+{
+	// Each block owns a range of cells. And the rows of the index are sorted by the synapse index.
+	// So every block only visits the synapses that ends in it's own cells. No atomics needed
+	size_t block_size = std::max(size_t(1), std::min(size_t(4096), num_cells));
+	tbb::parallel_for(tbb::blocked_range<size_t>(size_t(0), num_cells, block_size), [&](const auto& r) {
+		const uint32_t first_synapse = r.begin()*max_connections_per_cell;
+		const uint32_t last_synapse = r.end()*max_connections_per_cell;
+		for(const auto& [begin, end, delta] : rows) {
+			for(auto it = std::lower_bound(begin, end, first_synapse);it != end && *it < last_synapse;++it) {
+				if(synapse_strengths[*it] > connected_permeance)
+					overlap[*it/max_connections_per_cell] += delta;
+			}
+		}
+		for(size_t i=r.begin();i!=r.end();i++)
+			result[i] = overlap[i] < (int32_t)active_threshold ? 0 : overlap[i];
+	});
+}
+
+template <typename PermType>
+static std::shared_ptr<TensorImpl> invertedCellActivity(const TensorImpl* active_bits, const TensorImpl* reverse_index, const TensorImpl* permeances
+	, float connected_permeance, size_t active_threshold, CPUBackend* backend)
+{
+	requireProperties(active_bits, backend, DType::Int32, IsPlain());
+	requireProperties(reverse_index, backend, DType::Int32, IsPlain());
+	requireProperties(permeances, backend, typeToDType<PermType>(), IsPlain());
+	et_check(permeances->dimensions() >= 2);
+
+	Shape s = permeances->shape();
+	s.pop_back();
+	auto y = backend->createTensor(s, DType::Int32);
+	int32_t* result = (int32_t*)y->data();
+	std::fill(result, result+y->size(), 0);
+
+	std::vector<FanoutRow> rows;
+	addFanoutRows(active_bits, reverse_index, 1, rows);
+	applyFanout(rows, (const PermType*)permeances->data(), permeances->shape().back(), y->size()
+		, connected_permeance, active_threshold, result, result);
+	return y;
+}
+
+template <typename PermType>
+static std::shared_ptr<TensorImpl> updateOverlaps(const TensorImpl* turned_on, const TensorImpl* turned_off, const TensorImpl* reverse_index
+	, const TensorImpl* permeances, float connected_permeance, size_t active_threshold, TensorImpl* overlaps, CPUBackend* backend)
+{
+	requireProperties(turned_on, backend, DType::Int32, IsPlain());
+	requireProperties(turned_off, backend, DType::Int32, IsPlain());
+	requireProperties(reverse_index, backend, DType::Int32, IsPlain());
+	requireProperties(permeances, backend, typeToDType<PermType>(), IsPlain());
+	et_check(permeances->dimensions() >= 2);
+
+	Shape s = permeances->shape();
+	s.pop_back();
+	requireProperties(overlaps, backend, DType::Int32, IsPlain(), s);
+	auto y = backend->createTensor(s, DType::Int32);
 
+	std::vector<FanoutRow> rows;
+	addFanoutRows(turned_on, reverse_index, 1, rows);
+	addFanoutRows(turned_off, reverse_index, -1, rows);
+	applyFanout(rows, (const PermType*)permeances->data(), permeances->shape().back(), y->size()
+		, connected_permeance, active_threshold, (int32_t*)overlaps->data(), (int32_t*)y->data());
 	return y;
 }
 
+template <typename PermType>
+static void recomputeOverlaps(const TensorImpl* x, const TensorImpl* cells, const TensorImpl* connections, const TensorImpl* permeances
+	, float connected_permeance, TensorImpl* overlaps, CPUBackend* backend)
+{
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(cells, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(connections, backend, DType::Int32, IsPlain(), permeances->shape());
+	requireProperties(permeances, backend, typeToDType<PermType>(), IsPlain());
+	requireProperties(overlaps, backend, DType::Int32, IsPlain(), cells->shape());
+
+	const int32_t* synapses = (const int32_t*)connections->data();
+	const PermType* synapse_strengths = (const PermType*)permeances->data();
+	int32_t* overlap = (int32_t*)overlaps->data();
+	size_t max_connections_per_cell = connections->shape().back();
+
+	visitBinary(x, [&](auto input) { visitBinary(cells, [&](auto mask) {
+	tbb::parallel_for(size_t(0), cells->size(), [&](size_t i) {
+		if(mask[i] == false)
+			return;
+		int32_t sum = 0;
+		for(size_t j=i*max_connections_per_cell;j<(i+1)*max_connections_per_cell && synapses[j] != -1;j++)
+			sum += input[synapses[j]] && synapse_strengths[j] > connected_permeance;
+		overlap[i] = sum;
+	});
+	});});
+}
+
+//One learning step of a synapse. The permanence moves towards 1 if the input is on and towards 0 otherwise
+template <typename PermType>
+struct PermanenceUpdate
+{
+	PermanenceUpdate(float perm_inc, float perm_dec) : inc(perm_inc), dec(perm_dec) {}
+	void operator() (PermType& perm, bool on) const
+	{
+		if(on == true)
+			perm += inc;
+		else
+			perm -= dec;
+
+		perm = std::clamp(perm, PermType(0), PermType(1));
+	}
+	float inc;
+	float dec;
+};
+
+//Fixed point permanences take saturating integer steps
+template <>
+struct PermanenceUpdate<unorm8>
+{
+	PermanenceUpdate(float perm_inc, float perm_dec) : inc(unorm8::step(perm_inc)), dec(unorm8::step(perm_dec)) {}
+	void operator() (unorm8& perm, bool on) const
+	{
+		int32_t v = perm.value;
+		perm.value = on == true ? std::min(v+inc, 255) : std::max(v-dec, 0);
+	}
+	int32_t inc;
+	int32_t dec;
+};
+
+//Reinforces the synapses of cell i connected to active inputs and punishes the rest
+template <typename PermType, typename Input>
+inline void learnCell(size_t i, const Input& input, const int32_t* synapses, PermType* synapse_strengths
+	, size_t max_connections_per_cell, const PermanenceUpdate<PermType>& update)
+{
+	for(size_t j=0; j<max_connections_per_cell;j++) {
+		size_t idx = i*max_connections_per_cell+j;
+		auto connection = synapses[idx];
+		if(connection == -1)
+			break;
+
+		update(synapse_strengths[idx], input[connection]);
+	}
+}
+
+//Finds the smallest value that survives global inhibition. i.e. the value of the target_size-th largest non-zero value.
+//Everything that is non-zero and not smaller than the threshold wins. Returns false when all values are zero.
+//Activities are small integers most of the time, so a counting select is used when the value range allows
+static bool inhibitionThreshold(const int32_t* values, size_t n, size_t target_size, int32_t& threshold)
+{
+	size_t num_nonzero = 0;
+	int32_t min_val = std::numeric_limits<int32_t>::max();
+	int32_t max_val = std::numeric_limits<int32_t>::min();
+	for(size_t i=0;i<n;i++) {
+		if(values[i] == 0)
+			continue;
+		num_nonzero += 1;
+		min_val = std::min(min_val, values[i]);
+		max_val = std::max(max_val, values[i]);
+	}
+
+	if(num_nonzero == 0)
+		return false;
+
+	// The rank (counting from the largest) of the threshold value
+	size_t accept_index = std::min((target_size==0? 0 : target_size-1), num_nonzero-1);
+
+	size_t value_range = size_t(int64_t(max_val) - int64_t(min_val)) + 1;
+	if(value_range <= std::max(n, size_t(4096))) {
+		thread_local std::vector<uint32_t> histogram;
+		histogram.assign(value_range, 0);
+		for(size_t i=0;i<n;i++) {
+			if(values[i] != 0)
+				histogram[values[i]-min_val] += 1;
+		}
+
+		size_t seen = 0;
+		for(size_t i=value_range;i--!=0;) {
+			seen += histogram[i];
+			if(seen > accept_index) {
+				threshold = int32_t(min_val + int64_t(i));
+				return true;
+			}
+		}
+		et_assert(false, "Unreachable");
+	}
+
+	thread_local std::vector<int32_t> candidates;
+	candidates.clear();
+	for(size_t i=0;i<n;i++) {
+		if(values[i] != 0)
+			candidates.push_back(values[i]);
+	}
+	std::nth_element(candidates.begin(), candidates.begin()+accept_index, candidates.end(), std::greater<int32_t>());
+	threshold = candidates[accept_index];
+	return true;
+}
+
 template <typename PermType>
 void learnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* connections, TensorImpl* permeances
 	, float perm_inc, float perm_dec, bool has_unconnected_synapse, CPUBackend* backend)
 {
-	requireProperties(x, backend, DType::Bool, IsPlain());
-	requireProperties(learn, backend, DType::Bool, IsPlain());
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(learn, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
 	requireProperties(connections, backend, DType::Int32, IsPlain(), permeances->shape());
 	requireProperties(permeances, backend, typeToDType<PermType>(), IsPlain());
 
-	const bool* input = (const bool*)x->data();
-	const bool* learning = (const bool*)learn->data();
 	const int32_t* synapses = (const int32_t*)connections->data();
 	PermType* synapse_strengths = (PermType*)permeances->data();
 
 	size_t max_connections_per_cell = connections->shape().back();
-	size_t num_cells = connections->size()/max_connections_per_cell;
+	const PermanenceUpdate<PermType> update(perm_inc, perm_dec);
 
+	visitBinary(x, [&](auto input) { visitBinary(learn, [&](auto learning) {
 	tbb::parallel_for(size_t(0), learn->size(), [&](size_t i) {
 		if(learning[i] == false)
 			return;
+		learnCell(i, input, synapses, synapse_strengths, max_connections_per_cell, update);
+	});
+	});});
+}
 
-		for(size_t j=0; j<max_connections_per_cell;j++) {
-			size_t idx = i*max_connections_per_cell+j;
-			auto connection = synapses[idx];
-			if(connection == -1)
-				break;
-			ASSERT((size_t)connection < num_cells);
+template <typename PermType>
+static std::shared_ptr<TensorImpl> spatialPoolerStep(const TensorImpl* x, const TensorImpl* connections, TensorImpl* permeances
+	, const TensorImpl* average_activity, float connected_permeance, size_t active_threshold, float density, float boost_factor
+	, bool learn, float perm_inc, float perm_dec, CPUBackend* backend)
+{
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(connections, backend, DType::Int32, IsPlain(), permeances->shape());
+	requireProperties(permeances, backend, typeToDType<PermType>(), IsPlain());
+	et_check(connections->dimensions() >= 2);
 
-			PermType& perm = synapse_strengths[idx];
-			if(input[connection] == true)
-				perm += perm_inc;
-			else
-				perm -= perm_dec;
+	Shape s = connections->shape();
+	s.pop_back();
+	if(average_activity != nullptr)
+		requireProperties(average_activity, backend, DType::Float, IsPlain(), s);
+	size_t num_cells = s.volume();
+	size_t max_connections_per_cell = connections->shape().back();
+
+	// Scratch space kept between calls. So online training only allocates the output.
+	// NOTE: Only touch them through pointers inside parallel regions. Worker threads have their own copies
+	thread_local std::vector<int32_t> activity_buffer;
+	thread_local std::vector<uint32_t> winners;
+	activity_buffer.resize(num_cells);
+	int32_t* activity = activity_buffer.data();
+
+	overlapScores<PermType>(x, connections, permeances, connected_permeance, active_threshold, activity);
+
+	if(average_activity != nullptr && boost_factor != 0) {
+		const float* average = (const float*)average_activity->data();
+		tbb::parallel_for(size_t(0), num_cells, [&](size_t i) {
+			// Same math as boost() in Boost.hpp
+			float factor = std::exp((density - average[i]) * boost_factor);
+			activity[i] = int32_t(factor * activity[i]);
+		});
+	}
+
+	// Global inhibition. Selecting the k-th largest activity is enough, no need to sort everything
+	auto y = backend->createTensor(s, DType::Bool);
+	bool* output = (bool*)y->data();
+	std::fill(output, output+num_cells, false);
+
+	size_t target_size = num_cells*density;
+	int32_t min_accept_val;
+	if(inhibitionThreshold(activity, num_cells, target_size, min_accept_val) == false)
+		return y;
 
-			perm = std::clamp(perm, PermType(0), PermType(1));
+	winners.clear();
+	for(size_t i=0;i<num_cells;i++) {
+		if(activity[i] != 0 && activity[i] >= min_accept_val) {
+			output[i] = true;
+			winners.push_back(i);
 		}
-	});
+	}
+
+	// Only the winning columns are written to
+	if(learn) {
+		const int32_t* synapses = (const int32_t*)connections->data();
+		PermType* synapse_strengths = (PermType*)permeances->data();
+		const uint32_t* winner_ids = winners.data();
+		const PermanenceUpdate<PermType> update(perm_inc, perm_dec);
+		visitBinary(x, [&](auto input) {
+			tbb::parallel_for(size_t(0), winners.size(), [&](size_t i) {
+				learnCell(winner_ids[i], input, synapses, synapse_strengths, max_connections_per_cell, update);
+			});
+		});
+	}
+	return y;
 }
 
 template <typename PermType>
@@ -220,8 +866,8 @@ template <typename PermType>
 void growSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* connections
 	, TensorImpl* permeances, float initial_perm, CPUBackend* backend)
 {
-	requireProperties(x, backend, DType::Bool, IsPlain());
-	requireProperties(y, backend, DType::Bool, IsPlain());
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(y, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
 	requireProperties(connections, backend, DType::Int32, IsPlain(), permeances->shape());
 	requireProperties(permeances, backend, typeToDType<PermType>(), IsPlain());
 
@@ -232,19 +878,20 @@ void growSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* connecti
 	size_t max_synapses_per_cell = connections->shape().back();
 	size_t input_cell_count = x->size();
 
-	const bool* in = (const bool*) x->data();
-	const bool* out = (const bool*) y->data();
 	int32_t* conns = (int32_t*)connections->data();
 	PermType* perms = (PermType*)permeances->data();
 
 	std::vector<uint32_t> on_bits;
 	on_bits.reserve(input_cell_count*0.1);
-	for(size_t i=0;i<input_cell_count;i++) {
-		if(in[i] == true)
-			on_bits.push_back(i);
-	}
+	visitBinary(x, [&](auto in) {
+		for(size_t i=0;i<input_cell_count;i++) {
+			if(in[i] == true)
+				on_bits.push_back(i);
+		}
+	});
 
 	size_t block_size = std::min(size_t(16), (size_t)y->shape().back());
+	visitBinary(y, [&](auto out) {
 	tbb::parallel_for(tbb::blocked_range<size_t>(size_t(0), y->size(), block_size), [&](const auto& r) {
 		for(size_t i=r.begin();i!=r.end();i++) {
 			if(out[i] == 0)
@@ -291,6 +938,7 @@ void growSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* connecti
 			apply_permutation_in_place(strengths, strengths+write_idx, sort_indices);
 		}
 	});
+	});
 }
 
 template <typename PermType>
@@ -329,28 +977,510 @@ void decaySynapses(TensorImpl* connections, TensorImpl* permeances, float thresh
 	});
 }
 
-}
+//A cell's slice of the synapse storage in the CSR layout
+struct SparseRow
+{
+	int32_t offset;
+	int32_t size;
+	int32_t capacity;
+};
+static_assert(sizeof(SparseRow) == 3*sizeof(int32_t));
 
-std::shared_ptr<TensorImpl> CPUBackend::cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
-	, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse)
+template <typename PermType>
+static void requireSparseSynapses(const TensorImpl* rows, const TensorImpl* indices, const TensorImpl* permeances, CPUBackend* backend)
 {
-	std::shared_ptr<TensorImpl> res;
-	dispatch<type_list_t<float, half>>(permeances->dtype(), [&](auto v){
-		res = detail::cellActivity<decltype(v)>(x, connections, permeances, connected_permeance, active_threshold, has_unconnected_synapse, this);
-	});
-	return res;
+	requireProperties(rows, backend, DType::Int32, IsPlain());
+	requireProperties(indices, backend, DType::Int32, IsPlain(), permeances->shape());
+	requireProperties(permeances, backend, typeToDType<PermType>(), IsPlain());
+	et_check(rows->dimensions() >= 2 && rows->shape().back() == 3, "Expecting rows to have the shape [cells...] + 3");
 }
 
-void CPUBackend::learnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* connections, TensorImpl* permeances
-	, float perm_inc, float perm_dec, bool has_unconnected_synapse)
+template <typename PermType>
+static std::shared_ptr<TensorImpl> sparseCellActivity(const TensorImpl* x, const TensorImpl* rows, const TensorImpl* indices
+	, const TensorImpl* permeances, float connected_permeance, size_t active_threshold, CPUBackend* backend)
 {
-	dispatch<type_list_t<float, half>>(permeances->dtype(), [&](auto v){
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireSparseSynapses<PermType>(rows, indices, permeances, backend);
+
+	Shape s = rows->shape();
+	s.pop_back();
+	auto y = backend->createTensor(s, DType::Int32);
+
+	const SparseRow* row = (const SparseRow*)rows->data();
+	const int32_t* synapses = (const int32_t*)indices->data();
+	const PermType* synapse_strengths = (const PermType*)permeances->data();
+	int32_t* result = (int32_t*)y->data();
+	size_t num_cells = s.volume();
+
+	static const RowOverlapFunc<PermType> row_overlap = [](){
+#ifdef ETALER_X86_SIMD_KERNELS
+		if(auto f = selectRowOverlap<PermType>(); f != nullptr)
+			return f;
+#endif
+		return RowOverlapFunc<PermType>(rowOverlapScalar<PermType>);
+	}();
+
+	std::vector<uint32_t> packed((x->size()+31)/32);
+	visitBinary(x, [&](auto input) {
+		packBits(input, 0, x->size(), packed.data());
+	});
+
+	size_t block_size = std::max(size_t(1), std::min(size_t(128), num_cells));
+	tbb::parallel_for(tbb::blocked_range<size_t>(size_t(0), num_cells, block_size), [&](const auto& r) {
+		for(size_t i=r.begin();i!=r.end();i++) {
+			size_t sum = row_overlap(synapses+row[i].offset, synapse_strengths+row[i].offset, row[i].size
+				, packed.data(), connected_permeance);
+			result[i] = sum >= active_threshold ? sum : 0;
+		}
+	});
+	return y;
+}
+
+template <typename PermType>
+static void sparseLearnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* rows, const TensorImpl* indices
+	, TensorImpl* permeances, float perm_inc, float perm_dec, CPUBackend* backend)
+{
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(learn, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireSparseSynapses<PermType>(rows, indices, permeances, backend);
+	et_check(learn->size()*3 == rows->size());
+
+	const SparseRow* row = (const SparseRow*)rows->data();
+	const int32_t* synapses = (const int32_t*)indices->data();
+	PermType* synapse_strengths = (PermType*)permeances->data();
+	const PermanenceUpdate<PermType> update(perm_inc, perm_dec);
+
+	visitBinary(x, [&](auto input) { visitBinary(learn, [&](auto learning) {
+	tbb::parallel_for(size_t(0), learn->size(), [&](size_t i) {
+		if(learning[i] == false)
+			return;
+		for(int32_t j=row[i].offset;j<row[i].offset+row[i].size;j++)
+			update(synapse_strengths[j], input[synapses[j]]);
+	});
+	});});
+}
+
+//Counts the synapses growSynapses() would add to a cell. i.e. the on bits not yet connected, in order, until the cell is
+//full. last is set to the position in on_bits of the last one added
+static size_t countNewSynapses(const int32_t* synapses, size_t size, const std::vector<int32_t>& on_bits, size_t room, size_t& last)
+{
+	size_t num_new = 0;
+	size_t j = 0;
+	for(size_t b=0;b<on_bits.size() && num_new<room;b++) {
+		while(j<size && synapses[j] < on_bits[b])
+			j++;
+		if(j<size && synapses[j] == on_bits[b])
+			continue;
+		num_new++;
+		last = b;
+	}
+	return num_new;
+}
+
+template <typename PermType>
+static void sparseGrowSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* rows, std::shared_ptr<TensorImpl>& indices
+	, std::shared_ptr<TensorImpl>& permeances, float initial_perm, size_t max_synapses_per_cell, CPUBackend* backend)
+{
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(y, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireSparseSynapses<PermType>(rows, indices.get(), permeances.get(), backend);
+
+	Shape s = rows->shape();
+	s.pop_back();
+	et_check(s == y->shape());
+
+	SparseRow* row = (SparseRow*)rows->data();
+	size_t num_cells = y->size();
+
+	std::vector<int32_t> on_bits;
+	visitBinary(x, [&](auto in) {
+		for(size_t i=0;i<x->size();i++) {
+			if(in[i] == true)
+				on_bits.push_back(i);
+		}
+	});
+
+	std::vector<size_t> num_new(num_cells, 0);
+	std::vector<size_t> last_bit(num_cells, 0);
+	const int32_t* old_synapses = (const int32_t*)indices->data();
+	visitBinary(y, [&](auto out) {
+		tbb::parallel_for(size_t(0), num_cells, [&](size_t i) {
+			if(out[i] == false || size_t(row[i].size) >= max_synapses_per_cell)
+				return;
+			num_new[i] = countNewSynapses(old_synapses+row[i].offset, row[i].size, on_bits
+				, max_synapses_per_cell-row[i].size, last_bit[i]);
+		});
+	});
+
+	//Rows without enough room are moved to the end of the storage with their capacity (at least) doubled. So a row is
+	//moved O(log(max_synapses_per_cell)) times in total. The storage itself grows geometrically and is compacted once
+	//more than half of it is left behind by moved rows
+	size_t storage_end = 0;
+	size_t reserved = 0;
+	for(size_t i=0;i<num_cells;i++) {
+		storage_end = std::max(storage_end, size_t(row[i].offset+row[i].capacity));
+		reserved += row[i].capacity;
+	}
+
+	std::vector<SparseRow> new_row(row, row+num_cells);
+	size_t new_end = storage_end;
+	for(size_t i=0;i<num_cells;i++) {
+		size_t required = row[i].size+num_new[i];
+		if(required <= size_t(row[i].capacity))
+			continue;
+		size_t capacity = std::min(max_synapses_per_cell, std::max({required, size_t(row[i].capacity)*2, size_t(4)}));
+		new_row[i].offset = new_end;
+		new_row[i].capacity = capacity;
+		new_end += capacity;
+		reserved += capacity - row[i].capacity;
+	}
+	et_check(new_end <= size_t(std::numeric_limits<int32_t>::max()), "Too many synapses for 32 bit offsets");
+
+	//Never grow past what the dense layout would use. Compact instead
+	size_t dense_size = num_cells*max_synapses_per_cell;
+	size_t storage_size = indices->size();
+	bool compact = new_end > 2*reserved || (new_end > storage_size && new_end > dense_size);
+	if(compact) {
+		size_t offset = 0;
+		for(size_t i=0;i<num_cells;i++) {
+			new_row[i].offset = offset;
+			offset += new_row[i].capacity;
+		}
+		new_end = offset;
+	}
+
+	//Copy the rows to where they now live. Into new tensors if the current ones aren't large enough (or are compacted)
+	std::shared_ptr<TensorImpl> new_indices = indices;
+	std::shared_ptr<TensorImpl> new_permeances = permeances;
+	if(compact || new_end > storage_size) {
+		size_t new_size = std::min(compact ? new_end+new_end/2 : std::max(new_end, storage_size*2), dense_size);
+		new_size = std::max({new_size, new_end, size_t(1)});
+		new_indices = backend->createTensor({intmax_t(new_size)}, DType::Int32);
+		new_permeances = backend->createTensor({intmax_t(new_size)}, typeToDType<PermType>());
+		//Zeroed, so the unused storage doesn't hold whatever was in the memory before
+		memset(new_indices->data(), 0, dtypeToBufferSize(DType::Int32, new_size));
+		memset(new_permeances->data(), 0, dtypeToBufferSize(typeToDType<PermType>(), new_size));
+	}
+	const PermType* old_strengths = (const PermType*)permeances->data();
+	int32_t* synapses = (int32_t*)new_indices->data();
+	PermType* strengths = (PermType*)new_permeances->data();
+	bool reallocated = new_indices != indices;
+	tbb::parallel_for(size_t(0), num_cells, [&](size_t i) {
+		if(reallocated == false && new_row[i].offset == row[i].offset)
+			return;
+		std::copy(old_synapses+row[i].offset, old_synapses+row[i].offset+row[i].size, synapses+new_row[i].offset);
+		std::copy(old_strengths+row[i].offset, old_strengths+row[i].offset+row[i].size, strengths+new_row[i].offset);
+	});
+	std::copy(new_row.begin(), new_row.end(), row);
+	indices = new_indices;
+	permeances = new_permeances;
+
+	//Merge the new synapses into the (sorted) rows. From the back, so it can be done in place
+	tbb::parallel_for(size_t(0), num_cells, [&](size_t i) {
+		if(num_new[i] == 0)
+			return;
+		int32_t* cell_synapses = synapses+row[i].offset;
+		PermType* cell_strengths = strengths+row[i].offset;
+		intmax_t a = row[i].size-1;
+		intmax_t b = last_bit[i];
+		intmax_t w = row[i].size+num_new[i]-1;
+		while(w > a) {
+			if(a >= 0 && on_bits[b] == cell_synapses[a])
+				b--; //Already connected
+			else if(a < 0 || on_bits[b] > cell_synapses[a]) {
+				cell_synapses[w] = on_bits[b];
+				cell_strengths[w] = initial_perm;
+				w--;
+				b--;
+			}
+			else {
+				cell_synapses[w] = cell_synapses[a];
+				cell_strengths[w] = cell_strengths[a];
+				w--;
+				a--;
+			}
+		}
+		row[i].size += num_new[i];
+	});
+}
+
+template <typename PermType>
+static void sparseDecaySynapses(TensorImpl* rows, TensorImpl* indices, TensorImpl* permeances, float threshold, CPUBackend* backend)
+{
+	requireSparseSynapses<PermType>(rows, indices, permeances, backend);
+
+	SparseRow* row = (SparseRow*)rows->data();
+	int32_t* synapses = (int32_t*)indices->data();
+	PermType* strengths = (PermType*)permeances->data();
+
+	tbb::parallel_for(size_t(0), rows->size()/3, [&](size_t i) {
+		int32_t write_idx = row[i].offset;
+		for(int32_t j=row[i].offset;j<row[i].offset+row[i].size;j++) {
+			if(strengths[j] < threshold)
+				continue;
+			synapses[write_idx] = synapses[j];
+			strengths[write_idx] = strengths[j];
+			write_idx++;
+		}
+		row[i].size = write_idx - row[i].offset;
+	});
+}
+
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
+	, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse)
+{
+	ET_PROFILE_OP(x);
+	std::shared_ptr<TensorImpl> res;
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		res = detail::cellActivity<decltype(v)>(x, connections, permeances, connected_permeance, active_threshold, has_unconnected_synapse, nullptr, this);
+	});
+	return res;
+}
+
+void CPUBackend::cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
+	, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		detail::cellActivity<decltype(v)>(x, connections, permeances, connected_permeance, active_threshold, has_unconnected_synapse, out, this);
+	});
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::batchCellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
+	, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse)
+{
+	ET_PROFILE_OP(x);
+	std::shared_ptr<TensorImpl> res;
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		res = detail::batchCellActivity<decltype(v)>(x, connections, permeances, connected_permeance, active_threshold, this);
+	});
+	return res;
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::invertedCellActivity(const TensorImpl* active_bits, const TensorImpl* reverse_index
+	, const TensorImpl* permeances, float connected_permeance, size_t active_threshold)
+{
+	ET_PROFILE_OP(active_bits);
+	std::shared_ptr<TensorImpl> res;
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		res = detail::invertedCellActivity<decltype(v)>(active_bits, reverse_index, permeances, connected_permeance, active_threshold, this);
+	});
+	return res;
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::updateOverlaps(const TensorImpl* turned_on, const TensorImpl* turned_off, const TensorImpl* reverse_index
+	, const TensorImpl* permeances, float connected_permeance, size_t active_threshold, TensorImpl* overlaps)
+{
+	ET_PROFILE_OP(turned_on);
+	std::shared_ptr<TensorImpl> res;
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		res = detail::updateOverlaps<decltype(v)>(turned_on, turned_off, reverse_index, permeances, connected_permeance
+			, active_threshold, overlaps, this);
+	});
+	return res;
+}
+
+void CPUBackend::recomputeOverlaps(const TensorImpl* x, const TensorImpl* cells, const TensorImpl* connections, const TensorImpl* permeances
+	, float connected_permeance, TensorImpl* overlaps)
+{
+	ET_PROFILE_OP(x);
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		detail::recomputeOverlaps<decltype(v)>(x, cells, connections, permeances, connected_permeance, overlaps, this);
+	});
+}
+
+namespace et::detail
+{
+//Packs x, as rows of row_size elements, into num_words 64 bit words per row. So every row starts on a new word
+static std::vector<uint64_t> packRows(const TensorImpl* x, size_t row_size, size_t num_words)
+{
+	size_t num_rows = x->size()/row_size;
+	std::vector<uint64_t> packed(num_rows*num_words, 0);
+	visitBinary(x, [&](auto input) {
+		tbb::parallel_for(size_t(0), num_rows, [&](size_t r) {
+			uint64_t* out = packed.data() + r*num_words;
+			for(size_t i=0;i<row_size;i++)
+				out[i/64] |= uint64_t(input[r*row_size+i]) << (i%64);
+		});
+	});
+	return packed;
+}
+
+static std::shared_ptr<TensorImpl> maskCellActivity(const TensorImpl* x, const TensorImpl* masks, size_t active_threshold
+	, bool batched, CPUBackend* backend)
+{
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(masks, backend, DType::Bit, IsPlain());
+	et_check(batched == false || x->dimensions() >= 2, "Expecting a batch of inputs, got shape " + to_string(x->shape()));
+	size_t num_samples = batched ? x->shape()[0] : 1;
+	size_t input_size = x->size()/std::max(num_samples, size_t(1));
+	size_t num_words = (input_size+63)/64;
+	et_check(masks->dimensions() >= 2 && masks->shape().back() == intmax_t(num_words*64), "Expecting masks of shape [cells...] + "
+		+ std::to_string(num_words*64) + " for an input of " + std::to_string(input_size) + " bits, got " + to_string(masks->shape()));
+
+	Shape s = masks->shape();
+	s.pop_back();
+	auto y = backend->createTensor(batched ? Shape{intmax_t(num_samples)} + s : s, DType::Int32);
+
+	// A single Bit tensor is already packed and it's padding bits are 0
+	std::vector<uint64_t> packed;
+	const uint64_t* input = (const uint64_t*)x->data();
+	if(batched || x->dtype() == DType::Bool) {
+		packed = packRows(x, input_size, num_words);
+		input = packed.data();
+	}
+
+	const uint64_t* mask = (const uint64_t*)masks->data();
+	int32_t* result = (int32_t*)y->data();
+	size_t num_cells = s.volume();
+	size_t n = num_samples*num_cells;
+	size_t block_size = std::max(size_t(1), std::min(size_t(128), n));
+	tbb::parallel_for(tbb::blocked_range<size_t>(size_t(0), n, block_size), [&](const auto& r) {
+		for(size_t i=r.begin();i!=r.end();i++) {
+			const uint64_t* sample = input + i/num_cells*num_words;
+			const uint64_t* row = mask + i%num_cells*num_words;
+			size_t sum = 0;
+			for(size_t w=0;w<num_words;w++)
+				sum += popcount(row[w] & sample[w]);
+			result[i] = sum >= active_threshold ? sum : 0;
+		}
+	});
+	return y;
+}
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::maskCellActivity(const TensorImpl* x, const TensorImpl* masks, size_t active_threshold)
+{
+	ET_PROFILE_OP(x);
+	return detail::maskCellActivity(x, masks, active_threshold, false, this);
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::batchMaskCellActivity(const TensorImpl* x, const TensorImpl* masks, size_t active_threshold)
+{
+	ET_PROFILE_OP(x);
+	return detail::maskCellActivity(x, masks, active_threshold, true, this);
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::indexCellActivity(const TensorImpl* x, const TensorImpl* rows, const TensorImpl* indices
+	, size_t active_threshold)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(rows, this, DType::Int32, IsPlain());
+	requireProperties(indices, this, DType::Int32, IsPlain());
+	et_check(rows->dimensions() >= 2 && rows->shape().back() == 2, "Expecting rows to have the shape [cells...] + 2");
+
+	Shape s = rows->shape();
+	s.pop_back();
+	auto y = createTensor(s, DType::Int32);
+
+	const int32_t* row = (const int32_t*)rows->data();
+	const int32_t* targets = (const int32_t*)indices->data();
+	int32_t* result = (int32_t*)y->data();
+	size_t num_cells = s.volume();
+	size_t block_size = std::max(size_t(1), std::min(size_t(128), num_cells));
+	detail::visitBinary(x, [&](auto input) {
+		tbb::parallel_for(tbb::blocked_range<size_t>(size_t(0), num_cells, block_size), [&](const auto& r) {
+			for(size_t i=r.begin();i!=r.end();i++) {
+				const int32_t* begin = targets + row[i*2];
+				size_t sum = 0;
+				for(int32_t j=0;j<row[i*2+1];j++)
+					sum += input[begin[j]];
+				result[i] = sum >= active_threshold ? sum : 0;
+			}
+		});
+	});
+	return y;
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::reverseSynapseIndex(const TensorImpl* connections, const Shape& input_shape)
+{
+	ET_PROFILE_OP(connections);
+	requireProperties(connections, this, DType::Int32, IsPlain());
+
+	const int32_t* synapses = (const int32_t*)connections->data();
+	size_t num_inputs = input_shape.volume();
+	size_t num_synapses = connections->size();
+
+	// Count how many synapses connects to each input bit. Then lay the synapses out row by row.
+	// Rows are filled in increasing synapse index, so they come out sorted
+	std::vector<int32_t> fanout(num_inputs, 0);
+	for(size_t i=0;i<num_synapses;i++) {
+		int32_t target = synapses[i];
+		if(target == -1)
+			continue;
+		et_check((size_t)target < num_inputs, "Synapse connects to bit " + std::to_string(target)
+			+ ", which is out of range for input shape " + to_string(input_shape));
+		fanout[target] += 1;
+	}
+	size_t max_fanout = std::max(*std::max_element(fanout.begin(), fanout.end()), int32_t(1));
+
+	auto res = createTensor(input_shape + intmax_t(max_fanout), DType::Int32);
+	int32_t* index = (int32_t*)res->data();
+	std::fill(index, index+res->size(), -1);
+	std::fill(fanout.begin(), fanout.end(), 0);
+	for(size_t i=0;i<num_synapses;i++) {
+		int32_t target = synapses[i];
+		if(target == -1)
+			continue;
+		index[target*max_fanout+fanout[target]] = i;
+		fanout[target] += 1;
+	}
+	return res;
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::flatnonzero(const TensorImpl* x)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this, IsPlain());
+
+	std::vector<int32_t> indices;
+	if(x->dtype() == DType::Bit) {
+		const uint64_t* words = (const uint64_t*)x->data();
+		for(size_t w=0;w<(x->size()+63)/64;w++) {
+			for(uint64_t bits=words[w];bits!=0;bits&=bits-1)
+				indices.push_back(w*64+detail::popcount((bits & (~bits+1)) - 1)); //Index of the lowest set bit
+		}
+		return createTensor({intmax_t(indices.size())}, DType::Int32, indices.data());
+	}
+	dispatch(x->dtype(), [&](auto v){
+		using T = decltype(v);
+		const T* ptr = (const T*)x->data();
+		for(size_t i=0;i<x->size();i++) {
+			if(ptr[i] != T(0))
+				indices.push_back(i);
+		}
+	});
+	return createTensor({intmax_t(indices.size())}, DType::Int32, indices.data());
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::spatialPoolerStep(const TensorImpl* x, const TensorImpl* connections, TensorImpl* permeances
+	, const TensorImpl* average_activity, float connected_permeance, size_t active_threshold, float density, float boost_factor
+	, bool learn, float perm_inc, float perm_dec)
+{
+	ET_PROFILE_OP(x);
+	std::shared_ptr<TensorImpl> res;
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		res = detail::spatialPoolerStep<decltype(v)>(x, connections, permeances, average_activity, connected_permeance
+			, active_threshold, density, boost_factor, learn, perm_inc, perm_dec, this);
+	});
+	return res;
+}
+
+void CPUBackend::learnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* connections, TensorImpl* permeances
+	, float perm_inc, float perm_dec, bool has_unconnected_synapse)
+{
+	ET_PROFILE_OP(x);
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
 		detail::learnCorrilation<decltype(v)>(x, learn, connections, permeances, perm_inc, perm_dec, has_unconnected_synapse, this);
 	});
 }
 
 std::shared_ptr<TensorImpl> CPUBackend::globalInhibition(const TensorImpl* x, float fraction)
 {
+	ET_PROFILE_OP(x);
 	requireProperties(x, this, DType::Int32, IsPlain());
 
 	auto y = createTensor(x->shape(), DType::Bool);
@@ -358,156 +1488,493 @@ std::shared_ptr<TensorImpl> CPUBackend::globalInhibition(const TensorImpl* x, fl
 	const int32_t* input = (const int32_t*)x->data();
 	bool* output = (bool*)y->data();
 
-	std::vector<std::pair<int32_t, size_t>> v;
 	size_t target_size = x->size()*fraction;
-	v.reserve(target_size);//Some sane value
-	for(size_t i=0;i<x->size();i++) {
-		if(input[i] != 0)
-			v.push_back({input[i], i});
-	}
-
+	int32_t min_accept_val;
 	//If we have a empty input
-	if(v.size() == 0)
+	if(detail::inhibitionThreshold(input, x->size(), target_size, min_accept_val) == false) {
+		std::fill(output, output+y->size(), false);
 		return y;
+	}
 
-	tbb::parallel_sort(v.begin(), v.end(), [](const auto& a, const auto&b){return a.first > b.first;});
+	tbb::parallel_for(size_t(0), y->size(), [&](size_t i) {
+		output[i] = input[i] != 0 && input[i] >= min_accept_val;
+	});
+	return y;
+}
 
-	for(size_t i=0;i<y->size();i++)
-		output[i] = false;
-	size_t accept_index = std::min((target_size==0? 0 : target_size-1), v.size()-1);
-	int32_t min_accept_val = v[accept_index].first;
-	auto bound_end = std::upper_bound(v.begin()+accept_index, v.end(), min_accept_val, [](const auto& a, const auto& b){return a > b.first;});
+std::shared_ptr<TensorImpl> CPUBackend::batchGlobalInhibition(const TensorImpl* x, float fraction)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this, DType::Int32, IsPlain());
+	et_check(x->dimensions() >= 1);
 
-	for(auto it=v.begin();it!=bound_end;++it)
-		output[it->second] = true;
+	auto y = createTensor(x->shape(), DType::Bool);
+
+	const int32_t* input = (const int32_t*)x->data();
+	bool* output = (bool*)y->data();
+	size_t batch_size = x->shape()[0];
+	size_t row_size = batch_size == 0 ? 0 : x->size()/batch_size;
+	size_t target_size = row_size*fraction;
+
+	tbb::parallel_for(size_t(0), batch_size, [&](size_t b) {
+		const int32_t* row = input+b*row_size;
+		bool* out = output+b*row_size;
+		int32_t min_accept_val;
+		if(detail::inhibitionThreshold(row, row_size, target_size, min_accept_val) == false) {
+			std::fill(out, out+row_size, false);
+			return;
+		}
+		for(size_t i=0;i<row_size;i++)
+			out[i] = row[i] != 0 && row[i] >= min_accept_val;
+	});
+	return y;
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::localInhibition(const TensorImpl* x, float fraction, size_t radius)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this, DType::Int32, IsPlain());
+
+	auto y = createTensor(x->shape(), DType::Bool);
+
+	const int32_t* input = (const int32_t*)x->data();
+	bool* output = (bool*)y->data();
+	const Shape shape = x->shape();
+	const Shape stride = x->stride();
+	const size_t dims = shape.size();
+
+	// A cell wins if less than fraction of its neighbours are strictly stronger than it. Which is the same
+	// rule globalInhibition uses, so ties at the threshold still win
+	tbb::parallel_for(size_t(0), x->size(), [&](size_t i) {
+		const int32_t value = input[i];
+		if(value == 0) {
+			output[i] = false;
+			return;
+		}
+
+		Shape center = foldIndex(i, shape);
+		Shape low(dims), high(dims);
+		size_t neighborhood_size = 1;
+		for(size_t d=0;d<dims;d++) {
+			low[d] = std::max(center[d]-intmax_t(radius), intmax_t(0));
+			high[d] = std::min(center[d]+intmax_t(radius), shape[d]-1);
+			neighborhood_size *= high[d]-low[d]+1;
+		}
+		size_t target_size = neighborhood_size*fraction;
+		size_t max_stronger = target_size==0 ? 0 : target_size-1;
+
+		// Walk the hyper-rectangle [low, high] like an odometer
+		size_t stronger = 0;
+		Shape pos = low;
+		while(stronger <= max_stronger) {
+			int32_t neighbour = input[unfold(pos, stride)];
+			if(neighbour != 0 && neighbour > value)
+				stronger += 1;
+
+			size_t d = dims;
+			while(d != 0 && pos[d-1] == high[d-1]) {
+				pos[d-1] = low[d-1];
+				d--;
+			}
+			if(d == 0)
+				break;
+			pos[d-1] += 1;
+		}
+		output[i] = stronger <= max_stronger;
+	});
 	return y;
 }
 
 
 template <typename To, typename From>
-static auto castData(const From* ptr, size_t n)
+static void castData(const From* ptr, size_t n, To* out)
 {
 	// Deal with the special case of bool
-	if constexpr(std::is_same_v<std::decay_t<To>, bool>) {
-		std::vector<uint8_t> res(n);
-		std::transform(ptr, ptr+n, res.begin(), [](auto a){ return (bool)a; });
-		return res;
-	}
+	if constexpr(std::is_same_v<std::decay_t<To>, bool>)
+		std::transform(ptr, ptr+n, out, [](auto a){ return (bool)a; });
+	// Fixed point numbers convert through float
+	else if constexpr(std::is_same_v<To, unorm8> || std::is_same_v<From, unorm8>)
+		std::transform(ptr, ptr+n, out, [](auto a){ return To(float(a)); });
 	else
-		return std::vector<To>(ptr, ptr+n);
+		std::copy(ptr, ptr+n, out);
 }
 
-std::shared_ptr<TensorImpl> CPUBackend::cast(const TensorImpl* x, DType toType)
+namespace et::detail
 {
-	requireProperties(x, this, IsPlain());
-	auto res = createTensor(x->shape(), toType);
-	dispatch(toType, [&](auto v0){
-		using ToType = decltype(v0);
-		dispatch(x->dtype(), [&](auto v1){
-			using FromType = decltype(v1);
-			auto casted_data = castData<ToType>((FromType*)x->data(), x->size());
-			static_assert(sizeof(typename decltype(casted_data)::value_type) == sizeof(ToType));
-			memcpy(res->data(), casted_data.data(), casted_data.size()*sizeof(ToType));
+
+static std::shared_ptr<TensorImpl> cast(const TensorImpl* x, DType toType, TensorImpl* out, CPUBackend* backend)
+{
+	requireProperties(x, backend, IsPlain());
+	return writeOutput(x->shape(), toType, out, {x}, true, backend, [&](TensorImpl* res) {
+		// Casting to the same type in-place
+		if(res->data() == x->data())
+			return;
+
+		// Packing and unpacking of Bit tensors
+		if(toType == DType::Bit && x->dtype() == DType::Bit)
+			memcpy(res->data(), x->data(), dtypeToBufferSize(DType::Bit, x->size()));
+		else if(toType == DType::Bit) {
+			uint64_t* out = (uint64_t*)res->data();
+			dispatch<StorageTypeList>(x->dtype(), [&](auto v){
+				using T = decltype(v);
+				const T* in = (const T*)x->data();
+				detail::parallelForWords(x->size(), [&](size_t w, size_t begin, size_t end) {
+					uint64_t word = 0;
+					for(size_t i=begin;i<end;i++)
+						word |= uint64_t(in[i] != T(0)) << (i-begin);
+					out[w] = word;
+				});
+			});
+		}
+		else if(x->dtype() == DType::Bit) {
+			const uint64_t* in = (const uint64_t*)x->data();
+			dispatch<StorageTypeList>(toType, [&](auto v){
+				using T = decltype(v);
+				T* out = (T*)res->data();
+				tbb::parallel_for(size_t(0), x->size(), [&](size_t i) {
+					out[i] = T(detail::getBit(in, i));
+				});
+			});
+		}
+		if(toType == DType::Bit || x->dtype() == DType::Bit)
+			return;
+
+		dispatch<StorageTypeList>(toType, [&](auto v0){
+			using ToType = decltype(v0);
+			dispatch<StorageTypeList>(x->dtype(), [&](auto v1){
+				using FromType = decltype(v1);
+				castData((const FromType*)x->data(), x->size(), (ToType*)res->data());
+			});
 		});
-		
 	});
-	return res;
+}
+
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::cast(const TensorImpl* x, DType toType)
+{
+	ET_PROFILE_OP(x);
+	return detail::cast(x, toType, nullptr, this);
+}
+
+void CPUBackend::cast(const TensorImpl* x, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	detail::cast(x, out->dtype(), out, this);
 }
 
 void CPUBackend::copyToHost(const TensorImpl* t, void* ptr)
 {
+	ET_PROFILE_OP(t);
 	requireProperties(t, this, IsPlain());
-	memcpy(ptr, t->data(), t->size()*dtypeToSize(t->dtype()));
+	memcpy(ptr, t->data(), dtypeToBufferSize(t->dtype(), t->size()));
 }
 
 std::shared_ptr<TensorImpl> CPUBackend::copy(const TensorImpl* x)
 {
+	ET_PROFILE_OP(x);
 	requireProperties(x, this, IsContingous());
-	size_t offset_bytes = x->offset()*dtypeToSize(x->dtype());
+	// Views not starting at a word boundary have to be shifted bit by bit
+	if(x->dtype() == DType::Bit && x->offset()%64 != 0)
+		return realize(x);
+	size_t offset_bytes = dtypeToBufferSize(x->dtype(), x->offset());
 	return createTensor(x->shape(), x->dtype(), (const char*)x->data()+offset_bytes);
 }
 
 void CPUBackend::sortSynapse(TensorImpl* connections, TensorImpl* permeances)
 {
-	dispatch<type_list_t<float, half>>(permeances->dtype(), [&](auto v) {
+	ET_PROFILE_OP(connections);
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v) {
 		detail::sortSynapse<decltype(v)>(connections, permeances, this);
 	});
 }
 
-std::shared_ptr<TensorImpl> CPUBackend::burst(const TensorImpl* x, const TensorImpl* s)
+namespace et::detail
 {
-	requireProperties(x, this, DType::Bool, IsPlain());
-	requireProperties(s, this, DType::Bool, IsPlain());
+
+static std::shared_ptr<TensorImpl> burst(const TensorImpl* x, const TensorImpl* s, TensorImpl* out, CPUBackend* backend)
+{
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
+	requireProperties(s, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
 
 	Shape shape = s->shape();
 	shape.pop_back();
 	requireProperties(x, shape);
 
-	auto y = createTensor(s->shape(), DType::Bool);
-
-	const bool* in = (const bool*)x->data();
-	const bool* state = (const bool*)s->data();
-	bool* out = (bool*)y->data();
-
-	size_t column_size = y->shape().back();
-	tbb::parallel_for(size_t(0), x->size(), [&](size_t i) {
-		if(in[i] == false)
-			std::generate(out+i*column_size, out+(i+1)*column_size, [](){return 0;});
-		else {
-			if(std::accumulate(state+i*column_size, state+(i+1)*column_size, 0) == 0)
-				std::generate(out+i*column_size, out+(i+1)*column_size, [](){return 1;});
-			else
-				std::copy(state+i*column_size, state+(i+1)*column_size, out+i*column_size);
+	size_t column_size = s->shape().back();
+
+	// Words of Bit tensors hold parts of multiple columns. So the state can't be overwritten while other columns read it
+	return writeOutput(s->shape(), s->dtype(), out, {x, s}, s->dtype() != DType::Bit, backend, [&](TensorImpl* y) {
+		if(s->dtype() == DType::Bit) {
+			const uint64_t* state = (const uint64_t*)s->data();
+			uint64_t* out = (uint64_t*)y->data();
+			// Each word is written by exactly one task. Columns crossing word boundaries are simply looked at twice
+			detail::visitBinary(x, [&](auto in) {
+				detail::parallelForWords(y->size(), [&](size_t w, size_t begin, size_t end) {
+					uint64_t word = 0;
+					for(size_t i=begin/column_size;i*column_size<end;i++) {
+						if(in[i] == false)
+							continue;
+						size_t column_begin = i*column_size;
+						size_t column_end = column_begin+column_size;
+						uint64_t mask = detail::lowMask(std::min(column_end, end)-begin) & ~detail::lowMask(std::max(column_begin, begin)-begin);
+						if(detail::countBits(state, column_begin, column_end) == 0)
+							word |= mask;
+						else
+							word |= state[w] & mask;
+					}
+					out[w] = word;
+				});
+			});
+			return;
 		}
+
+		const bool* state = (const bool*)s->data();
+		bool* out = (bool*)y->data();
+
+		detail::visitBinary(x, [&](auto in) {
+		tbb::parallel_for(size_t(0), x->size(), [&](size_t i) {
+			if(in[i] == false)
+				std::generate(out+i*column_size, out+(i+1)*column_size, [](){return 0;});
+			else {
+				if(std::accumulate(state+i*column_size, state+(i+1)*column_size, 0) == 0)
+					std::generate(out+i*column_size, out+(i+1)*column_size, [](){return 1;});
+				else
+					std::copy(state+i*column_size, state+(i+1)*column_size, out+i*column_size);
+			}
+		});
+		});
 	});
-	return y;
 }
 
-std::shared_ptr<TensorImpl> CPUBackend::reverseBurst(const TensorImpl* x)
+static std::shared_ptr<TensorImpl> reverseBurst(const TensorImpl* x, TensorImpl* out, CPUBackend* backend)
 {
-	requireProperties(x, this, DType::Bool, IsPlain());
+	requireProperties(x, backend, IsDType{DType::Bool, DType::Bit}, IsPlain());
 
 	size_t cells_per_column = x->shape().back();
 	size_t num_columns = x->size()/cells_per_column;
-	static pcg64 rng; //Static so the behavor hangees every time, breaking symmetry
-	std::uniform_int_distribution<size_t> dist(0, cells_per_column-1);
+	// Every column draws from it's own generator. So columns are processed in parallel without sharing state and the
+	// result doesn't depend on the threads. Each call takes a new stream, breaking symmetry
+	RandomStream stream = backend->randomStream();
+	auto chooseCell = [&stream, cells_per_column](size_t column) {
+		pcg32 rng = stream.generator(column);
+		return column*cells_per_column + std::uniform_int_distribution<size_t>(0, cells_per_column-1)(rng);
+	};
+
+	// Columns are read before they are written. So this can run in-place
+	return writeOutput(x->shape(), x->dtype(), out, {x}, true, backend, [&](TensorImpl* y) {
+		if(x->dtype() == DType::Bit) {
+			const uint64_t* in = (const uint64_t*)x->data();
+			uint64_t* out = (uint64_t*)y->data();
+
+			// Find the bursting columns first. So columns spanning multiple words agree on the chosen cell
+			std::vector<uint8_t> bursting(num_columns);
+			std::vector<size_t> chosen(num_columns);
+			tbb::parallel_for(size_t(0), num_columns, [&](size_t i) {
+				bursting[i] = detail::countBits(in, i*cells_per_column, (i+1)*cells_per_column) == cells_per_column;
+				if(bursting[i])
+					chosen[i] = chooseCell(i);
+			});
 
-	auto y = createTensor(x->shape(), DType::Bool);
+			detail::parallelForWords(x->size(), [&](size_t w, size_t begin, size_t end) {
+				uint64_t word = 0;
+				for(size_t i=begin/cells_per_column;i*cells_per_column<end;i++) {
+					size_t column_begin = i*cells_per_column;
+					size_t column_end = column_begin+cells_per_column;
+					if(bursting[i] == false)
+						word |= in[w] & detail::lowMask(std::min(column_end, end)-begin) & ~detail::lowMask(std::max(column_begin, begin)-begin);
+					else if(chosen[i] >= begin && chosen[i] < end)
+						word |= uint64_t(1) << (chosen[i]-begin);
+				}
+				out[w] = word;
+			});
+			return;
+		}
 
-	const bool* in = (const bool*) x->data();
-	bool* out = (bool*) y->data();
+		const bool* in = (const bool*) x->data();
+		bool* out = (bool*) y->data();
 
-	tbb::parallel_for(size_t(0), num_columns, [&](size_t i) {
-		if(std::accumulate(in+i*cells_per_column, in+(i+1)*cells_per_column, size_t(0)) == cells_per_column) {
-			std::generate(out+i*cells_per_column, out+(i+1)*cells_per_column, [](){return 0;});
-			out[i*cells_per_column+dist(rng)] = 1;
-		}
-		else
-			std::copy(in+i*cells_per_column, in+(i+1)*cells_per_column, out+i*cells_per_column);
+		tbb::parallel_for(size_t(0), num_columns, [&](size_t i) {
+			if(std::accumulate(in+i*cells_per_column, in+(i+1)*cells_per_column, size_t(0)) == cells_per_column) {
+				std::generate(out+i*cells_per_column, out+(i+1)*cells_per_column, [](){return 0;});
+				out[chooseCell(i)] = 1;
+			}
+			else
+				std::copy(in+i*cells_per_column, in+(i+1)*cells_per_column, out+i*cells_per_column);
+		});
 	});
-	return y;
+}
+
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::burst(const TensorImpl* x, const TensorImpl* s)
+{
+	ET_PROFILE_OP(x);
+	return detail::burst(x, s, nullptr, this);
+}
+
+void CPUBackend::burst(const TensorImpl* x, const TensorImpl* s, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	detail::burst(x, s, out, this);
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::reverseBurst(const TensorImpl* x)
+{
+	ET_PROFILE_OP(x);
+	return detail::reverseBurst(x, nullptr, this);
+}
 
+void CPUBackend::reverseBurst(const TensorImpl* x, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	detail::reverseBurst(x, out, this);
 }
 
 void CPUBackend::growSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* connections
 	, TensorImpl* permeances, float initial_perm)
 {
-	dispatch<type_list_t<float, half>>(permeances->dtype(), [&](auto v) {
+	ET_PROFILE_OP(x);
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v) {
 		detail::growSynapses<decltype(v)>(x, y, connections, permeances, initial_perm, this);
 	});
 }
 
-template <typename T>
-const T* getPtrToValue(size_t parent_idx, const TensorImpl* t)
+namespace et::detail
+{
+//Walks N tensors of the same shape in row-major order. Instead of computing the buffer index of every element,
+//the elements are visited in runs along the innermost dimension, where each tensor advances by a constant stride.
+//Dimensions that are laid out contiguously (for every tensor) are merged first. So contiguous tensors are walked
+//in a single run.
+template <size_t N>
+struct StridedLoop
+{
+	StridedLoop(const Shape& shape, const std::array<const TensorImpl*, N>& tensors)
+	{
+		for(size_t k=0;k<N;k++)
+			offsets_[k] = tensors[k]->offset();
+
+		for(size_t d=0;d<shape.size();d++) {
+			if(shape[d] == 1)
+				continue;
+			std::array<intmax_t, N> stride;
+			for(size_t k=0;k<N;k++)
+				stride[k] = tensors[k]->stride()[d];
+
+			//Merge with the previous dimension if stepping through it is the same as stepping through this one
+			bool mergeable = shape_.empty() == false;
+			for(size_t k=0;k<N && mergeable;k++)
+				mergeable = strides_.back()[k] == stride[k]*shape[d];
+			if(mergeable) {
+				shape_.back() *= shape[d];
+				strides_.back() = stride;
+			}
+			else {
+				shape_.push_back(shape[d]);
+				strides_.push_back(stride);
+			}
+		}
+		if(shape_.empty()) {
+			shape_.push_back(1);
+			strides_.push_back({});
+		}
+	}
+
+	//Calls f(i, length, offsets, strides) for every run covering the elements [begin, end). offsets[k] is the buffer
+	//index of the i-th element in the k-th tensor, and strides[k] the distance between elements of the run
+	template <typename Func>
+	void run(size_t begin, size_t end, Func f) const
+	{
+		if(begin >= end)
+			return;
+		const size_t dims = shape_.size();
+		const std::array<intmax_t, N>& inner_stride = strides_.back();
+		const intmax_t inner_size = shape_.back();
+
+		svector<intmax_t> index(dims);
+		std::array<intmax_t, N> offsets = offsets_;
+		size_t rem = begin;
+		for(int d=(int)dims-1;d>=0;d--) {
+			index[d] = rem % shape_[d];
+			rem /= shape_[d];
+			for(size_t k=0;k<N;k++)
+				offsets[k] += index[d]*strides_[d][k];
+		}
+
+		size_t i = begin;
+		while(i < end) {
+			size_t length = std::min(size_t(inner_size - index.back()), end - i);
+			f(i, length, offsets, inner_stride);
+			i += length;
+			if(i == end)
+				break;
+
+			//Move to the start of the next run. Carrying into the outer dimensions
+			for(size_t k=0;k<N;k++)
+				offsets[k] -= index.back()*inner_stride[k];
+			index.back() = 0;
+			for(int d=(int)dims-2;d>=0;d--) {
+				index[d]++;
+				for(size_t k=0;k<N;k++)
+					offsets[k] += strides_[d][k];
+				if(index[d] != shape_[d])
+					break;
+				for(size_t k=0;k<N;k++)
+					offsets[k] -= index[d]*strides_[d][k];
+				index[d] = 0;
+			}
+		}
+	}
+
+	//Same as run(). But splits the elements into chunks processed in parallel
+	template <typename Func>
+	void parallelRun(size_t size, Func f) const
+	{
+		constexpr size_t grain_size = 4096;
+		if(size <= grain_size) {
+			run(0, size, f);
+			return;
+		}
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, size, grain_size), [&](const auto& r) {
+			run(r.begin(), r.end(), f);
+		});
+	}
+
+protected:
+	svector<intmax_t> shape_;
+	svector<std::array<intmax_t, N>> strides_;
+	std::array<intmax_t, N> offsets_;
+};
+
+}
+
+//Maps the index of an element in the tensor to it's index in the underlying buffer
+static size_t unfoldedIndex(size_t parent_idx, const TensorImpl* t)
 {
 	// Optimized case for contnigous input
 	if(t->iscontiguous())
-		return (const T*)t->data()+t->offset()+parent_idx;
+		return t->offset()+parent_idx;
 	
 	Shape s = foldIndex(parent_idx, t->shape());
 	s = Shape(t->stride().size()-s.size(), 0) + s;
-	size_t offset = t->offset() + unfold(s, t->stride());
-	return ((const T*)t->data())+offset;
+	return t->offset() + unfold(s, t->stride());
+}
+
+template <typename T>
+const T* getPtrToValue(size_t parent_idx, const TensorImpl* t)
+{
+	return ((const T*)t->data())+unfoldedIndex(parent_idx, t);
+}
+
+//Returns x as a plain Bit tensor. Only realizing and casting when needed
+static std::shared_ptr<const TensorImpl> plainBits(const TensorImpl* x, CPUBackend* backend)
+{
+	std::shared_ptr<const TensorImpl> res = x->shared_from_this();
+	if(res->isplain() == false)
+		res = backend->realize(res.get());
+	if(res->dtype() != DType::Bit)
+		res = backend->cast(res.get(), DType::Bit);
+	return res;
 }
 
 template <typename T2, typename T1>
@@ -516,8 +1983,9 @@ void write(T2* ptr, T1 v)
 	*ptr = v;
 }
 
+//Elementwise operations. Writing to target instead of a new tensor when given
 template <typename Op>
-static std::shared_ptr<TensorImpl> uniaryOp(const TensorImpl* src, Op op)
+static std::shared_ptr<TensorImpl> uniaryOp(const TensorImpl* src, Op op, TensorImpl* target=nullptr)
 {
 	std::shared_ptr<TensorImpl> dest;
 	dispatch(src->dtype(), [&](auto v){
@@ -527,237 +1995,1193 @@ static std::shared_ptr<TensorImpl> uniaryOp(const TensorImpl* src, Op op)
 		using StoreType = typename std::conditional_t<std::is_same_v<ResType, bool>, bool
 			, typename std::conditional_t<std::is_same_v<T, half>, half
 			, typename std::conditional_t<std::is_same_v<ResType, double>, float, ResType>>>;
-		dest = src->backend()->createTensor(src->shape(), typeToDType<StoreType>());
-		tbb::parallel_for(size_t(0), src->size(), [&](size_t i) {
-			auto ptr = getPtrToValue<T>(i, src);
-			auto res = op(*ptr);
+		dest = detail::writeOutput(src->shape(), typeToDType<StoreType>(), target, {src}, true, src->backend(), [&](TensorImpl* y) {
+			const T* in = (const T*)src->data();
+			StoreType* out = (StoreType*)y->data();
+			detail::StridedLoop<1>(src->shape(), {src}).parallelRun(src->size(), [&](size_t i, size_t n, auto offsets, auto strides) {
+				const T* a = in + offsets[0];
+				if(strides[0] == 1) {
+					for(size_t j=0;j<n;j++)
+						out[i+j] = op(a[j]);
+				}
+				else {
+					for(size_t j=0;j<n;j++)
+						out[i+j] = op(a[j*strides[0]]);
+				}
+			});
+		});
+	});
+
+	et_assert(target != nullptr || (bool)dest);
+	return dest;
+}
 
-			reinterpret_cast<StoreType*>(dest->data())[i] = res;
+template <typename Op>
+static std::shared_ptr<TensorImpl> binaryOp(const TensorImpl* src, const TensorImpl* src2, Op op, TensorImpl* target=nullptr)
+{
+	std::shared_ptr<TensorImpl> dest;
+	et_assert(src->shape() == src2->shape());
+
+	dispatch(src->dtype(), [&](auto v){
+		using T1 = decltype(v);
+		dispatch(src2->dtype(), [&](auto v){
+			using T2 = decltype(v);
+			using ResType = std::invoke_result_t<Op, T1, T2>;
+			//We don't have support to double percition now. Cast it to float
+			using StoreType = typename std::conditional<std::is_same<ResType, double>::value, float, ResType>::type;
+			dest = detail::writeOutput(src->shape(), typeToDType<StoreType>(), target, {src, src2}, true, src->backend(), [&](TensorImpl* y) {
+				const T1* in1 = (const T1*)src->data();
+				const T2* in2 = (const T2*)src2->data();
+				StoreType* out = (StoreType*)y->data();
+
+				detail::StridedLoop<2>(src->shape(), {src, src2}).parallelRun(src->size(), [&](size_t i, size_t n, auto offsets, auto strides) {
+					const T1* a = in1 + offsets[0];
+					const T2* b = in2 + offsets[1];
+					if(strides[0] == 1 && strides[1] == 1) {
+						for(size_t j=0;j<n;j++)
+							out[i+j] = op(a[j], b[j]);
+					}
+					else {
+						for(size_t j=0;j<n;j++)
+							out[i+j] = op(a[j*strides[0]], b[j*strides[1]]);
+					}
+				});
+			});
 		});
 	});
 
-	et_assert((bool)dest);
+	et_assert(target != nullptr || (bool)dest);
 	return dest;
 }
 
-template <typename Op>
-static std::shared_ptr<TensorImpl> binaryOp(const TensorImpl* src, const TensorImpl* src2, Op op)
+std::shared_ptr<TensorImpl> CPUBackend::realize(const TensorImpl* x)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	et_assert(x->data() != nullptr);
+	auto res = createTensor(x->shape(), x->dtype());
+
+	if(x->dtype() == DType::Bit) {
+		const uint64_t* in = (const uint64_t*)x->data();
+		uint64_t* out = (uint64_t*)res->data();
+		detail::parallelForWords(x->size(), [&](size_t w, size_t begin, size_t end) {
+			uint64_t word = 0;
+			for(size_t i=begin;i<end;i++)
+				word |= uint64_t(detail::getBit(in, unfoldedIndex(i, x))) << (i-begin);
+			out[w] = word;
+		});
+		return res;
+	}
+
+	dispatch<StorageTypeList>(x->dtype(), [&](auto v){
+		using T = decltype(v);
+		const T* in = (const T*)x->data();
+		T* out = (T*)res->data();
+		detail::StridedLoop<1>(x->shape(), {x}).parallelRun(x->size(), [&](size_t i, size_t n, auto offsets, auto strides) {
+			if(strides[0] == 1)
+				std::copy(in+offsets[0], in+offsets[0]+n, out+i);
+			else {
+				for(size_t j=0;j<n;j++)
+					out[i+j] = in[offsets[0]+j*strides[0]];
+			}
+		});
+	});
+	return res;
+}
+
+
+void CPUBackend::assign(TensorImpl* dest, const TensorImpl* src)
+{
+	ET_PROFILE_OP(dest);
+	requireProperties(dest, this);
+	requireProperties(src, this);
+
+	if(dest->shape() != src->shape())
+		throw EtError("Shape mismatch in tensor assignment. Shape "
+			+ to_string(dest->shape()) + " and " + to_string(src->shape()));
+
+	if(dest->dtype() != src->dtype()) {
+		auto casted = src->isplain() ? cast(src, dest->dtype()) : cast(realize(src).get(), dest->dtype());
+		assign(dest, casted.get());
+		return;
+	}
+
+	// Neighbouring elements share words. Write them one by one
+	if(dest->dtype() == DType::Bit) {
+		const uint64_t* in = (const uint64_t*)src->data();
+		uint64_t* out = (uint64_t*)dest->data();
+		for(size_t i=0;i<dest->size();i++)
+			detail::setBit(out, unfoldedIndex(i, dest), detail::getBit(in, unfoldedIndex(i, src)));
+		return;
+	}
+
+	dispatch<StorageTypeList>(dest->dtype(), [&](auto v) {
+		using T = decltype(v);
+		T* out = (T*)dest->data();
+		const T* in = (const T*)src->data();
+		detail::StridedLoop<2>(dest->shape(), {dest, src}).parallelRun(dest->size(), [&](size_t, size_t n, auto offsets, auto strides) {
+			if(strides[0] == 1 && strides[1] == 1)
+				std::copy(in+offsets[1], in+offsets[1]+n, out+offsets[0]);
+			else {
+				for(size_t j=0;j<n;j++)
+					out[offsets[0]+j*strides[0]] = in[offsets[1]+j*strides[1]];
+			}
+		});
+	});
+}
+
+namespace et::detail
+{
+
+//The type sums of dtype are stored as, when not specified
+static DType sumType(DType dtype)
+{
+	if(dtype == DType::Bool || dtype == DType::Int32 || dtype == DType::Bit)
+		return DType::Int32;
+	else if(dtype == DType::Half)
+		return DType::Half;
+	else
+		return DType::Float;
+}
+
+static std::shared_ptr<TensorImpl> sum(const TensorImpl* x, size_t chunk_size, DType dtype, TensorImpl* out, CPUBackend* backend)
+{
+	requireProperties(x, backend, IsPlain());
+	et_check(x->size() % chunk_size == 0);
+
+	DType result_dtype = dtype == DType::Unknown ? sumType(x->dtype()) : dtype;
+
+	size_t result_size = x->size()/chunk_size;
+	if(out != nullptr)
+		et_check(out->size() == result_size, "Expecting out to hold " + std::to_string(result_size) + " sums. Got " + to_string(out->shape()));
+	Shape result_shape = out != nullptr ? out->shape() : Shape{intmax_t(result_size)};
+
+	return writeOutput(result_shape, result_dtype, out, {x}, false, backend, [&](TensorImpl* res) {
+		// popcount the words directly
+		if(x->dtype() == DType::Bit) {
+			const uint64_t* in = (const uint64_t*)x->data();
+			dispatch(result_dtype, [&](auto v) {
+				using ResType = decltype(v);
+				auto ptr = (ResType*) res->data();
+				if(result_size == 1) {
+					// The padding bits are 0. So summing all words is safe
+					*ptr = ResType(tbb::parallel_reduce(tbb::blocked_range<size_t>(0, (x->size()+63)/64), size_t(0)
+						, [in](const auto& r, size_t init){
+							for(size_t i=r.begin();i!=r.end();i++)
+								init += detail::popcount(in[i]);
+							return init;
+						}, std::plus<size_t>()));
+					return;
+				}
+				tbb::parallel_for(size_t(0), result_size, [&](size_t i) {
+					ptr[i] = ResType(detail::countBits(in, i*chunk_size, (i+1)*chunk_size));
+				});
+			});
+			return;
+		}
+
+		// Optimized case for summing everything
+		if(result_size == 1) {
+			dispatch2d(x->dtype(), result_dtype, [&](auto v1, auto v2) {
+				using T = decltype(v1);
+				auto in = (const T*)x->data();
+				using ResType = decltype(v2);
+				auto ptr = (ResType*) res->data();
+				*ptr = tbb::parallel_reduce(tbb::blocked_range(in, in+x->size()), ResType(0)
+					, [](const auto& r, ResType init){
+						return std::accumulate(r.begin(), r.end(), init);
+					},
+					[](auto x, auto y) {
+						return x + y;
+					});
+			});
+		}
+		else {
+			dispatch2d(x->dtype(), result_dtype, [&](auto v1, auto v2) {
+				using T = decltype(v1);
+				auto in = (const T*)x->data();
+				using ResType = decltype(v2);
+				auto ptr = (ResType*) res->data();
+				tbb::parallel_for(size_t(0), size_t(x->size()/chunk_size), [&](size_t i) {
+					size_t offset = i*chunk_size;
+					ResType s = std::accumulate(in+offset, in+offset+chunk_size, ResType(0));
+					ptr[i] = s;
+				});
+			});
+		}
+	});
+}
+
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::sum(const TensorImpl* x, size_t chunk_size, DType dtype)
+{
+	ET_PROFILE_OP(x);
+	return detail::sum(x, chunk_size, dtype, nullptr, this);
+}
+
+void CPUBackend::sum(const TensorImpl* x, size_t chunk_size, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	detail::sum(x, chunk_size, out->dtype(), out, this);
+}
+
+namespace et::detail
+{
+
+//Splits the dimensions of a tensor into the ones kept by a reduction and the reduced ones, with their strides in the
+//buffer. Neighbouring dimensions that step through memory as one are merged. So a contiguous block is reduced in one run
+struct ReduceLayout
+{
+	ReduceLayout(const TensorImpl* x, const svector<intmax_t>& dims) : offset(x->offset())
+	{
+		for(size_t d=0;d<x->dimensions();d++) {
+			if(x->shape()[d] == 1)
+				continue;
+			bool reduced = std::find(dims.begin(), dims.end(), intmax_t(d)) != dims.end();
+			Shape& shape = reduced ? reduced_shape : kept_shape;
+			Shape& stride = reduced ? reduced_stride : kept_stride;
+			if(shape.empty() == false && stride.back() == x->stride()[d]*x->shape()[d]) {
+				shape.back() *= x->shape()[d];
+				stride.back() = x->stride()[d];
+			}
+			else {
+				shape.push_back(x->shape()[d]);
+				stride.push_back(x->stride()[d]);
+			}
+		}
+		for(auto [shape, stride] : {std::pair{&kept_shape, &kept_stride}, std::pair{&reduced_shape, &reduced_stride}}) {
+			if(shape->empty()) {
+				shape->push_back(1);
+				stride->push_back(0);
+			}
+		}
+	}
+
+	size_t keptSize() const { return kept_shape.volume(); }
+	size_t reducedSize() const { return reduced_shape.volume(); }
+
+	//Buffer index of the first element reduced into the o-th result
+	intmax_t base(size_t o) const
+	{
+		intmax_t res = offset;
+		for(int d=(int)kept_shape.size()-1;d>=0;d--) {
+			res += (o % kept_shape[d])*kept_stride[d];
+			o /= kept_shape[d];
+		}
+		return res;
+	}
+
+	//Calls f(i, offset, length, stride) for runs covering the reduced elements [begin, end) of the result starting at
+	//base. Where offset is the buffer index of the i-th element. Returns false as soon as f does, true otherwise
+	template <typename Func>
+	bool run(intmax_t base, size_t begin, size_t end, Func f) const
+	{
+		const size_t dims = reduced_shape.size();
+		const intmax_t inner_size = reduced_shape.back();
+		const intmax_t inner_stride = reduced_stride.back();
+
+		svector<intmax_t> index(dims);
+		intmax_t offset = base;
+		size_t rem = begin;
+		for(int d=(int)dims-1;d>=0;d--) {
+			index[d] = rem % reduced_shape[d];
+			rem /= reduced_shape[d];
+			offset += index[d]*reduced_stride[d];
+		}
+
+		size_t i = begin;
+		while(i < end) {
+			size_t length = std::min(size_t(inner_size - index.back()), end - i);
+			if(f(i, offset, length, inner_stride) == false)
+				return false;
+			i += length;
+			if(i == end)
+				break;
+
+			offset -= index.back()*inner_stride;
+			index.back() = 0;
+			for(int d=(int)dims-2;d>=0;d--) {
+				index[d]++;
+				offset += reduced_stride[d];
+				if(index[d] != reduced_shape[d])
+					break;
+				offset -= index[d]*reduced_stride[d];
+				index[d] = 0;
+			}
+		}
+		return true;
+	}
+
+	intmax_t offset;
+	Shape kept_shape;
+	Shape kept_stride;
+	Shape reduced_shape;
+	Shape reduced_stride;
+};
+
+//Reducers fold runs of elements into a State. update() is given the index of the first element of the run within the
+//reduction and returns false once the result can't change anymore
+template <typename T, typename Acc>
+struct SumReducer
+{
+	using State = Acc;
+	State init() const { return Acc(0); }
+	bool update(State& s, const T* p, size_t, size_t n, intmax_t stride) const
+	{
+		Acc acc = s;
+		if(stride == 1) {
+			for(size_t j=0;j<n;j++)
+				acc += Acc(p[j]);
+		}
+		else {
+			for(size_t j=0;j<n;j++)
+				acc += Acc(p[j*stride]);
+		}
+		s = acc;
+		return true;
+	}
+	static State combine(State a, State b) { return a + b; }
+};
+
+//Max, Min and ArgMax. Keeps the first of equal elements
+template <typename T, typename Compare>
+struct ExtremumReducer
 {
-	std::shared_ptr<TensorImpl> dest;
-	et_assert(src->shape() == src2->shape());
+	struct State
+	{
+		T value;
+		intmax_t index;
+	};
+	State init() const { return State{T(0), -1}; }
+	bool update(State& s, const T* p, size_t i, size_t n, intmax_t stride) const
+	{
+		for(size_t j=0;j<n;j++) {
+			T v = p[j*stride];
+			if(s.index < 0 || Compare()(v, s.value))
+				s = State{v, intmax_t(i+j)};
+		}
+		return true;
+	}
+	static State combine(State a, State b)
+	{
+		if(b.index < 0)
+			return a;
+		if(a.index < 0)
+			return b;
+		if(Compare()(b.value, a.value) || (Compare()(a.value, b.value) == false && b.index < a.index))
+			return b;
+		return a;
+	}
+};
 
-	dispatch(src->dtype(), [&](auto v){
-		using T1 = decltype(v);
-		dispatch(src2->dtype(), [&](auto v){
-			using T2 = decltype(v);
-			using ResType = std::invoke_result_t<Op, T1, T2>;
-			//We don't have support to double percition now. Cast it to float
-			using StoreType = typename std::conditional<std::is_same<ResType, double>::value, float, ResType>::type;
-			dest = src->backend()->createTensor(src->shape(), typeToDType<StoreType>());
+//Looks for an element which is non zero when Value is true, or zero otherwise. Any is finding a true element and All is
+//not finding a false one
+template <typename T, bool Value>
+struct FindReducer
+{
+	using State = bool;
+	State init() const { return false; }
+	bool update(State& found, const T* p, size_t, size_t n, intmax_t stride) const
+	{
+		for(size_t j=0;j<n;j++) {
+			if((p[j*stride] != T(0)) == Value) {
+				found = true;
+				return false;
+			}
+		}
+		return true;
+	}
+	static State combine(State a, State b) { return a || b; }
+};
 
-			tbb::parallel_for(size_t(0), src->size(), [&](size_t i) {
-				auto ptr = getPtrToValue<T1>(i, src);
-				auto ptr2 = getPtrToValue<T2>(i, src2);
-				auto res = op(*ptr, *ptr2);
+//Computes every result of the layout with the reducer and calls store(o, state) for the o-th result
+template <typename T, typename Reducer, typename Store>
+static void reduceLayout(const ReduceLayout& layout, const T* in, Reducer r, Store store)
+{
+	using State = typename Reducer::State;
+	const size_t result_size = layout.keptSize();
+	const size_t reduced_size = layout.reducedSize();
+	auto reduceRange = [&](intmax_t base, size_t begin, size_t end, State& s) {
+		// The reduced dimensions merged into a single run
+		if(layout.reduced_shape.size() == 1) {
+			const intmax_t stride = layout.reduced_stride[0];
+			return r.update(s, in+base+begin*stride, begin, end-begin, stride);
+		}
+		return layout.run(base, begin, end, [&](size_t i, intmax_t offset, size_t n, intmax_t stride) {
+			return r.update(s, in+offset, i, n, stride);
+		});
+	};
+
+	// Few but long reductions. Split each of them across threads instead
+	if(result_size < 16 && reduced_size >= 16*4096) {
+		for(size_t o=0;o<result_size;o++) {
+			const intmax_t base = layout.base(o);
+			std::atomic<bool> done = false;
+			State s = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, reduced_size, 4096), r.init()
+				, [&](const auto& range, State s) {
+					if(done.load(std::memory_order_relaxed) == false && reduceRange(base, range.begin(), range.end(), s) == false)
+						done.store(true, std::memory_order_relaxed);
+					return s;
+				}, Reducer::combine);
+			store(o, s);
+		}
+		return;
+	}
 
-				reinterpret_cast<StoreType*>(dest->data())[i] = res;
+	// The results are consecutive in memory but the reduced elements are not. Reduce a block of neighbouring results
+	// in one walk. So memory is read in rows instead of columns
+	const intmax_t inner_size = layout.kept_shape.back();
+	if(layout.kept_stride.back() == 1 && layout.reduced_stride.back() != 1 && inner_size > 1) {
+		constexpr intmax_t block_size = 128;
+		const size_t blocks_per_row = (inner_size+block_size-1)/block_size;
+		tbb::parallel_for(size_t(0), result_size/inner_size*blocks_per_row, [&](size_t b) {
+			const size_t o = b/blocks_per_row*inner_size + b%blocks_per_row*block_size;
+			const size_t n = std::min<size_t>(block_size, inner_size - b%blocks_per_row*block_size);
+			std::array<State, block_size> states;
+			std::fill(states.begin(), states.begin()+n, r.init());
+			layout.run(layout.base(o), 0, reduced_size, [&](size_t i, intmax_t offset, size_t length, intmax_t stride) {
+				for(size_t j=0;j<length;j++) {
+					const T* row = in + offset + j*stride;
+					for(size_t k=0;k<n;k++)
+						r.update(states[k], row+k, i+j, 1, 1);
+				}
+				return true;
 			});
+			for(size_t k=0;k<n;k++)
+				store(o+k, states[k]);
 		});
-	});
-
-	et_assert((bool)dest);
-	return dest;
-}
-
-std::shared_ptr<TensorImpl> CPUBackend::realize(const TensorImpl* x)
-{
-	requireProperties(x, this);
-	et_assert(x->data() != nullptr);
-	auto res = createTensor(x->shape(), x->dtype());
+		return;
+	}
 
-	dispatch(x->dtype(), [&](auto v){
-		using T = decltype(v);
-		for(size_t i=0;i<x->size();i++) {
-			auto ptr = (T*)res->data();
-			ptr[i] = *getPtrToValue<T>(i, x);
+	// Short reductions are grouped so each task has some work to do
+	const size_t grain_size = std::max<size_t>(1, 4096/std::max<size_t>(reduced_size, 1));
+	tbb::parallel_for(tbb::blocked_range<size_t>(0, result_size, grain_size), [&](const auto& range) {
+		for(size_t o=range.begin();o!=range.end();o++) {
+			State s = r.init();
+			reduceRange(layout.base(o), 0, reduced_size, s);
+			store(o, s);
 		}
 	});
-	return res;
 }
 
-
-void CPUBackend::assign(TensorImpl* dest, const TensorImpl* src)
+static std::shared_ptr<TensorImpl> reduce(const TensorImpl* x, const svector<intmax_t>& dims, ReduceOp op, DType dtype, CPUBackend* backend)
 {
-	requireProperties(dest, this);
-	requireProperties(src, this);
-
-	if(dest->shape() != src->shape())
-		throw EtError("Shape mismatch in tensor assignment. Shape "
-			+ to_string(dest->shape()) + " and " + to_string(src->shape()));
+	intmax_t reduced_size = 1;
+	Shape result_shape;
+	for(size_t d=0;d<x->dimensions();d++) {
+		if(std::find(dims.begin(), dims.end(), intmax_t(d)) != dims.end())
+			reduced_size *= x->shape()[d];
+		else
+			result_shape.push_back(x->shape()[d]);
+	}
+	for(auto d : dims)
+		et_check(d >= 0 && d < (intmax_t)x->dimensions(), "Dimension " + std::to_string(d) + " is out of range");
+	if(op == ReduceOp::Max || op == ReduceOp::Min || op == ReduceOp::ArgMax)
+		et_check(reduced_size != 0, "Cannot reduce 0 elements");
+	if(result_shape.empty())
+		result_shape = {1};
+
+	// Summing into bools is checking if any element is not 0. Which can stop at the first one
+	if(op == ReduceOp::Sum && dtype == DType::Bool)
+		op = ReduceOp::Any;
+
+	// Reducing the trailing dimensions of a plain tensor is summing chunks of consecutive elements. Bits are popcounted
+	bool trailing = dims.empty() == false && dims.back() == (intmax_t)x->dimensions()-1
+		&& dims.front() == intmax_t(x->dimensions()-dims.size());
+	if(op == ReduceOp::Sum && trailing && x->isplain() && reduced_size != 0) {
+		auto res = sum(x, reduced_size, dtype, nullptr, backend);
+		return std::make_shared<TensorImpl>(res->buffer(), result_shape, shapeToStride(result_shape));
+	}
 
-	if(dest->dtype() != src->dtype())
-		assign(dest, cast(src, dest->dtype()).get());
+	if(x->dtype() == DType::Bit)
+		return reduce(backend->cast(plainBits(x, backend).get(), DType::Bool).get(), dims, op, dtype, backend);
+
+	DType result_dtype = [&]() {
+		switch(op) {
+			case ReduceOp::Sum: return dtype == DType::Unknown ? sumType(x->dtype()) : dtype;
+			case ReduceOp::Mean: return dtype == DType::Unknown ? DType::Float : dtype;
+			case ReduceOp::ArgMax: return DType::Int32;
+			case ReduceOp::Any:
+			case ReduceOp::All: return DType::Bool;
+			default: return x->dtype();
+		}
+	}();
 
-	dispatch(dest->dtype(), [&](auto v) {
+	ReduceLayout layout(x, dims);
+	auto res = backend->createTensor(result_shape, result_dtype);
+	dispatch(x->dtype(), [&](auto v) {
 		using T = decltype(v);
-
-		//Parallelize if the problem is big enought
-		if(dest->size() > 2000) {
-			tbb::parallel_for(size_t(0), dest->size(), [&](size_t i) {
-				auto s = (T*)getPtrToValue<T>(i, src);
-				auto ptr = (T*)getPtrToValue<T>(i, dest);
-				*ptr = *s;
+		const T* in = (const T*)x->data();
+		if(op == ReduceOp::Sum || op == ReduceOp::Mean) {
+			dispatch(result_dtype, [&](auto v) {
+				using ResType = decltype(v);
+				//Integers are summed as the result type and the rest as floats
+				using Acc = std::conditional_t<std::is_same_v<ResType, int32_t>, int32_t, float>;
+				ResType* out = (ResType*)res->data();
+				const float n = op == ReduceOp::Mean ? float(reduced_size) : 1.f;
+				reduceLayout(layout, in, SumReducer<T, Acc>(), [&](size_t o, Acc s) {
+					out[o] = op == ReduceOp::Mean ? ResType(s/n) : ResType(s);
+				});
 			});
 		}
+		else if(op == ReduceOp::Any || op == ReduceOp::All) {
+			bool* out = (bool*)res->data();
+			auto find = [&](auto reducer) {
+				reduceLayout(layout, in, reducer, [&](size_t o, bool found) {
+					out[o] = found == (op == ReduceOp::Any);
+				});
+			};
+			if(op == ReduceOp::Any)
+				find(FindReducer<T, true>());
+			else
+				find(FindReducer<T, false>());
+		}
 		else {
-			for(size_t i=0;i<dest->size();i++) {
-				auto s = (T*)getPtrToValue<T>(i, src);
-				auto ptr = (T*)getPtrToValue<T>(i, dest);
-				*ptr = *s;
-			}
+			auto extremum = [&](auto compare) {
+				using Reducer = ExtremumReducer<T, decltype(compare)>;
+				reduceLayout(layout, in, Reducer(), [&](size_t o, typename Reducer::State s) {
+					if(op == ReduceOp::ArgMax)
+						((int32_t*)res->data())[o] = int32_t(s.index);
+					else
+						((T*)res->data())[o] = s.value;
+				});
+			};
+			if(op == ReduceOp::Min)
+				extremum(std::less<T>());
+			else
+				extremum(std::greater<T>());
 		}
 	});
+	return res;
 }
 
-std::shared_ptr<TensorImpl> CPUBackend::sum(const TensorImpl* x, size_t chunk_size, DType dtype)
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::reduce(const TensorImpl* x, const svector<intmax_t>& dims, ReduceOp op, DType dtype)
 {
-	requireProperties(x, this, IsPlain());
-	et_check(x->size() % chunk_size == 0);
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	return detail::reduce(x, dims, op, dtype, this);
+}
 
-	DType result_dtype = dtype;
+void CPUBackend::decaySynapses(TensorImpl* connections, TensorImpl* permeances, float threshold)
+{
+	ET_PROFILE_OP(connections);
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v) {
+		detail::decaySynapses<decltype(v)>(connections, permeances, threshold, this);
+	});
+}
 
-	if(dtype == DType::Unknown) {
-		result_dtype = [x](){
-			DType dtype = x->dtype();
-			if(dtype == DType::Bool || dtype == DType::Int32)
-				return DType::Int32;
-			else if(dtype == DType::Half)
-				return DType::Half;
-			else
-				return DType::Float;
-		}();
-	}
+std::shared_ptr<TensorImpl> CPUBackend::sparseCellActivity(const TensorImpl* x, const TensorImpl* rows, const TensorImpl* indices
+	, const TensorImpl* permeances, float connected_permeance, size_t active_threshold)
+{
+	ET_PROFILE_OP(x);
+	std::shared_ptr<TensorImpl> res;
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		res = detail::sparseCellActivity<decltype(v)>(x, rows, indices, permeances, connected_permeance, active_threshold, this);
+	});
+	return res;
+}
 
-	size_t result_size = x->size()/chunk_size;
-	auto res = createTensor({intmax_t(result_size)}, result_dtype);
-
-	// Optimized case for summing everything
-	if(result_size == 1) {
-		dispatch2d(x->dtype(), result_dtype, [&](auto v1, auto v2) {
-			using T = decltype(v1);
-			auto in = (const T*)x->data();
-			using ResType = decltype(v2);
-			auto ptr = (ResType*) res->data();
-			*ptr = tbb::parallel_reduce(tbb::blocked_range(in, in+x->size()), ResType(0)
-				, [](const auto& r, ResType init){
-					return std::accumulate(r.begin(), r.end(), init);
-				},
-				[](auto x, auto y) {
-					return x + y;
-				});
-		});
-	}
-	else {
-		dispatch2d(x->dtype(), result_dtype, [&](auto v1, auto v2) {
-			using T = decltype(v1);
-			auto in = (const T*)x->data();
-			using ResType = decltype(v2);
-			auto ptr = (ResType*) res->data();
-			tbb::parallel_for(size_t(0), size_t(x->size()/chunk_size), [&](size_t i) {
-				size_t offset = i*chunk_size;
-				ResType s = std::accumulate(in+offset, in+offset+chunk_size, ResType(0));
-				ptr[i] = s;
-			});
-		});
-	}
+void CPUBackend::sparseLearnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* rows, const TensorImpl* indices
+	, TensorImpl* permeances, float perm_inc, float perm_dec)
+{
+	ET_PROFILE_OP(x);
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		detail::sparseLearnCorrilation<decltype(v)>(x, learn, rows, indices, permeances, perm_inc, perm_dec, this);
+	});
+}
 
-	return res;
+void CPUBackend::sparseGrowSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* rows, std::shared_ptr<TensorImpl>& indices
+	, std::shared_ptr<TensorImpl>& permeances, float initial_perm, size_t max_synapses_per_cell)
+{
+	ET_PROFILE_OP(x);
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		detail::sparseGrowSynapses<decltype(v)>(x, y, rows, indices, permeances, initial_perm, max_synapses_per_cell, this);
+	});
 }
 
-void CPUBackend::decaySynapses(TensorImpl* connections, TensorImpl* permeances, float threshold)
+void CPUBackend::sparseDecaySynapses(TensorImpl* rows, TensorImpl* indices, TensorImpl* permeances, float threshold)
 {
-	dispatch<type_list_t<float, half>>(permeances->dtype(), [&](auto v) {
-		detail::decaySynapses<decltype(v)>(connections, permeances, threshold, this);
+	ET_PROFILE_OP(rows);
+	dispatch<PermTypeList>(permeances->dtype(), [&](auto v){
+		detail::sparseDecaySynapses<decltype(v)>(rows, indices, permeances, threshold, this);
 	});
 }
 
 std::shared_ptr<TensorImpl> CPUBackend::abs(const TensorImpl* x)
 {
+	ET_PROFILE_OP(x);
 	return uniaryOp(x, [](auto v){return std::abs(v);});
 }
 
+void CPUBackend::abs(const TensorImpl* x, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	uniaryOp(x, [](auto v){return std::abs(v);}, out);
+}
+
 std::shared_ptr<TensorImpl> CPUBackend::exp(const TensorImpl* x)
 {
+	ET_PROFILE_OP(x);
 	return uniaryOp(x, [](auto v){return std::exp(v);});
 }
 
+void CPUBackend::exp(const TensorImpl* x, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	uniaryOp(x, [](auto v){return std::exp(v);}, out);
+}
+
 std::shared_ptr<TensorImpl> CPUBackend::negate(const TensorImpl* x)
 {
+	ET_PROFILE_OP(x);
 	return uniaryOp(x, [](auto v){return -v;});
 }
 
+void CPUBackend::negate(const TensorImpl* x, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	uniaryOp(x, [](auto v){return -v;}, out);
+}
+
 std::shared_ptr<TensorImpl> CPUBackend::inverse(const TensorImpl* x)
 {
+	ET_PROFILE_OP(x);
 	return uniaryOp(x, [](auto v){return 1.f/v;});
 }
 
+void CPUBackend::inverse(const TensorImpl* x, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	uniaryOp(x, [](auto v){return 1.f/v;}, out);
+}
+
 std::shared_ptr<TensorImpl> CPUBackend::log(const TensorImpl* x)
 {
+	ET_PROFILE_OP(x);
 	return uniaryOp(x, [](auto v){return std::log(v);});
 }
 
+void CPUBackend::log(const TensorImpl* x, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	uniaryOp(x, [](auto v){return std::log(v);}, out);
+}
+
+static std::shared_ptr<TensorImpl> logicalNot(const TensorImpl* x, TensorImpl* target, CPUBackend* backend)
+{
+	if(x->dtype() == DType::Bit) {
+		auto in = plainBits(x, backend);
+		return detail::writeOutput(x->shape(), DType::Bit, target, {x}, true, backend, [&](TensorImpl* y) {
+			const uint64_t* a = (const uint64_t*)in->data();
+			uint64_t* out = (uint64_t*)y->data();
+			detail::parallelForWords(x->size(), [&](size_t w, size_t begin, size_t end) {
+				out[w] = ~a[w] & detail::lowMask(end-begin);
+			});
+		});
+	}
+	return uniaryOp(x, [](auto v){return !((bool)v);}, target);
+}
+
 std::shared_ptr<TensorImpl> CPUBackend::logical_not(const TensorImpl* x)
 {
-	return uniaryOp(x, [](auto v){return !((bool)v);});
+	ET_PROFILE_OP(x);
+	return logicalNot(x, nullptr, this);
+}
+
+void CPUBackend::logical_not(const TensorImpl* x, TensorImpl* out)
+{
+	ET_PROFILE_OP(x);
+	logicalNot(x, out, this);
 }
 
 std::shared_ptr<TensorImpl> CPUBackend::add(const TensorImpl* x1, const TensorImpl* x2)
 {
+	ET_PROFILE_OP(x1);
 	return binaryOp(x1, x2, [](auto a, auto b) {return a+b;});
 }
+void CPUBackend::add(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out)
+{
+	ET_PROFILE_OP(x1);
+	binaryOp(x1, x2, [](auto a, auto b) {return a+b;}, out);
+}
 std::shared_ptr<TensorImpl> CPUBackend::subtract(const TensorImpl* x1, const TensorImpl* x2)
 {
+	ET_PROFILE_OP(x1);
 	return binaryOp(x1, x2, [](auto a, auto b) {return a-b;});
 }
+void CPUBackend::subtract(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out)
+{
+	ET_PROFILE_OP(x1);
+	binaryOp(x1, x2, [](auto a, auto b) {return a-b;}, out);
+}
 std::shared_ptr<TensorImpl> CPUBackend::mul(const TensorImpl* x1, const TensorImpl* x2)
 {
+	ET_PROFILE_OP(x1);
 	return binaryOp(x1, x2, [](auto a, auto b) {return a*b;});
 }
+void CPUBackend::mul(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out)
+{
+	ET_PROFILE_OP(x1);
+	binaryOp(x1, x2, [](auto a, auto b) {return a*b;}, out);
+}
 std::shared_ptr<TensorImpl> CPUBackend::div(const TensorImpl* x1, const TensorImpl* x2)
 {
+	ET_PROFILE_OP(x1);
 	return binaryOp(x1, x2, [](auto a, auto b) {return a/b;});
 }
+void CPUBackend::div(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out)
+{
+	ET_PROFILE_OP(x1);
+	binaryOp(x1, x2, [](auto a, auto b) {return a/b;}, out);
+}
+
+//Word-wise operation on Bit tensors. Any non Bit operand is converted to Bit first
+template <typename Op>
+static std::shared_ptr<TensorImpl> bitwiseOp(const TensorImpl* x1, const TensorImpl* x2, CPUBackend* backend, Op op, TensorImpl* target=nullptr)
+{
+	et_assert(x1->shape() == x2->shape());
+	auto in1 = plainBits(x1, backend);
+	auto in2 = plainBits(x2, backend);
+	return detail::writeOutput(x1->shape(), DType::Bit, target, {x1, x2}, true, backend, [&](TensorImpl* y) {
+		const uint64_t* a = (const uint64_t*)in1->data();
+		const uint64_t* b = (const uint64_t*)in2->data();
+		uint64_t* out = (uint64_t*)y->data();
+		detail::parallelForWords(x1->size(), [&](size_t w, size_t begin, size_t end) {
+			out[w] = op(a[w], b[w]) & detail::lowMask(end-begin);
+		});
+	});
+}
+
+static std::shared_ptr<TensorImpl> equalOp(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* target, CPUBackend* backend)
+{
+	if(x1->dtype() == DType::Bit && x2->dtype() == DType::Bit)
+		return bitwiseOp(x1, x2, backend, [](uint64_t a, uint64_t b) {return ~(a^b);}, target);
+	else if(x1->dtype() == DType::Bit)
+		return equalOp(backend->cast(plainBits(x1, backend).get(), DType::Bool).get(), x2, target, backend);
+	else if(x2->dtype() == DType::Bit)
+		return equalOp(x1, backend->cast(plainBits(x2, backend).get(), DType::Bool).get(), target, backend);
+	return binaryOp(x1, x2, [](auto a, auto b) {return a==b;}, target);
+}
 
 std::shared_ptr<TensorImpl> CPUBackend::equal(const TensorImpl* x1, const TensorImpl* x2)
 {
-	return binaryOp(x1, x2, [](auto a, auto b) {return a==b;});
+	ET_PROFILE_OP(x1);
+	return equalOp(x1, x2, nullptr, this);
+}
+void CPUBackend::equal(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out)
+{
+	ET_PROFILE_OP(x1);
+	equalOp(x1, x2, out, this);
 }
 std::shared_ptr<TensorImpl> CPUBackend::greater(const TensorImpl* x1, const TensorImpl* x2)
 {
+	ET_PROFILE_OP(x1);
 	return binaryOp(x1, x2, [](auto a, auto b) {return a>b;});
 }
+void CPUBackend::greater(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out)
+{
+	ET_PROFILE_OP(x1);
+	binaryOp(x1, x2, [](auto a, auto b) {return a>b;}, out);
+}
 std::shared_ptr<TensorImpl> CPUBackend::lesser(const TensorImpl* x1, const TensorImpl* x2)
 {
+	ET_PROFILE_OP(x1);
 	return binaryOp(x1, x2, [](auto a, auto b) {return a<b;});
 }
+void CPUBackend::lesser(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out)
+{
+	ET_PROFILE_OP(x1);
+	binaryOp(x1, x2, [](auto a, auto b) {return a<b;}, out);
+}
 std::shared_ptr<TensorImpl> CPUBackend::logical_and(const TensorImpl* x1, const TensorImpl* x2)
 {
+	ET_PROFILE_OP(x1);
+	if(x1->dtype() == DType::Bit || x2->dtype() == DType::Bit)
+		return bitwiseOp(x1, x2, this, [](uint64_t a, uint64_t b) {return a&b;});
 	return binaryOp(x1, x2, [](auto a, auto b) {return a&&b;});
 }
+void CPUBackend::logical_and(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out)
+{
+	ET_PROFILE_OP(x1);
+	if(x1->dtype() == DType::Bit || x2->dtype() == DType::Bit)
+		bitwiseOp(x1, x2, this, [](uint64_t a, uint64_t b) {return a&b;}, out);
+	else
+		binaryOp(x1, x2, [](auto a, auto b) {return a&&b;}, out);
+}
 std::shared_ptr<TensorImpl> CPUBackend::logical_or(const TensorImpl* x1, const TensorImpl* x2)
 {
+	ET_PROFILE_OP(x1);
+	if(x1->dtype() == DType::Bit || x2->dtype() == DType::Bit)
+		return bitwiseOp(x1, x2, this, [](uint64_t a, uint64_t b) {return a|b;});
 	return binaryOp(x1, x2, [](auto a, auto b) {return a||b;});
 }
+void CPUBackend::logical_or(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out)
+{
+	ET_PROFILE_OP(x1);
+	if(x1->dtype() == DType::Bit || x2->dtype() == DType::Bit)
+		bitwiseOp(x1, x2, this, [](uint64_t a, uint64_t b) {return a|b;}, out);
+	else
+		binaryOp(x1, x2, [](auto a, auto b) {return a||b;}, out);
+}
+
+//binaryOp with the second operand being the same value everywhere. Saves creating and striding over a brodcasted tensor
+template <typename Op>
+static std::shared_ptr<TensorImpl> scalarOp(const TensorImpl* src, Scalar scalar, CPUBackend* backend, Op op)
+{
+	if(src->dtype() == DType::Bit)
+		return scalarOp(backend->cast(plainBits(src, backend).get(), DType::Bool).get(), scalar, backend, op);
+
+	std::shared_ptr<TensorImpl> dest;
+	dispatch(src->dtype(), [&](auto v){
+		using T1 = decltype(v);
+		dispatch<type_list_t<int32_t, float, bool>>(scalar.dtype, [&](auto v){
+			using T2 = decltype(v);
+			using ResType = std::invoke_result_t<Op, T1, T2>;
+			//We don't have support to double percition now. Cast it to float
+			using StoreType = typename std::conditional<std::is_same<ResType, double>::value, float, ResType>::type;
+			const T2 b = T2(scalar.value);
+			dest = backend->createTensor(src->shape(), typeToDType<StoreType>());
+			const T1* in = (const T1*)src->data();
+			StoreType* out = (StoreType*)dest->data();
+
+			detail::StridedLoop<1>(src->shape(), {src}).parallelRun(src->size(), [&](size_t i, size_t n, auto offsets, auto strides) {
+				const T1* a = in + offsets[0];
+				if(strides[0] == 1) {
+					for(size_t j=0;j<n;j++)
+						out[i+j] = op(a[j], b);
+				}
+				else {
+					for(size_t j=0;j<n;j++)
+						out[i+j] = op(a[j*strides[0]], b);
+				}
+			});
+		});
+	});
+
+	et_assert((bool)dest);
+	return dest;
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::add_scalar(const TensorImpl* x, Scalar s)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	return scalarOp(x, s, this, [](auto a, auto b) {return a+b;});
+}
+std::shared_ptr<TensorImpl> CPUBackend::subtract_scalar(const TensorImpl* x, Scalar s, bool scalar_first)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	if(scalar_first)
+		return scalarOp(x, s, this, [](auto a, auto b) {return b-a;});
+	return scalarOp(x, s, this, [](auto a, auto b) {return a-b;});
+}
+std::shared_ptr<TensorImpl> CPUBackend::mul_scalar(const TensorImpl* x, Scalar s)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	return scalarOp(x, s, this, [](auto a, auto b) {return a*b;});
+}
+std::shared_ptr<TensorImpl> CPUBackend::div_scalar(const TensorImpl* x, Scalar s, bool scalar_first)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	if(scalar_first)
+		return scalarOp(x, s, this, [](auto a, auto b) {return b/a;});
+	return scalarOp(x, s, this, [](auto a, auto b) {return a/b;});
+}
+std::shared_ptr<TensorImpl> CPUBackend::equal_scalar(const TensorImpl* x, Scalar s)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	return scalarOp(x, s, this, [](auto a, auto b) {return a==b;});
+}
+std::shared_ptr<TensorImpl> CPUBackend::greater_scalar(const TensorImpl* x, Scalar s)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	return scalarOp(x, s, this, [](auto a, auto b) {return a>b;});
+}
+std::shared_ptr<TensorImpl> CPUBackend::lesser_scalar(const TensorImpl* x, Scalar s)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	return scalarOp(x, s, this, [](auto a, auto b) {return a<b;});
+}
+std::shared_ptr<TensorImpl> CPUBackend::greater_equal_scalar(const TensorImpl* x, Scalar s)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	return scalarOp(x, s, this, [](auto a, auto b) {return a>=b;});
+}
+std::shared_ptr<TensorImpl> CPUBackend::lesser_equal_scalar(const TensorImpl* x, Scalar s)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	return scalarOp(x, s, this, [](auto a, auto b) {return a<=b;});
+}
+std::shared_ptr<TensorImpl> CPUBackend::not_equal_scalar(const TensorImpl* x, Scalar s)
+{
+	ET_PROFILE_OP(x);
+	requireProperties(x, this);
+	return scalarOp(x, s, this, [](auto a, auto b) {return a!=b;});
+}
 
 std::shared_ptr<TensorImpl> CPUBackend::from(const TensorImpl* x)
 {
+	ET_PROFILE_OP(x);
 	const void* ptr = x->data();
 	if(ptr != nullptr)
 		return createTensor(x->shape(), x->dtype(), ptr);
 
-	void* buffer = malloc(x->size()*dtypeToSize(x->dtype()));
+	void* buffer = malloc(dtypeToBufferSize(x->dtype(), x->size()));
 	x->backend()->copyToHost(x, buffer);
 	auto res = createTensor(x->shape(), x->dtype(), buffer);
 	free(buffer);
 	return res;
 }
+
+namespace et::detail
+{
+//An elementwise expression compiled into a list of instructions. Every instruction writes a register holding
+//a block of values. Everything is computed in float, so only expressions where the eager operations would
+//also compute in float (or produce Bool from floats and Bools) are accepted. These give identical results.
+//Int32 tensors and casts to Int32 are not fused, float can't hold every Int32 value. Int32 scalars are fine,
+//they only end up next to floats and the eager operations convert them to float too
+struct FusedInstruction
+{
+	ExprOp op;
+	DType dtype; // DType of the result had the operation been performed eagerly
+	int lhs = -1;
+	int rhs = -1;
+	std::shared_ptr<TensorImpl> leaf; // Brodcasted to the result shape
+	std::shared_ptr<StridedLoop<1>> loop; // Walks the leaf
+	float scalar = 0;
+	bool is_scalar = false;
+};
+
+struct FusedProgram
+{
+	FusedProgram(const CPUBackend* backend, Shape shape) : backend_(backend), shape_(std::move(shape)) {}
+
+	//Returns the register index holding the node's result. -1 if the node can't be fused
+	int compile(const ExprNode* node)
+	{
+		if(auto it = registers_.find(node); it != registers_.end())
+			return it->second;
+
+		FusedInstruction inst;
+		inst.op = node->op;
+		if(node->op == ExprOp::Tensor && node->scalar.has_value()) {
+			inst.dtype = node->scalar->dtype;
+			inst.is_scalar = true;
+			inst.scalar = float(node->scalar->value);
+			return push(node, std::move(inst));
+		}
+		if(node->op == ExprOp::Tensor) {
+			const Tensor& t = node->tensor;
+			inst.dtype = t.dtype();
+			if(t.backend() != backend_ || (inst.dtype != DType::Float && inst.dtype != DType::Bool))
+				return -1;
+			if(t.size() == 1) {
+				inst.is_scalar = true;
+				dispatch<type_list_t<float, bool>>(inst.dtype, [&](auto v) {
+					inst.scalar = float(*getPtrToValue<decltype(v)>(0, t.pimpl()));
+				});
+			}
+			else {
+				inst.leaf = brodcast_to(t, shape_).shared_pimpl();
+				inst.loop = std::make_shared<StridedLoop<1>>(shape_, std::array<const TensorImpl*, 1>{inst.leaf.get()});
+			}
+			return push(node, std::move(inst));
+		}
+
+		inst.lhs = compile(node->lhs.get());
+		if(inst.lhs == -1)
+			return -1;
+		if(node->rhs) {
+			inst.rhs = compile(node->rhs.get());
+			if(inst.rhs == -1)
+				return -1;
+		}
+
+		DType a = instructions_[inst.lhs].dtype;
+		DType b = inst.rhs == -1 ? DType::Unknown : instructions_[inst.rhs].dtype;
+		bool has_float = a == DType::Float || b == DType::Float;
+		switch(node->op) {
+			case ExprOp::Cast:
+				inst.dtype = node->dtype;
+				if(inst.dtype != DType::Float && inst.dtype != DType::Bool)
+					return -1;
+				break;
+			case ExprOp::Abs: case ExprOp::Exp: case ExprOp::Negate: case ExprOp::Log:
+				if(a != DType::Float)
+					return -1;
+				inst.dtype = DType::Float;
+				break;
+			case ExprOp::Inverse:
+				inst.dtype = DType::Float;
+				break;
+			case ExprOp::Add: case ExprOp::Subtract: case ExprOp::Mul: case ExprOp::Div:
+				if(has_float == false)
+					return -1; // Integer arithmetic
+				inst.dtype = DType::Float;
+				break;
+			case ExprOp::Equal: case ExprOp::Greater: case ExprOp::Lesser:
+				if(has_float == false && (a != DType::Bool || b != DType::Bool))
+					return -1; // Integer comparsion
+				inst.dtype = DType::Bool;
+				break;
+			case ExprOp::LogicalNot: case ExprOp::LogicalAnd: case ExprOp::LogicalOr:
+				inst.dtype = DType::Bool;
+				break;
+			default:
+				return -1;
+		}
+		return push(node, std::move(inst));
+	}
+
+	void run(size_t begin, size_t size, float* registers, size_t block_size) const
+	{
+		for(size_t k=0;k<instructions_.size();k++) {
+			const FusedInstruction& inst = instructions_[k];
+			float* out = registers + k*block_size;
+			const float* a = inst.lhs == -1 ? nullptr : registers + inst.lhs*block_size;
+			const float* b = inst.rhs == -1 ? nullptr : registers + inst.rhs*block_size;
+			switch(inst.op) {
+				case ExprOp::Tensor:
+					if(inst.is_scalar)
+						std::fill(out, out+size, inst.scalar);
+					else
+						load(inst, begin, size, out);
+					break;
+				case ExprOp::Cast:
+					if(inst.dtype == DType::Bool)
+						for(size_t i=0;i<size;i++) out[i] = a[i] != 0;
+					else
+						std::copy(a, a+size, out);
+					break;
+				case ExprOp::Abs: for(size_t i=0;i<size;i++) out[i] = std::abs(a[i]); break;
+				case ExprOp::Exp: for(size_t i=0;i<size;i++) out[i] = std::exp(a[i]); break;
+				case ExprOp::Negate: for(size_t i=0;i<size;i++) out[i] = -a[i]; break;
+				case ExprOp::Inverse: for(size_t i=0;i<size;i++) out[i] = 1.f/a[i]; break;
+				case ExprOp::Log: for(size_t i=0;i<size;i++) out[i] = std::log(a[i]); break;
+				case ExprOp::LogicalNot: for(size_t i=0;i<size;i++) out[i] = a[i] == 0; break;
+				case ExprOp::Add: for(size_t i=0;i<size;i++) out[i] = a[i] + b[i]; break;
+				case ExprOp::Subtract: for(size_t i=0;i<size;i++) out[i] = a[i] - b[i]; break;
+				case ExprOp::Mul: for(size_t i=0;i<size;i++) out[i] = a[i] * b[i]; break;
+				case ExprOp::Div: for(size_t i=0;i<size;i++) out[i] = a[i] / b[i]; break;
+				case ExprOp::Equal: for(size_t i=0;i<size;i++) out[i] = a[i] == b[i]; break;
+				case ExprOp::Greater: for(size_t i=0;i<size;i++) out[i] = a[i] > b[i]; break;
+				case ExprOp::Lesser: for(size_t i=0;i<size;i++) out[i] = a[i] < b[i]; break;
+				case ExprOp::LogicalAnd: for(size_t i=0;i<size;i++) out[i] = a[i] != 0 && b[i] != 0; break;
+				case ExprOp::LogicalOr: for(size_t i=0;i<size;i++) out[i] = a[i] != 0 || b[i] != 0; break;
+			}
+		}
+	}
+
+	size_t size() const {return instructions_.size();}
+	DType resultType() const {return instructions_.back().dtype;}
+
+	//Runs the program over every element, writing the results into res (plain and of resultType())
+	void evaluate(TensorImpl* res) const
+	{
+		constexpr size_t block_size = 1024;
+		const size_t num_registers = size();
+		tbb::parallel_for(tbb::blocked_range<size_t>(0, res->size(), block_size), [&](const auto& r) {
+			thread_local std::vector<float> registers;
+			registers.resize(num_registers*block_size);
+			float* regs = registers.data();
+			run(r.begin(), r.size(), regs, block_size);
+
+			const float* result = regs + (num_registers-1)*block_size;
+			dispatch<type_list_t<float, bool>>(res->dtype(), [&](auto v) {
+				using T = decltype(v);
+				T* out = (T*)res->data() + r.begin();
+				for(size_t i=0;i<r.size();i++)
+					out[i] = T(result[i]);
+			});
+		});
+	}
+
+protected:
+	int push(const ExprNode* node, FusedInstruction inst)
+	{
+		instructions_.push_back(std::move(inst));
+		registers_[node] = int(instructions_.size()-1);
+		return registers_[node];
+	}
+
+	static void load(const FusedInstruction& inst, size_t begin, size_t size, float* out)
+	{
+		dispatch<type_list_t<float, bool>>(inst.dtype, [&](auto v) {
+			using T = decltype(v);
+			const T* in = (const T*)inst.leaf->data();
+			inst.loop->run(begin, begin+size, [&](size_t i, size_t n, auto offsets, auto strides) {
+				float* dest = out + (i-begin);
+				for(size_t j=0;j<n;j++)
+					dest[j] = float(in[offsets[0]+j*strides[0]]);
+			});
+		});
+	}
+
+	const CPUBackend* backend_;
+	Shape shape_;
+	std::vector<FusedInstruction> instructions_;
+	std::unordered_map<const ExprNode*, int> registers_;
+};
+
+}
+
+namespace et::detail
+{
+
+//Leaves of the expression sharing memory with out. The fused kernel computes blocks of elements before writing them.
+//So these are fine as long as they are read at the element being written
+static void collectLeaves(const ExprNode* node, std::vector<const TensorImpl*>& leaves)
+{
+	if(node->op == ExprOp::Tensor && node->scalar.has_value() == false)
+		leaves.push_back(node->tensor.pimpl());
+	if(node->lhs)
+		collectLeaves(node->lhs.get(), leaves);
+	if(node->rhs)
+		collectLeaves(node->rhs.get(), leaves);
+}
+
+}
+
+std::shared_ptr<TensorImpl> CPUBackend::evaluate(const ExprNode* expr)
+{
+	ET_PROFILE_OP_SHAPE(expr->shape, DType::Unknown);
+	detail::FusedProgram program(this, expr->shape);
+	if(program.compile(expr) == -1)
+		return Backend::evaluate(expr);
+	auto res = createTensor(expr->shape, program.resultType());
+	program.evaluate(res.get());
+	return res;
+}
+
+void CPUBackend::evaluate(const ExprNode* expr, TensorImpl* out)
+{
+	ET_PROFILE_OP_SHAPE(expr->shape, DType::Unknown);
+	detail::FusedProgram program(this, expr->shape);
+	if(program.compile(expr) == -1)
+		return Backend::evaluate(expr, out);
+
+	std::vector<const TensorImpl*> leaves;
+	detail::collectLeaves(expr, leaves);
+	bool direct = out->isplain() && out->dtype() == program.resultType() && std::all_of(leaves.begin(), leaves.end(), [&](auto x) {
+		return x->buffer() != out->buffer() || (x->isplain() && x->shape() == out->shape());
+	});
+	requireProperties(out, this, expr->shape);
+	if(direct) {
+		program.evaluate(out);
+		return;
+	}
+	auto res = createTensor(expr->shape, program.resultType());
+	program.evaluate(res.get());
+	assign(out, res.get());
+}
@@ -2,9 +2,9 @@
 
 #include <Etaler/Core/TensorImpl.hpp>
 #include <Etaler/Core/TypeHelpers.hpp>
+#include "CPUAllocator.hpp"
 
 #include <memory>
-#include <variant>
 #include <vector>
 #include <cstdint>
 
@@ -14,52 +14,74 @@ namespace et
 
 struct ETALER_EXPORT CPUBuffer : public BufferImpl
 {
-	CPUBuffer(const Shape& shape, DType dtype, std::shared_ptr<Backend> backend)
-		: BufferImpl(shape.volume(), dtype, std::move(backend))
+	CPUBuffer(const Shape& shape, DType dtype, std::shared_ptr<Backend> backend, std::shared_ptr<CPUAllocator> allocator)
+		: BufferImpl(shape.volume(), dtype, std::move(backend)), allocator_(std::move(allocator))
 	{
-		if(dtype == DType::Bool)
-			storage_ = new bool[shape.volume()];
-		else if(dtype == DType::Int32)
-			storage_ = new int32_t[shape.volume()];
-		else if(dtype == DType::Float)
-			storage_ = new float[shape.volume()];
-		else if(dtype == DType::Half)
-			storage_ = new half[shape.volume()];
-		else
+		if(dtype == DType::Unknown) {
 			std::cerr << "Critical Warning: CPUBuffer Initialize failed. Unknown DType" << std::endl;
+			return;
+		}
+		storage_ = allocator_->allocate(dtypeToBufferSize(dtype, shape.volume()));
+		if(dtype == DType::Bit) //Zeroed. Kernels rely on the unused tail bits being 0
+			memset(storage_, 0, dtypeToBufferSize(dtype, shape.volume()));
 	}
 
-	CPUBuffer(const Shape& shape, DType dtype, std::shared_ptr<Backend> backend, const void* src_ptr)
-		: CPUBuffer(shape, dtype, std::move(backend))
+	CPUBuffer(const Shape& shape, DType dtype, std::shared_ptr<Backend> backend, std::shared_ptr<CPUAllocator> allocator, const void* src_ptr)
+		: CPUBuffer(shape, dtype, std::move(backend), std::move(allocator))
 	{
 		void* ptr = data();
 
 		//HACK: Lazy method to dopy data
 		if(src_ptr != nullptr)
-			memcpy(ptr, src_ptr, shape.volume()*dtypeToSize(dtype));
+			memcpy(ptr, src_ptr, dtypeToBufferSize(dtype, shape.volume()));
+
+		//Clear the padding bits in case the source has garbage in them
+		if(src_ptr != nullptr && dtype == DType::Bit && shape.volume()%64 != 0)
+			((uint64_t*)ptr)[shape.volume()/64] &= (uint64_t(1) << (shape.volume()%64)) - 1;
 	}
 
+	//Uses memory owned by someone else (ex: a memory mapped file) as the storage. owner is kept alive with the buffer
+	CPUBuffer(const Shape& shape, DType dtype, std::shared_ptr<Backend> backend, void* storage, std::shared_ptr<void> owner)
+		: BufferImpl(shape.volume(), dtype, std::move(backend)), storage_(storage), owner_(std::move(owner))
+	{}
+
 	virtual ~CPUBuffer();
 
 	virtual void* data() const override;
 
 protected:
-	std::variant<bool*, int32_t*, float*, half*> storage_;
+	void* storage_ = nullptr;
+	std::shared_ptr<CPUAllocator> allocator_;
+	std::shared_ptr<void> owner_;
 };
 
 struct ETALER_EXPORT CPUBackend : public Backend
 {
 	virtual std::shared_ptr<TensorImpl> createTensor(const Shape& shape, DType dtype, const void* data=nullptr) override
 	{
-		auto buf = std::make_shared<CPUBuffer>(shape, dtype, shared_from_this(), data);
+		auto buf = std::make_shared<CPUBuffer>(shape, dtype, shared_from_this(), allocator_, data);
 		return std::make_shared<TensorImpl>(buf, shape, shapeToStride(shape));
 	}
 
+	//Creates a tensor using data as it's storage without copying. owner is kept alive as long as the tensor is
+	virtual std::shared_ptr<TensorImpl> wrapTensor(const Shape& shape, DType dtype, void* data, std::shared_ptr<void> owner)
+	{
+		auto buf = std::make_shared<CPUBuffer>(shape, dtype, shared_from_this(), data, std::move(owner));
+		return std::make_shared<TensorImpl>(buf, shape, shapeToStride(shape));
+	}
+
+	//The caching allocator all tensors on this backend are allocated from
+	CPUAllocator& allocator() const {return *allocator_;}
+
 	virtual std::shared_ptr<TensorImpl> cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances,
 		float connected_permeance, size_t active_threshold, bool has_unconnected_synapse=true) override;
 	virtual void learnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* connections,
 		TensorImpl* permeances, float perm_inc, float perm_dec, bool has_unconnected_synapse=true) override;
 	virtual std::shared_ptr<TensorImpl> globalInhibition(const TensorImpl* x, float fraction) override;
+	virtual std::shared_ptr<TensorImpl> localInhibition(const TensorImpl* x, float fraction, size_t radius) override;
+	virtual std::shared_ptr<TensorImpl> batchCellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances,
+		float connected_permeance, size_t active_threshold, bool has_unconnected_synapse=true) override;
+	virtual std::shared_ptr<TensorImpl> batchGlobalInhibition(const TensorImpl* x, float fraction) override;
 	virtual std::shared_ptr<TensorImpl> cast(const TensorImpl* x, DType toType) override;
 	virtual void copyToHost(const TensorImpl* pimpl, void* dest) override;
 	virtual std::shared_ptr<TensorImpl> copy(const TensorImpl* x) override;
@@ -69,11 +91,35 @@ struct ETALER_EXPORT CPUBackend : public Backend
 	virtual void growSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* connections
 		, TensorImpl* permeances, float initial_perm) override;
 	virtual void decaySynapses(TensorImpl* connections, TensorImpl* permeances, float threshold) override;
+	virtual std::shared_ptr<TensorImpl> sparseCellActivity(const TensorImpl* x, const TensorImpl* rows, const TensorImpl* indices
+		, const TensorImpl* permeances, float connected_permeance, size_t active_threshold) override;
+	virtual void sparseLearnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* rows, const TensorImpl* indices
+		, TensorImpl* permeances, float perm_inc, float perm_dec) override;
+	virtual void sparseGrowSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* rows, std::shared_ptr<TensorImpl>& indices
+		, std::shared_ptr<TensorImpl>& permeances, float initial_perm, size_t max_synapses_per_cell) override;
+	virtual void sparseDecaySynapses(TensorImpl* rows, TensorImpl* indices, TensorImpl* permeances, float threshold) override;
 	virtual std::shared_ptr<TensorImpl> from(const TensorImpl* x) override;
+	virtual std::shared_ptr<TensorImpl> flatnonzero(const TensorImpl* x) override;
+	virtual std::shared_ptr<TensorImpl> reverseSynapseIndex(const TensorImpl* connections, const Shape& input_shape) override;
+	virtual std::shared_ptr<TensorImpl> invertedCellActivity(const TensorImpl* active_bits, const TensorImpl* reverse_index,
+		const TensorImpl* permeances, float connected_permeance, size_t active_threshold) override;
+	virtual std::shared_ptr<TensorImpl> updateOverlaps(const TensorImpl* turned_on, const TensorImpl* turned_off, const TensorImpl* reverse_index
+		, const TensorImpl* permeances, float connected_permeance, size_t active_threshold, TensorImpl* overlaps) override;
+	virtual void recomputeOverlaps(const TensorImpl* x, const TensorImpl* cells, const TensorImpl* connections, const TensorImpl* permeances
+		, float connected_permeance, TensorImpl* overlaps) override;
+	virtual std::shared_ptr<TensorImpl> maskCellActivity(const TensorImpl* x, const TensorImpl* masks, size_t active_threshold) override;
+	virtual std::shared_ptr<TensorImpl> batchMaskCellActivity(const TensorImpl* x, const TensorImpl* masks, size_t active_threshold) override;
+	virtual std::shared_ptr<TensorImpl> indexCellActivity(const TensorImpl* x, const TensorImpl* rows, const TensorImpl* indices
+		, size_t active_threshold) override;
+	virtual std::shared_ptr<TensorImpl> spatialPoolerStep(const TensorImpl* x, const TensorImpl* connections, TensorImpl* permeances
+		, const TensorImpl* average_activity, float connected_permeance, size_t active_threshold, float density, float boost_factor
+		, bool learn, float perm_inc, float perm_dec) override;
 
 	virtual std::shared_ptr<TensorImpl> realize(const TensorImpl* x) override;
+	virtual std::shared_ptr<TensorImpl> evaluate(const ExprNode* expr) override;
 	virtual void assign(TensorImpl* dest, const TensorImpl* src) override;
 	virtual std::shared_ptr<TensorImpl> sum(const TensorImpl* x, size_t chunk_size, DType dtype=DType::Unknown) override;
+	virtual std::shared_ptr<TensorImpl> reduce(const TensorImpl* x, const svector<intmax_t>& dims, ReduceOp op, DType dtype=DType::Unknown) override;
 
 	//Unary Operations
 	virtual std::shared_ptr<TensorImpl> abs(const TensorImpl* x) override;
@@ -94,7 +140,58 @@ struct ETALER_EXPORT CPUBackend : public Backend
 	virtual std::shared_ptr<TensorImpl> logical_and(const TensorImpl* x1, const TensorImpl* x2) override;
 	virtual std::shared_ptr<TensorImpl> logical_or(const TensorImpl* x1, const TensorImpl* x2) override;
 
+	//Binary operations with a scalar
+	virtual std::shared_ptr<TensorImpl> add_scalar(const TensorImpl* x, Scalar s) override;
+	virtual std::shared_ptr<TensorImpl> subtract_scalar(const TensorImpl* x, Scalar s, bool scalar_first=false) override;
+	virtual std::shared_ptr<TensorImpl> mul_scalar(const TensorImpl* x, Scalar s) override;
+	virtual std::shared_ptr<TensorImpl> div_scalar(const TensorImpl* x, Scalar s, bool scalar_first=false) override;
+	virtual std::shared_ptr<TensorImpl> equal_scalar(const TensorImpl* x, Scalar s) override;
+	virtual std::shared_ptr<TensorImpl> greater_scalar(const TensorImpl* x, Scalar s) override;
+	virtual std::shared_ptr<TensorImpl> lesser_scalar(const TensorImpl* x, Scalar s) override;
+	virtual std::shared_ptr<TensorImpl> greater_equal_scalar(const TensorImpl* x, Scalar s) override;
+	virtual std::shared_ptr<TensorImpl> lesser_equal_scalar(const TensorImpl* x, Scalar s) override;
+	virtual std::shared_ptr<TensorImpl> not_equal_scalar(const TensorImpl* x, Scalar s) override;
+
+	//Out variants. Written directly when out is plain, has the type the op produces and doesn't overlap with inputs
+	//the op reads other elements of. Otherwise through a temporary
+	virtual void cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
+		, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse, TensorImpl* out) override;
+	virtual void cast(const TensorImpl* x, TensorImpl* out) override;
+	virtual void burst(const TensorImpl* x, const TensorImpl* s, TensorImpl* out) override;
+	virtual void reverseBurst(const TensorImpl* x, TensorImpl* out) override;
+	virtual void evaluate(const ExprNode* expr, TensorImpl* out) override;
+	virtual void sum(const TensorImpl* x, size_t chunk_size, TensorImpl* out) override;
+
+	virtual void abs(const TensorImpl* x, TensorImpl* out) override;
+	virtual void exp(const TensorImpl* x, TensorImpl* out) override;
+	virtual void negate(const TensorImpl* x, TensorImpl* out) override;
+	virtual void inverse(const TensorImpl* x, TensorImpl* out) override;
+	virtual void log(const TensorImpl* x, TensorImpl* out) override;
+	virtual void logical_not(const TensorImpl* x, TensorImpl* out) override;
+
+	virtual void add(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) override;
+	virtual void subtract(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) override;
+	virtual void mul(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) override;
+	virtual void div(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) override;
+	virtual void equal(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) override;
+	virtual void greater(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) override;
+	virtual void lesser(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) override;
+	virtual void logical_and(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) override;
+	virtual void logical_or(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) override;
+
 	virtual std::string name() const override {return "CPU";}
+
+protected:
+	std::shared_ptr<CPUAllocator> allocator_ = std::make_shared<CPUAllocator>();
 };
 
+namespace detail
+{
+//Counts the synapses of a cell that are connected and connected to an on bit, using the cellActivity kernel named
+//kernel ("scalar", "avx2" or "avx512"). bits is the input packed 32 bits per word. Returns -1 if the kernel isn't
+//available on the running CPU. For testing the SIMD kernels against the scalar one
+ETALER_EXPORT intmax_t rowOverlap(const std::string& kernel, const int32_t* synapses, const void* perms, DType perm_type
+	, size_t n, const uint32_t* bits, float connected_permeance);
+}
+
 } // et
@@ -142,6 +142,7 @@ void OpenCLBackend::init(cl::Context context, cl::Platform platform, cl::Device
 std::shared_ptr<TensorImpl> OpenCLBackend::createTensor(const Shape& shape, DType dtype, const void* data)
 {
 	et_assert(dtype != DType::Unknown);
+	et_check(dtype != DType::Bit, "The OpenCL backend does not support Bit tensors yet");
 	size_t buf_size = shape.volume()*dtypeToSize(dtype);
 	cl::Buffer buf = allocBuffer(buf_size);
 
@@ -532,8 +533,8 @@ std::shared_ptr<TensorImpl> OpenCLBackend::reverseBurst(const TensorImpl* x)
 
 	size_t cells_per_column = x->shape().back();
 	size_t num_columns = x->size()/cells_per_column;
-	static pcg32 rng(42); //Static so the behavor hangees every time, breaking symmetry
-	std::uniform_int_distribution<size_t> dist(0, cells_per_column-1);
+	// A new stream every call, breaking symmetry. Reproducible for a seed
+	pcg32 rng = randomStream().generator(0);
 
 	auto res = copy(x);
 
@@ -0,0 +1,283 @@
+#include "Backend.hpp"
+#include "Tensor.hpp"
+#include "Expression.hpp"
+#include "Random.hpp"
+
+#include <unordered_map>
+#include <algorithm>
+
+using namespace et;
+
+std::shared_ptr<TensorImpl> Backend::spatialPoolerStep(const TensorImpl* x, const TensorImpl* connections, TensorImpl* permeances
+	, const TensorImpl* average_activity, float connected_permeance, size_t active_threshold, float density, float boost_factor
+	, bool learn, float perm_inc, float perm_dec)
+{
+	Tensor activity = cellActivity(x, connections, permeances, connected_permeance, active_threshold, false);
+	if(average_activity != nullptr && boost_factor != 0) {
+		Tensor average = std::const_pointer_cast<TensorImpl>(average_activity->shared_from_this());
+		activity = et::cast(et::exp((density - lazy(average)) * boost_factor) * activity, DType::Int32);
+	}
+
+	auto y = globalInhibition(activity.pimpl(), density);
+	if(learn)
+		learnCorrilation(x, y.get(), connections, permeances, perm_inc, perm_dec);
+	return y;
+}
+
+// Runs op on every sample of x and stacks the results
+template <typename Op>
+static std::shared_ptr<TensorImpl> perSample(const TensorImpl* x, Op op)
+{
+	Tensor input = std::const_pointer_cast<TensorImpl>(x->shared_from_this());
+	et_check(input.dimensions() >= 1);
+	svector<Tensor> results;
+	for(intmax_t i=0;i<input.shape()[0];i++) {
+		Tensor y = op(realize(input.view({i})));
+		results.push_back(y.reshape(Shape{1} + y.shape()));
+	}
+	return cat(results, 0).shared_pimpl();
+}
+
+std::shared_ptr<TensorImpl> Backend::batchCellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
+	, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse)
+{
+	return perSample(x, [&](const Tensor& sample) {
+		return Tensor(cellActivity(sample.pimpl(), connections, permeances, connected_permeance, active_threshold, has_unconnected_synapse));
+	});
+}
+
+std::shared_ptr<TensorImpl> Backend::batchGlobalInhibition(const TensorImpl* x, float fraction)
+{
+	return perSample(x, [&](const Tensor& sample) {
+		return Tensor(globalInhibition(sample.pimpl(), fraction));
+	});
+}
+
+RandomStream Backend::randomStream()
+{
+	return RandomStream(random_seed_, random_step_++);
+}
+
+// A 1 element tensor holding s on backend
+static Tensor scalarTensor(Scalar s, Backend* backend)
+{
+	bool b = s.value != 0;
+	int32_t i = int32_t(s.value);
+	float f = float(s.value);
+	if(s.dtype == DType::Bool)
+		return Tensor({1}, &b, backend);
+	else if(s.dtype == DType::Int32)
+		return Tensor({1}, &i, backend);
+	return Tensor({1}, &f, backend);
+}
+
+// s in a tensor on the backend of x, brodcasted to x's shape. For backends without scalar operations
+static Tensor brodcastScalar(const TensorImpl* x, Scalar s)
+{
+	return brodcast_to(scalarTensor(s, x->backend()), x->shape());
+}
+
+static Tensor evaluateNode(const ExprNode* node, std::unordered_map<const ExprNode*, Tensor>& results, Backend* backend);
+
+// Binary operations between a tensor and a scalar are done by the scalar operations of the tensor's backend.
+// Returns an empty tensor for other nodes
+static Tensor evaluateScalarNode(const ExprNode* node, std::unordered_map<const ExprNode*, Tensor>& results, Backend* backend)
+{
+	if(node->rhs.get() == nullptr || node->lhs->scalar.has_value() == node->rhs->scalar.has_value())
+		return Tensor();
+	bool scalar_first = node->lhs->scalar.has_value();
+	Scalar v = scalar_first ? *node->lhs->scalar : *node->rhs->scalar;
+	Tensor t = evaluateNode(scalar_first ? node->rhs.get() : node->lhs.get(), results, backend);
+	if(t.shape() != node->shape)
+		return Tensor();
+
+	switch(node->op) {
+		case ExprOp::Add: return t.backend()->add_scalar(t.pimpl(), v);
+		case ExprOp::Subtract: return t.backend()->subtract_scalar(t.pimpl(), v, scalar_first);
+		case ExprOp::Mul: return t.backend()->mul_scalar(t.pimpl(), v);
+		case ExprOp::Div: return t.backend()->div_scalar(t.pimpl(), v, scalar_first);
+		case ExprOp::Equal: return t.backend()->equal_scalar(t.pimpl(), v);
+		case ExprOp::Greater: return scalar_first ? t.backend()->lesser_scalar(t.pimpl(), v) : t.backend()->greater_scalar(t.pimpl(), v);
+		case ExprOp::Lesser: return scalar_first ? t.backend()->greater_scalar(t.pimpl(), v) : t.backend()->lesser_scalar(t.pimpl(), v);
+		default: return Tensor();
+	}
+}
+
+// Scalar leaves are created on the backend of the tensor they are used with, or the evaluating backend otherwise
+static Tensor evaluateNode(const ExprNode* node, std::unordered_map<const ExprNode*, Tensor>& results, Backend* backend)
+{
+	if(node->op == ExprOp::Tensor && node->scalar.has_value() == false)
+		return node->tensor;
+	if(auto it = results.find(node); it != results.end())
+		return it->second;
+	if(node->op == ExprOp::Tensor)
+		return results[node] = scalarTensor(*node->scalar, backend);
+
+	Tensor res = evaluateScalarNode(node, results, backend);
+	if(res.has_value()) {
+		results[node] = res;
+		return res;
+	}
+
+	bool lhs_scalar = node->lhs->scalar.has_value();
+	bool rhs_scalar = node->rhs && node->rhs->scalar.has_value();
+	Tensor a, b;
+	if(lhs_scalar && node->rhs && rhs_scalar == false) {
+		b = evaluateNode(node->rhs.get(), results, backend);
+		a = brodcastScalar(b.pimpl(), *node->lhs->scalar);
+	}
+	else {
+		a = evaluateNode(node->lhs.get(), results, backend);
+		if(rhs_scalar && lhs_scalar == false)
+			b = brodcastScalar(a.pimpl(), *node->rhs->scalar);
+		else if(node->rhs)
+			b = evaluateNode(node->rhs.get(), results, backend);
+	}
+	res = [&]() {
+		switch(node->op) {
+			case ExprOp::Cast: return a.cast(node->dtype);
+			case ExprOp::Abs: return a.abs();
+			case ExprOp::Exp: return a.exp();
+			case ExprOp::Negate: return a.negate();
+			case ExprOp::Inverse: return a.inverse();
+			case ExprOp::Log: return a.log();
+			case ExprOp::LogicalNot: return a.logical_not();
+			case ExprOp::Add: return a.add(b);
+			case ExprOp::Subtract: return a.subtract(b);
+			case ExprOp::Mul: return a.mul(b);
+			case ExprOp::Div: return a.div(b);
+			case ExprOp::Equal: return a.equal(b);
+			case ExprOp::Greater: return a.greater(b);
+			case ExprOp::Lesser: return a.lesser(b);
+			case ExprOp::LogicalAnd: return a.logical_and(b);
+			case ExprOp::LogicalOr: return a.logical_or(b);
+			default: throw EtError("Unknown expression node");
+		}
+	}();
+	results[node] = res;
+	return res;
+}
+
+std::shared_ptr<TensorImpl> Backend::evaluate(const ExprNode* expr)
+{
+	std::unordered_map<const ExprNode*, Tensor> results;
+	return evaluateNode(expr, results, this).shared_pimpl();
+}
+
+void Backend::cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
+	, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse, TensorImpl* out)
+{
+	assign(out, cellActivity(x, connections, permeances, connected_permeance, active_threshold, has_unconnected_synapse).get());
+}
+
+void Backend::cast(const TensorImpl* x, TensorImpl* out) { assign(out, cast(x, out->dtype()).get()); }
+void Backend::burst(const TensorImpl* x, const TensorImpl* s, TensorImpl* out) { assign(out, burst(x, s).get()); }
+void Backend::reverseBurst(const TensorImpl* x, TensorImpl* out) { assign(out, reverseBurst(x).get()); }
+void Backend::evaluate(const ExprNode* expr, TensorImpl* out) { assign(out, evaluate(expr).get()); }
+
+void Backend::sum(const TensorImpl* x, size_t chunk_size, TensorImpl* out)
+{
+	auto res = sum(x, chunk_size, out->dtype());
+	res->resize(out->shape());
+	assign(out, res.get());
+}
+
+void Backend::abs(const TensorImpl* x, TensorImpl* out) { assign(out, abs(x).get()); }
+void Backend::exp(const TensorImpl* x, TensorImpl* out) { assign(out, exp(x).get()); }
+void Backend::negate(const TensorImpl* x, TensorImpl* out) { assign(out, negate(x).get()); }
+void Backend::inverse(const TensorImpl* x, TensorImpl* out) { assign(out, inverse(x).get()); }
+void Backend::log(const TensorImpl* x, TensorImpl* out) { assign(out, log(x).get()); }
+void Backend::logical_not(const TensorImpl* x, TensorImpl* out) { assign(out, logical_not(x).get()); }
+
+void Backend::add(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) { assign(out, add(x1, x2).get()); }
+void Backend::subtract(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) { assign(out, subtract(x1, x2).get()); }
+void Backend::mul(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) { assign(out, mul(x1, x2).get()); }
+void Backend::div(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) { assign(out, div(x1, x2).get()); }
+void Backend::equal(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) { assign(out, equal(x1, x2).get()); }
+void Backend::greater(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) { assign(out, greater(x1, x2).get()); }
+void Backend::lesser(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) { assign(out, lesser(x1, x2).get()); }
+void Backend::logical_and(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) { assign(out, logical_and(x1, x2).get()); }
+void Backend::logical_or(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out) { assign(out, logical_or(x1, x2).get()); }
+
+
+std::shared_ptr<TensorImpl> Backend::add_scalar(const TensorImpl* x, Scalar s) { return add(x, brodcastScalar(x, s).pimpl()); }
+std::shared_ptr<TensorImpl> Backend::mul_scalar(const TensorImpl* x, Scalar s) { return mul(x, brodcastScalar(x, s).pimpl()); }
+std::shared_ptr<TensorImpl> Backend::equal_scalar(const TensorImpl* x, Scalar s) { return equal(x, brodcastScalar(x, s).pimpl()); }
+std::shared_ptr<TensorImpl> Backend::greater_scalar(const TensorImpl* x, Scalar s) { return greater(x, brodcastScalar(x, s).pimpl()); }
+std::shared_ptr<TensorImpl> Backend::lesser_scalar(const TensorImpl* x, Scalar s) { return lesser(x, brodcastScalar(x, s).pimpl()); }
+std::shared_ptr<TensorImpl> Backend::greater_equal_scalar(const TensorImpl* x, Scalar s) { return logical_or(greater_scalar(x, s).get(), equal_scalar(x, s).get()); }
+std::shared_ptr<TensorImpl> Backend::lesser_equal_scalar(const TensorImpl* x, Scalar s) { return logical_or(lesser_scalar(x, s).get(), equal_scalar(x, s).get()); }
+std::shared_ptr<TensorImpl> Backend::not_equal_scalar(const TensorImpl* x, Scalar s) { return logical_not(equal_scalar(x, s).get()); }
+
+std::shared_ptr<TensorImpl> Backend::subtract_scalar(const TensorImpl* x, Scalar s, bool scalar_first)
+{
+	Tensor t = brodcastScalar(x, s);
+	return scalar_first ? subtract(t.pimpl(), x) : subtract(x, t.pimpl());
+}
+
+std::shared_ptr<TensorImpl> Backend::div_scalar(const TensorImpl* x, Scalar s, bool scalar_first)
+{
+	Tensor t = brodcastScalar(x, s);
+	return scalar_first ? div(t.pimpl(), x) : div(x, t.pimpl());
+}
+
+std::shared_ptr<TensorImpl> Backend::reduce(const TensorImpl* x, const svector<intmax_t>& dims, ReduceOp op, DType dtype)
+{
+	// Move the reduced dimensions to the back. So they are reduced as chunks of consecutive elements
+	Shape shape;
+	Shape stride;
+	Shape result_shape;
+	intmax_t chunk_size = 1;
+	for(bool reduced : {false, true}) {
+		for(size_t d=0;d<x->dimensions();d++) {
+			if((std::find(dims.begin(), dims.end(), intmax_t(d)) != dims.end()) != reduced)
+				continue;
+			shape.push_back(x->shape()[d]);
+			stride.push_back(x->stride()[d]);
+			if(reduced)
+				chunk_size *= x->shape()[d];
+			else
+				result_shape.push_back(x->shape()[d]);
+		}
+	}
+	if(result_shape.empty())
+		result_shape = {1};
+	Tensor t = realize(std::make_shared<TensorImpl>(x->buffer(), shape, stride, x->offset()).get());
+
+	// There are no ops to build Max, Min and ArgMax from. The chunks are reduced on the host instead
+	if(op == ReduceOp::Max || op == ReduceOp::Min || op == ReduceOp::ArgMax) {
+		et_check(chunk_size != 0, "Cannot reduce 0 elements");
+		DType value_dtype = t.dtype() == DType::Bit ? DType::Bool : t.dtype();
+		// Every other type is exact in float
+		Tensor values = value_dtype == DType::Int32 ? t : t.cast(DType::Float);
+		auto reduceChunks = [&](const auto& host) {
+			using T = typename std::decay_t<decltype(host)>::value_type;
+			std::vector<int32_t> index(host.size()/chunk_size);
+			std::vector<T> extremum(index.size());
+			for(size_t i=0;i<index.size();i++) {
+				auto begin = host.begin()+i*chunk_size;
+				auto it = op == ReduceOp::Min ? std::min_element(begin, begin+chunk_size) : std::max_element(begin, begin+chunk_size);
+				index[i] = int32_t(it-begin);
+				extremum[i] = *it;
+			}
+			if(op == ReduceOp::ArgMax)
+				return Tensor(result_shape, index.data(), this);
+			return Tensor(result_shape, extremum.data(), this).cast(value_dtype);
+		};
+		if(values.dtype() == DType::Int32)
+			return reduceChunks(values.toHost<int32_t>()).shared_pimpl();
+		return reduceChunks(values.toHost<float>()).shared_pimpl();
+	}
+
+	Tensor res;
+	switch(op) {
+		case ReduceOp::Sum: res = sum(t.pimpl(), chunk_size, dtype); break;
+		case ReduceOp::Mean: res = Tensor(sum(t.pimpl(), chunk_size, DType::Float)) / float(chunk_size); break;
+		case ReduceOp::Any: res = Tensor(sum(t.cast(DType::Bool).pimpl(), chunk_size, DType::Int32)) > 0; break;
+		case ReduceOp::All: res = Tensor(sum(t.cast(DType::Bool).pimpl(), chunk_size, DType::Int32)) == chunk_size; break;
+		default: et_assert(false);
+	}
+	if(op == ReduceOp::Mean && dtype != DType::Unknown && dtype != res.dtype())
+		res = res.cast(dtype);
+	return res.reshape(result_shape).shared_pimpl();
+}
@@ -2,6 +2,9 @@
 
 #include <memory>
 #include <string>
+#include <type_traits>
+#include <atomic>
+#include <cstdint>
 
 #include "Shape.hpp"
 #include "DType.hpp"
@@ -16,6 +19,32 @@ namespace et
 
 struct TensorImpl;
 struct Backend;
+struct ExprNode;
+struct RandomStream;
+
+//A scalar operand of binary operations. dtype is the type a tensor holding the value would have. So results are
+//typed the same as when operating on a tensor. Integers are Int32 and floating points are Float
+struct Scalar
+{
+	template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+	Scalar(T v) : value(double(v))
+		, dtype(std::is_same_v<T, bool> ? DType::Bool : std::is_integral_v<T> ? DType::Int32 : DType::Float) {}
+
+	double value;
+	DType dtype;
+};
+
+//Reductions done by Backend::reduce()
+enum class ReduceOp
+{
+	Sum,
+	Mean,
+	Max,
+	Min,
+	ArgMax,
+	Any,
+	All
+};
 
 struct ETALER_EXPORT Backend : public std::enable_shared_from_this<Backend>
 {
@@ -27,12 +56,24 @@ struct ETALER_EXPORT Backend : public std::enable_shared_from_this<Backend>
 	virtual std::shared_ptr<TensorImpl> createTensor(const Shape& shape, DType dtype, const void* data = nullptr) {throw notImplemented("createTensor");};
 
 	virtual void sync() const {} //Default empty implemention. For async backends
+
+	//Random numbers for stochastic kernels (ex: reverseBurst). Every call of a kernel takes a new stream, keyed by the seed
+	//and a step counter. So results are reproducible for a seed no matter how many threads run the kernel. Setting the
+	//seed waits for the queued ops first, so they finish with the old one
+	void setRandomSeed(uint64_t seed) { sync(); random_seed_ = seed; random_step_ = 0; }
+	uint64_t randomSeed() const { return random_seed_; }
+	RandomStream randomStream();
 	virtual std::shared_ptr<TensorImpl> cellActivity(const TensorImpl* x, const TensorImpl* connections,
 		const TensorImpl* permeances, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse=true) {throw notImplemented("overlapScore");}
 	virtual void learnCorrilation(const TensorImpl* x, const TensorImpl* learn,
 		const TensorImpl* connections, TensorImpl* permeances, float perm_inc, float perm_dec
 		, bool has_unconnected_synapse=true) {throw notImplemented("learnCorrilation");}
 	virtual std::shared_ptr<TensorImpl> globalInhibition(const TensorImpl* x, float fraction) {throw notImplemented("globalInhibition");}
+	virtual std::shared_ptr<TensorImpl> localInhibition(const TensorImpl* x, float fraction, size_t radius) {throw notImplemented("localInhibition");}
+	//cellActivity and globalInhibition applied to each x[i] along the first axis. Default to one call per sample
+	virtual std::shared_ptr<TensorImpl> batchCellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances,
+		float connected_permeance, size_t active_threshold, bool has_unconnected_synapse=true);
+	virtual std::shared_ptr<TensorImpl> batchGlobalInhibition(const TensorImpl* x, float fraction);
 	virtual std::shared_ptr<TensorImpl> cast(const TensorImpl* x, DType toType) {throw notImplemented("cast");}
 	virtual void copyToHost(const TensorImpl* pimpl, void* dest) {throw notImplemented("copyToHost");}
 	virtual std::string name() const {return "BaseBackend";}
@@ -43,11 +84,52 @@ struct ETALER_EXPORT Backend : public std::enable_shared_from_this<Backend>
 	virtual void growSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* connections
 		, TensorImpl* permeances, float initial_perm) {throw notImplemented("growSynapses");}
 	virtual void decaySynapses(TensorImpl* connections, TensorImpl* permeances, float threshold) {throw notImplemented("decaySynapses");}
+	//The same operations on synapses stored in the CSR layout of SparseSynapses. rows is Int32 of shape cell_shape + 3,
+	//holding {offset, size, capacity} of each cell's slice of indices and permeances
+	virtual std::shared_ptr<TensorImpl> sparseCellActivity(const TensorImpl* x, const TensorImpl* rows, const TensorImpl* indices
+		, const TensorImpl* permeances, float connected_permeance, size_t active_threshold) {throw notImplemented("sparseCellActivity");}
+	virtual void sparseLearnCorrilation(const TensorImpl* x, const TensorImpl* learn, const TensorImpl* rows, const TensorImpl* indices
+		, TensorImpl* permeances, float perm_inc, float perm_dec) {throw notImplemented("sparseLearnCorrilation");}
+	//Rows running out of capacity are moved, which may replace indices and permeances with larger tensors
+	virtual void sparseGrowSynapses(const TensorImpl* x, const TensorImpl* y, TensorImpl* rows, std::shared_ptr<TensorImpl>& indices
+		, std::shared_ptr<TensorImpl>& permeances, float initial_perm, size_t max_synapses_per_cell) {throw notImplemented("sparseGrowSynapses");}
+	virtual void sparseDecaySynapses(TensorImpl* rows, TensorImpl* indices, TensorImpl* permeances, float threshold) {throw notImplemented("sparseDecaySynapses");}
 	virtual std::shared_ptr<TensorImpl> from(const TensorImpl* x) {throw notImplemented("from");}
+	virtual std::shared_ptr<TensorImpl> flatnonzero(const TensorImpl* x) {throw notImplemented("flatnonzero");}
+	virtual std::shared_ptr<TensorImpl> reverseSynapseIndex(const TensorImpl* connections, const Shape& input_shape) {throw notImplemented("reverseSynapseIndex");}
+	virtual std::shared_ptr<TensorImpl> invertedCellActivity(const TensorImpl* active_bits, const TensorImpl* reverse_index,
+		const TensorImpl* permeances, float connected_permeance, size_t active_threshold) {throw notImplemented("invertedCellActivity");}
+	//Incremental cellActivity. overlaps holds the overlap of each cell (before active_threshold) with the last input. It is
+	//updated in place for the bits that turned on and off (lists of indices). Returns the activity
+	virtual std::shared_ptr<TensorImpl> updateOverlaps(const TensorImpl* turned_on, const TensorImpl* turned_off, const TensorImpl* reverse_index
+		, const TensorImpl* permeances, float connected_permeance, size_t active_threshold, TensorImpl* overlaps) {throw notImplemented("updateOverlaps");}
+	//Recomputes the overlaps of the cells in the boolean mask cells. For after their permanences have changed
+	virtual void recomputeOverlaps(const TensorImpl* x, const TensorImpl* cells, const TensorImpl* connections, const TensorImpl* permeances
+		, float connected_permeance, TensorImpl* overlaps) {throw notImplemented("recomputeOverlaps");}
+	//cellActivity of frozen models. masks is a Bit tensor of shape cell_shape + n holding the input bits each cell has a
+	//connected synapse to. n is the input size rounded up to a multiple of 64, so the mask of every cell starts on a new word
+	virtual std::shared_ptr<TensorImpl> maskCellActivity(const TensorImpl* x, const TensorImpl* masks, size_t active_threshold) {throw notImplemented("maskCellActivity");}
+	//maskCellActivity of every sample in x, of shape [batch] + input_shape. Returns [batch] + cell_shape
+	virtual std::shared_ptr<TensorImpl> batchMaskCellActivity(const TensorImpl* x, const TensorImpl* masks, size_t active_threshold) {throw notImplemented("batchMaskCellActivity");}
+	//Same as maskCellActivity. But the connected input bits are listed in indices. rows is Int32 of shape cell_shape + 2,
+	//holding {offset, size} of each cell's slice of indices
+	virtual std::shared_ptr<TensorImpl> indexCellActivity(const TensorImpl* x, const TensorImpl* rows, const TensorImpl* indices
+		, size_t active_threshold) {throw notImplemented("indexCellActivity");}
+	//cellActivity, boosting, globalInhibition and learnCorrilation in one call. average_activity is nullptr when not boosting.
+	//Defaults to calling the individual operations
+	virtual std::shared_ptr<TensorImpl> spatialPoolerStep(const TensorImpl* x, const TensorImpl* connections, TensorImpl* permeances
+		, const TensorImpl* average_activity, float connected_permeance, size_t active_threshold, float density, float boost_factor
+		, bool learn, float perm_inc, float perm_dec);
 
 	virtual std::shared_ptr<TensorImpl> realize(const TensorImpl* x) {throw notImplemented("realize");}
+	//Computes a lazy elementwise expression. Defaults to calling the operations one by one
+	virtual std::shared_ptr<TensorImpl> evaluate(const ExprNode* expr);
 	virtual void assign(TensorImpl* dest, const TensorImpl* src) {throw notImplemented("assign");}
 	virtual std::shared_ptr<TensorImpl> sum(const TensorImpl* x, size_t chunk_size, DType dtype=DType::Unknown) { throw notImplemented("sum");}
+	//Reduces x along dims (sorted and unique). The result has the remaining dimensions, or is {1} when all of them are
+	//reduced. dtype is the result type of Sum and Mean. ArgMax gives the row-major index within the reduced dimensions.
+	//Defaults to moving the reduced dimensions to the back and calling sum(). Which supports all but Max, Min and ArgMax
+	virtual std::shared_ptr<TensorImpl> reduce(const TensorImpl* x, const svector<intmax_t>& dims, ReduceOp op, DType dtype=DType::Unknown);
 
 	//Unary operations
 	virtual std::shared_ptr<TensorImpl> abs(const TensorImpl* x) { throw notImplemented("abs");}
@@ -68,7 +150,53 @@ struct ETALER_EXPORT Backend : public std::enable_shared_from_this<Backend>
 	virtual std::shared_ptr<TensorImpl> logical_and(const TensorImpl* x1, const TensorImpl* x2) { throw notImplemented("and");}
 	virtual std::shared_ptr<TensorImpl> logical_or(const TensorImpl* x1, const TensorImpl* x2) { throw notImplemented("or");}
 
+	//Binary operations with a scalar as the second operand. Or the first for subtract and div, when scalar_first is set.
+	//Default to brodcasting a 1 element tensor holding the scalar
+	virtual std::shared_ptr<TensorImpl> add_scalar(const TensorImpl* x, Scalar s);
+	virtual std::shared_ptr<TensorImpl> subtract_scalar(const TensorImpl* x, Scalar s, bool scalar_first=false);
+	virtual std::shared_ptr<TensorImpl> mul_scalar(const TensorImpl* x, Scalar s);
+	virtual std::shared_ptr<TensorImpl> div_scalar(const TensorImpl* x, Scalar s, bool scalar_first=false);
+	virtual std::shared_ptr<TensorImpl> equal_scalar(const TensorImpl* x, Scalar s);
+	virtual std::shared_ptr<TensorImpl> greater_scalar(const TensorImpl* x, Scalar s);
+	virtual std::shared_ptr<TensorImpl> lesser_scalar(const TensorImpl* x, Scalar s);
+	virtual std::shared_ptr<TensorImpl> greater_equal_scalar(const TensorImpl* x, Scalar s);
+	virtual std::shared_ptr<TensorImpl> lesser_equal_scalar(const TensorImpl* x, Scalar s);
+	virtual std::shared_ptr<TensorImpl> not_equal_scalar(const TensorImpl* x, Scalar s);
+
+	//Out variants. The result is written into out instead of a new tensor, so buffers can be reused across calls. out
+	//must have the shape of the result and it's dtype is the type of the result (converted as in assign()). out may be
+	//one of the inputs. Default to computing a new tensor and assigning it to out
+	virtual void cellActivity(const TensorImpl* x, const TensorImpl* connections, const TensorImpl* permeances
+		, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse, TensorImpl* out);
+	virtual void cast(const TensorImpl* x, TensorImpl* out);
+	virtual void burst(const TensorImpl* x, const TensorImpl* s, TensorImpl* out);
+	virtual void reverseBurst(const TensorImpl* x, TensorImpl* out);
+	virtual void evaluate(const ExprNode* expr, TensorImpl* out);
+	//out holds the x->size()/chunk_size sums and may have any shape of that volume
+	virtual void sum(const TensorImpl* x, size_t chunk_size, TensorImpl* out);
+
+	virtual void abs(const TensorImpl* x, TensorImpl* out);
+	virtual void exp(const TensorImpl* x, TensorImpl* out);
+	virtual void negate(const TensorImpl* x, TensorImpl* out);
+	virtual void inverse(const TensorImpl* x, TensorImpl* out);
+	virtual void log(const TensorImpl* x, TensorImpl* out);
+	virtual void logical_not(const TensorImpl* x, TensorImpl* out);
+
+	virtual void add(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out);
+	virtual void subtract(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out);
+	virtual void mul(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out);
+	virtual void div(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out);
+	virtual void equal(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out);
+	virtual void greater(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out);
+	virtual void lesser(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out);
+	virtual void logical_and(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out);
+	virtual void logical_or(const TensorImpl* x1, const TensorImpl* x2, TensorImpl* out);
+
 	inline EtError notImplemented(std::string func) const { return EtError(func + " not implemented on backend: " + name()); }
+
+protected:
+	std::atomic<uint64_t> random_seed_ = 42;
+	std::atomic<uint64_t> random_step_ = 0;
 };
 
 }
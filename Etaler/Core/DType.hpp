@@ -5,6 +5,7 @@
 #include <string>
 
 #include "Half.hpp"
+#include "UNorm8.hpp"
 
 namespace et
 {
@@ -16,6 +17,8 @@ enum class DType
 	Int32,
 	Float,
 	Half,
+	Bit, //Packed booleans. 64 elements per uint64_t word. No matching C++ type
+	UNorm8, //8 bit fixed point in [0, 1]. For quantized permanences
 
 	//Aliases
 	Float32 = Float,
@@ -34,6 +37,8 @@ constexpr inline DType typeToDType()
 		return DType::Bool;
 	else if constexpr(std::is_same<T, float16>::value)
 		return DType::Half;
+	else if constexpr(std::is_same<T, unorm8>::value)
+		return DType::UNorm8;
 	else
 		return DType::Unknown;
 }
@@ -48,9 +53,19 @@ inline constexpr size_t dtypeToSize(DType dtype)
 		return sizeof(float);
 	else if(dtype == DType::Half)
 		return sizeof(float16);
+	else if(dtype == DType::UNorm8)
+		return sizeof(unorm8);
 	return std::numeric_limits<size_t>::max();
 }
 
+//Number of bytes needed to store num_elements elements of dtype. Unlike dtypeToSize(), this also handles Bit
+inline constexpr size_t dtypeToBufferSize(DType dtype, size_t num_elements)
+{
+	if(dtype == DType::Bit)
+		return (num_elements+63)/64*sizeof(uint64_t);
+	return num_elements*dtypeToSize(dtype);
+}
+
 inline std::string to_ctype_string(DType dtype)
 {
 	if(dtype == DType::Bool)
@@ -61,6 +76,10 @@ inline std::string to_ctype_string(DType dtype)
 		return "float";
 	else if(dtype == DType::Half)
 		return "half";
+	else if(dtype == DType::Bit)
+		return "bit";
+	else if(dtype == DType::UNorm8)
+		return "unorm8";
 	return "Unknown";
 }
 
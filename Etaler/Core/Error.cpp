@@ -1,4 +1,5 @@
 #include "Error.hpp"
+#include "TensorImpl.hpp"
 using namespace et;
 
 #include <backward.hpp>
@@ -8,6 +9,7 @@ using namespace backward;
 #include <sstream>
 
 static bool g_enable_trace_on_exception = true;
+std::atomic<bool> et::g_property_checks_enabled{true};
 
 ETALER_EXPORT void et::enableTraceOnException(bool enable)
 {
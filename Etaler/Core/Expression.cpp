@@ -0,0 +1,82 @@
+#include "Expression.hpp"
+
+using namespace et;
+
+Expression::Expression(const Tensor& t)
+{
+	et_check(t.has_value(), "Cannot build an expression from an empty tensor");
+	auto node = std::make_shared<ExprNode>();
+	node->op = ExprOp::Tensor;
+	node->shape = t.shape();
+	node->tensor = t;
+	node_ = node;
+}
+
+std::shared_ptr<const ExprNode> Expression::scalarLeaf(Scalar v)
+{
+	auto node = std::make_shared<ExprNode>();
+	node->op = ExprOp::Tensor;
+	node->shape = {1};
+	node->scalar = v;
+	return node;
+}
+
+//The first leaf holding a tensor (not a scalar). Expressions are computed by it's backend
+static const ExprNode* firstTensorLeaf(const ExprNode* node)
+{
+	if(node->op == ExprOp::Tensor)
+		return node->scalar.has_value() ? nullptr : node;
+	if(auto leaf = firstTensorLeaf(node->lhs.get()))
+		return leaf;
+	return node->rhs ? firstTensorLeaf(node->rhs.get()) : nullptr;
+}
+
+Backend* Expression::backend() const
+{
+	const ExprNode* leaf = firstTensorLeaf(node());
+	return leaf != nullptr ? leaf->tensor.backend() : defaultBackend();
+}
+
+Tensor Expression::realize() const
+{
+	if(node_->op == ExprOp::Tensor && node_->scalar.has_value() == false)
+		return node_->tensor;
+	return backend()->evaluate(node());
+}
+
+void Expression::realize(Tensor& out) const
+{
+	if(node_->op == ExprOp::Tensor)
+		out.assign(realize());
+	else
+		backend()->evaluate(node(), out.pimpl());
+}
+
+Expression et::unaryExpression(ExprOp op, const Expression& x)
+{
+	auto node = std::make_shared<ExprNode>();
+	node->op = op;
+	node->shape = x.shape();
+	node->lhs = x.shared_node();
+	return Expression(std::move(node));
+}
+
+Expression et::binaryExpression(ExprOp op, const Expression& x1, const Expression& x2)
+{
+	auto node = std::make_shared<ExprNode>();
+	node->op = op;
+	node->shape = brodcastShape(x1.shape(), x2.shape());
+	node->lhs = x1.shared_node();
+	node->rhs = x2.shared_node();
+	return Expression(std::move(node));
+}
+
+Expression et::cast(const Expression& x, DType dtype)
+{
+	auto node = std::make_shared<ExprNode>();
+	node->op = ExprOp::Cast;
+	node->shape = x.shape();
+	node->dtype = dtype;
+	node->lhs = x.shared_node();
+	return Expression(std::move(node));
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Tensor.hpp"
+
+#include <optional>
+#include <type_traits>
+
+namespace et
+{
+
+enum class ExprOp
+{
+	Tensor,
+	Cast,
+	//Unary operations
+	Abs, Exp, Negate, Inverse, Log, LogicalNot,
+	//Binary operations
+	Add, Subtract, Mul, Div, Equal, Greater, Lesser, LogicalAnd, LogicalOr
+};
+
+//A node of a lazy elementwise expression. Leaves hold the (non-brodcasted) tensors they read
+struct ETALER_EXPORT ExprNode
+{
+	ExprOp op;
+	Shape shape;
+	Tensor tensor; // ExprOp::Tensor only
+	DType dtype = DType::Unknown; // Target type of ExprOp::Cast
+	std::optional<Scalar> scalar; // ExprOp::Tensor made from a C++ scalar. tensor is empty. The evaluating backend creates it if needed
+	std::shared_ptr<const ExprNode> lhs;
+	std::shared_ptr<const ExprNode> rhs;
+};
+
+//Elementwise operations on Expressions are recorded instead of computed. The whole expression is then
+//handed to the backend when realized, so it can be evaluated without creating the intermediate tensors
+struct ETALER_EXPORT Expression
+{
+	Expression(const Tensor& t);
+	template <typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+	explicit Expression(T v) : Expression(scalarLeaf(v)) {}
+	Expression(std::shared_ptr<const ExprNode> node) : node_(std::move(node)) {}
+
+	Shape shape() const {return node_->shape;}
+	Backend* backend() const;
+	const ExprNode* node() const {return node_.get();}
+	std::shared_ptr<const ExprNode> shared_node() const {return node_;}
+
+	Tensor realize() const;
+	//Evaluates into out (converted to it's dtype) instead of a new tensor. out may be read by the expression.
+	//ex: (lazy(x)*0.9f + lazy(y)*0.1f).realize(x); updates x in-place
+	void realize(Tensor& out) const;
+	operator Tensor() const {return realize();}
+
+protected:
+	static std::shared_ptr<const ExprNode> scalarLeaf(Scalar v);
+	std::shared_ptr<const ExprNode> node_;
+};
+
+//Starts a lazy expression. ex: Tensor y = exp(lazy(x)*0.5f + 1.f);
+inline Expression lazy(const Tensor& t) { return Expression(t); }
+
+Expression ETALER_EXPORT unaryExpression(ExprOp op, const Expression& x);
+Expression ETALER_EXPORT binaryExpression(ExprOp op, const Expression& x1, const Expression& x2);
+
+inline Expression abs(const Expression& x) { return unaryExpression(ExprOp::Abs, x); }
+inline Expression exp(const Expression& x) { return unaryExpression(ExprOp::Exp, x); }
+inline Expression negate(const Expression& x) { return unaryExpression(ExprOp::Negate, x); }
+inline Expression inverse(const Expression& x) { return unaryExpression(ExprOp::Inverse, x); }
+inline Expression log(const Expression& x) { return unaryExpression(ExprOp::Log, x); }
+inline Expression logical_not(const Expression& x) { return unaryExpression(ExprOp::LogicalNot, x); }
+Expression ETALER_EXPORT cast(const Expression& x, DType dtype);
+
+inline Expression operator- (const Expression& x) { return negate(x); }
+inline Expression operator! (const Expression& x) { return logical_not(x); }
+
+//Binary operators are enabled when one side is an Expression and the other is an Expression, Tensor or a scalar
+template <typename T1, typename T2>
+constexpr bool is_expression_operands_v = (std::is_same_v<T1, Expression> || std::is_same_v<T2, Expression>)
+	&& (std::is_same_v<T1, Expression> || std::is_same_v<T1, Tensor> || std::is_arithmetic_v<T1>)
+	&& (std::is_same_v<T2, Expression> || std::is_same_v<T2, Tensor> || std::is_arithmetic_v<T2>);
+
+template <typename T1, typename T2>
+using enable_if_expression_operands_t = std::enable_if_t<is_expression_operands_v<std::decay_t<T1>, std::decay_t<T2>>, Expression>;
+
+template <typename T1, typename T2>
+inline enable_if_expression_operands_t<T1, T2> operator+ (const T1& a, const T2& b) { return binaryExpression(ExprOp::Add, Expression(a), Expression(b)); }
+template <typename T1, typename T2>
+inline enable_if_expression_operands_t<T1, T2> operator- (const T1& a, const T2& b) { return binaryExpression(ExprOp::Subtract, Expression(a), Expression(b)); }
+template <typename T1, typename T2>
+inline enable_if_expression_operands_t<T1, T2> operator* (const T1& a, const T2& b) { return binaryExpression(ExprOp::Mul, Expression(a), Expression(b)); }
+template <typename T1, typename T2>
+inline enable_if_expression_operands_t<T1, T2> operator/ (const T1& a, const T2& b) { return binaryExpression(ExprOp::Div, Expression(a), Expression(b)); }
+template <typename T1, typename T2>
+inline enable_if_expression_operands_t<T1, T2> operator== (const T1& a, const T2& b) { return binaryExpression(ExprOp::Equal, Expression(a), Expression(b)); }
+template <typename T1, typename T2>
+inline enable_if_expression_operands_t<T1, T2> operator> (const T1& a, const T2& b) { return binaryExpression(ExprOp::Greater, Expression(a), Expression(b)); }
+template <typename T1, typename T2>
+inline enable_if_expression_operands_t<T1, T2> operator< (const T1& a, const T2& b) { return binaryExpression(ExprOp::Lesser, Expression(a), Expression(b)); }
+template <typename T1, typename T2>
+inline enable_if_expression_operands_t<T1, T2> operator&& (const T1& a, const T2& b) { return binaryExpression(ExprOp::LogicalAnd, Expression(a), Expression(b)); }
+template <typename T1, typename T2>
+inline enable_if_expression_operands_t<T1, T2> operator|| (const T1& a, const T2& b) { return binaryExpression(ExprOp::LogicalOr, Expression(a), Expression(b)); }
+
+inline Tensor realize(const Expression& x) { return x.realize(); }
+
+}
@@ -0,0 +1,170 @@
+#include "Profiler.hpp"
+#include "TensorImpl.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+using namespace et;
+
+std::atomic<bool> et::g_profiling_enabled = false;
+
+namespace
+{
+
+constexpr size_t events_per_thread = 16384;
+
+//Only the owning thread writes to it. So recording needs no locks
+struct ThreadProfile
+{
+	std::vector<ProfileEvent> events = std::vector<ProfileEvent>(events_per_thread);
+	std::atomic<size_t> num_recorded = 0; //Ever since the last clear. Wraps around the ring buffer
+	uint32_t thread_id = 0;
+};
+
+std::mutex g_registry_mutex;
+std::vector<std::shared_ptr<ThreadProfile>> g_thread_profiles;
+
+//Kept alive by the registry after the thread exits. So events of finished threads can still be read
+ThreadProfile& threadProfile()
+{
+	thread_local std::shared_ptr<ThreadProfile> profile = [](){
+		auto p = std::make_shared<ThreadProfile>();
+		std::lock_guard lock(g_registry_mutex);
+		p->thread_id = g_thread_profiles.size();
+		g_thread_profiles.push_back(p);
+		return p;
+	}();
+	return *profile;
+}
+
+//Only counts up. Events take the difference between start and finish
+thread_local size_t t_bytes_allocated = 0;
+
+uint64_t now()
+{
+	static const auto epoch = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+}
+
+void et::recordAllocation(size_t bytes)
+{
+	t_bytes_allocated += bytes;
+}
+
+void ProfileScope::start(const char* name, const TensorImpl* x, int num_threads)
+{
+	if(x == nullptr)
+		start(name, Shape(), DType::Unknown, num_threads);
+	else
+		start(name, x->shape(), x->dtype(), num_threads);
+}
+
+void ProfileScope::start(const char* name, const Shape& shape, DType dtype, int num_threads)
+{
+	event_.name = name;
+	event_.shape = shape;
+	event_.dtype = dtype;
+	event_.num_threads = num_threads;
+	event_.bytes_allocated = t_bytes_allocated;
+	event_.start = now();
+}
+
+void ProfileScope::finish()
+{
+	event_.duration = now() - event_.start;
+	event_.bytes_allocated = t_bytes_allocated - event_.bytes_allocated;
+
+	ThreadProfile& profile = threadProfile();
+	event_.thread_id = profile.thread_id;
+	size_t n = profile.num_recorded.load(std::memory_order_relaxed);
+	profile.events[n%events_per_thread] = std::move(event_);
+	profile.num_recorded.store(n+1, std::memory_order_release);
+}
+
+std::vector<ProfileEvent> et::profileEvents()
+{
+	std::vector<ProfileEvent> res;
+	std::lock_guard lock(g_registry_mutex);
+	for(const auto& profile : g_thread_profiles) {
+		size_t n = profile->num_recorded.load(std::memory_order_acquire);
+		for(size_t i=n-std::min(n, events_per_thread);i<n;i++)
+			res.push_back(profile->events[i%events_per_thread]);
+	}
+	std::sort(res.begin(), res.end(), [](const auto& a, const auto& b) {return a.start < b.start;});
+	return res;
+}
+
+void et::clearProfile()
+{
+	std::lock_guard lock(g_registry_mutex);
+	for(const auto& profile : g_thread_profiles)
+		profile->num_recorded.store(0, std::memory_order_release);
+}
+
+std::string et::chromeTrace()
+{
+	std::stringstream ss;
+	ss << std::fixed << std::setprecision(3);
+	ss << "{\"traceEvents\": [";
+	auto events = profileEvents();
+	for(size_t i=0;i<events.size();i++) {
+		const auto& e = events[i];
+		ss << (i == 0 ? "\n" : ",\n") << "{\"name\": \"" << e.name << "\", \"cat\": \"etaler\", \"ph\": \"X\""
+			<< ", \"ts\": " << e.start/1000.0 << ", \"dur\": " << e.duration/1000.0
+			<< ", \"pid\": 0, \"tid\": " << e.thread_id
+			<< ", \"args\": {\"shape\": \"" << to_string(e.shape) << "\", \"dtype\": \"" << to_string(e.dtype)
+			<< "\", \"bytes_allocated\": " << e.bytes_allocated << ", \"num_threads\": " << e.num_threads << "}}";
+	}
+	ss << "\n], \"displayTimeUnit\": \"ms\"}\n";
+	return ss.str();
+}
+
+void et::saveChromeTrace(const std::string& path)
+{
+	std::ofstream out(path);
+	et_check(out.good(), "Cannot open " + path + " for writing");
+	out << chromeTrace();
+}
+
+std::string et::profileSummary()
+{
+	struct OpSummary
+	{
+		size_t calls = 0;
+		uint64_t total = 0;
+		uint64_t max = 0;
+		size_t bytes_allocated = 0;
+	};
+	std::map<std::string, OpSummary> ops;
+	for(const auto& e : profileEvents()) {
+		auto& op = ops[e.name];
+		op.calls += 1;
+		op.total += e.duration;
+		op.max = std::max(op.max, e.duration);
+		op.bytes_allocated += e.bytes_allocated;
+	}
+
+	std::vector<std::pair<std::string, OpSummary>> rows(ops.begin(), ops.end());
+	std::sort(rows.begin(), rows.end(), [](const auto& a, const auto& b) {return a.second.total > b.second.total;});
+
+	// Nested ops are counted in their parent's time too
+	std::stringstream ss;
+	ss << std::left << std::setw(28) << "op" << std::right << std::setw(10) << "calls" << std::setw(14) << "total (ms)"
+		<< std::setw(14) << "mean (us)" << std::setw(14) << "max (us)" << std::setw(16) << "allocated (KB)" << "\n";
+	ss << std::fixed << std::setprecision(3);
+	for(const auto& [name, op] : rows) {
+		ss << std::left << std::setw(28) << name << std::right << std::setw(10) << op.calls
+			<< std::setw(14) << op.total/1e6 << std::setw(14) << op.total/1e3/op.calls << std::setw(14) << op.max/1e3
+			<< std::setw(16) << op.bytes_allocated/1024.0 << "\n";
+	}
+	return ss.str();
+}
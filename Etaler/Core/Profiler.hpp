@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Shape.hpp"
+#include "DType.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Etaler_export.h"
+
+namespace et
+{
+
+struct TensorImpl;
+
+//A backend op recorded while profiling. Times are in nanoseconds since the program started
+struct ProfileEvent
+{
+	const char* name = nullptr;
+	Shape shape; //Of the first input
+	DType dtype = DType::Unknown;
+	uint64_t start = 0;
+	uint64_t duration = 0;
+	size_t bytes_allocated = 0; //By the thread running the op. Nested ops included
+	uint32_t thread_id = 0;
+	int num_threads = 0; //Threads the op could run on
+};
+
+extern ETALER_EXPORT std::atomic<bool> g_profiling_enabled;
+
+//Profiling is off by default. Checking for it is a single atomic load. So leaving the hooks in costs next to nothing
+inline void enableProfiling(bool enable) {g_profiling_enabled.store(enable, std::memory_order_relaxed);}
+inline bool profilingEnabled() {return g_profiling_enabled.load(std::memory_order_relaxed);}
+
+//Events are kept in a ring buffer per thread, holding the latest 16384 ops of it. These functions shall not be called
+//while other threads are running backend ops
+ETALER_EXPORT std::vector<ProfileEvent> profileEvents();
+ETALER_EXPORT void clearProfile();
+//Chrome trace_event JSON. Open it in chrome://tracing or Perfetto
+ETALER_EXPORT std::string chromeTrace();
+ETALER_EXPORT void saveChromeTrace(const std::string& path);
+//A table of the calls, total, mean and max time and memory allocated by each op. Sorted by the total time
+ETALER_EXPORT std::string profileSummary();
+
+ETALER_EXPORT void recordAllocation(size_t bytes);
+//Called by the backends when allocating memory
+inline void profileAllocation(size_t bytes)
+{
+	if(profilingEnabled())
+		recordAllocation(bytes);
+}
+
+//Records the time from construction to destruction as an event. Backends create one at the start of each op
+struct ETALER_EXPORT ProfileScope
+{
+	ProfileScope(const char* name, const TensorImpl* x, int num_threads=1)
+	{
+		if(profilingEnabled())
+			start(name, x, num_threads);
+	}
+	ProfileScope(const char* name, const Shape& shape, DType dtype, int num_threads=1)
+	{
+		if(profilingEnabled())
+			start(name, shape, dtype, num_threads);
+	}
+	~ProfileScope()
+	{
+		if(event_.name != nullptr)
+			finish();
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator= (const ProfileScope&) = delete;
+
+protected:
+	void start(const char* name, const TensorImpl* x, int num_threads);
+	void start(const char* name, const Shape& shape, DType dtype, int num_threads);
+	void finish();
+
+	ProfileEvent event_;
+};
+
+}
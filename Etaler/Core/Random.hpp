@@ -2,4 +2,33 @@
 
 #include "Etaler/3rdparty/pcg-cpp/include/pcg_random.hpp"
 #include "Etaler/3rdparty/pcg-cpp/include/pcg_extras.hpp"
-#include <random>
\ No newline at end of file
+#include <random>
+#include <cstdint>
+
+namespace et
+{
+
+//Counter-based random numbers for parallel kernels. The numbers are a function of (seed, step, key) only. Kernels take
+//a generator per piece of work (ex: a column) instead of sharing one across threads. So no state is shared and the
+//results don't depend on how the work is split between threads
+struct RandomStream
+{
+	RandomStream(uint64_t seed, uint64_t step) : key_(mix(seed ^ mix(step))) {}
+
+	//An independent generator for key
+	pcg32 generator(uint64_t key) const { return pcg32(mix(key_ ^ mix(key))); }
+
+	//splitmix64's finalizer. Spreads every bit of x over the result
+	static uint64_t mix(uint64_t x)
+	{
+		x += 0x9e3779b97f4a7c15;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+		return x ^ (x >> 31);
+	}
+
+private:
+	uint64_t key_;
+};
+
+}
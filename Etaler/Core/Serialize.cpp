@@ -1,10 +1,23 @@
 #include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <functional>
 
 #include "Serialize.hpp"
 
 #include "Etaler/Core/Tensor.hpp"
+#include "Etaler/Core/DefaultBackend.hpp"
+#include "Etaler/Backends/CPUBackend.hpp"
 #include "TypeHelpers.hpp"
 
+#if __has_include(<sys/mman.h>)
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+	#define ETALER_HAS_MMAP
+#endif
+
 #include <cereal/cereal.hpp>
 #include <cereal/types/vector.hpp>
 #include <cereal/types/string.hpp>
@@ -13,6 +26,18 @@
 
 using namespace et;
 
+namespace et::detail
+{
+//In the native (.etm) format tensor data is not stored in the archive. Instead the archive only holds an id
+//and the data is placed (aligned) in the payload section of the file
+struct TensorPayloads
+{
+	std::vector<Tensor> tensors; // Tensors to write. The id is the index
+	std::function<Tensor(uint64_t, const Shape&, DType)> load; // Creates the tensor of a given id
+};
+static thread_local TensorPayloads* g_tensor_payloads = nullptr;
+}
+
 namespace cereal
 {
 
@@ -58,6 +83,10 @@ void save(Archive & archive, Tensor const & t)
 			return "int32";
 		if(t.dtype() == DType::Half)
 			return "half";
+		if(t.dtype() == DType::Bit)
+			return "bit";
+		if(t.dtype() == DType::UNorm8)
+			return "unorm8";
 
 		throw EtError("Cannot handle such dtype()");
 	}();
@@ -65,6 +94,11 @@ void save(Archive & archive, Tensor const & t)
 
 	archive(make_nvp("shape", t.shape()));
 	archive(make_nvp("dtype", dtype));
+	if(auto payloads = et::detail::g_tensor_payloads; payloads != nullptr) {
+		archive(make_nvp("payload", uint64_t(payloads->tensors.size())));
+		payloads->tensors.push_back(t);
+		return;
+	}
 	if(t.dtype() == DType::Bool) {
 		std::vector<uint8_t> arr = t.toHost<uint8_t>();
 		archive(make_nvp("data", arr));
@@ -81,6 +115,13 @@ void save(Archive & archive, Tensor const & t)
 		std::vector<half> arr = t.toHost<half>();
 		archive(make_nvp("data", arr));
 	}
+	else if(t.dtype() == DType::Bit || t.dtype() == DType::UNorm8) {
+		// Stored as raw bytes, the same way as in memory
+		Tensor q = ravel(t);
+		std::vector<uint8_t> arr(dtypeToBufferSize(t.dtype(), q.size()));
+		q.backend()->copyToHost(q.pimpl(), arr.data());
+		archive(make_nvp("data", arr));
+	}
 }
 
 template <class Archive>
@@ -92,6 +133,28 @@ void load(Archive & archive, Tensor & t)
 	std::string dtype;
 	archive(make_nvp("dtype", dtype));
 
+	if(auto payloads = et::detail::g_tensor_payloads; payloads != nullptr) {
+		uint64_t id;
+		archive(make_nvp("payload", id));
+		DType type = [&dtype]() {
+			if(dtype == "uint8")
+				return DType::Bool;
+			if(dtype == "float")
+				return DType::Float;
+			if(dtype == "int32")
+				return DType::Int32;
+			if(dtype == "half")
+				return DType::Half;
+			if(dtype == "bit")
+				return DType::Bit;
+			if(dtype == "unorm8")
+				return DType::UNorm8;
+			throw EtError("Cannot handle dtype " + dtype);
+		}();
+		t = payloads->load(id, s, type);
+		return;
+	}
+
 	if(dtype == "uint8") {
 		std::vector<uint8_t> d(s.volume());
 		archive(make_nvp("data", d));
@@ -112,6 +175,16 @@ void load(Archive & archive, Tensor & t)
 		archive(make_nvp("data", d));
 		t = Tensor(s, d.data());
 	}
+	else if(dtype == "bit") {
+		std::vector<uint8_t> d(dtypeToBufferSize(DType::Bit, s.volume()));
+		archive(make_nvp("data", d));
+		t = defaultBackend()->createTensor(s, DType::Bit, d.data());
+	}
+	else if(dtype == "unorm8") {
+		std::vector<uint8_t> d(s.volume());
+		archive(make_nvp("data", d));
+		t = defaultBackend()->createTensor(s, DType::UNorm8, d.data());
+	}
 }
 
 template <class Archive>
@@ -274,11 +347,184 @@ static std::string fileExtenstion(std::string path)
 	return "";
 }
 
+// Layout of the native format. All integers are in the byte order of the machine that saved the file
+// [0, 8)   magic "ETALERSD"
+// [8, 12)  format version
+// [12, 16) byte order mark (0x01020304)
+// [16, 24) offset of the index
+// [24, 32) size of the index
+// [64, ...) tensor payloads, each aligned to payload_alignment bytes
+// [index offset, ...) the index. A portable binary archive of the payload offsets and the StateDict
+namespace et::detail
+{
+static constexpr char native_magic[8] = {'E', 'T', 'A', 'L', 'E', 'R', 'S', 'D'};
+static constexpr uint32_t native_version = 1;
+static constexpr uint32_t native_byte_order = 0x01020304;
+static constexpr size_t native_header_size = 64;
+static constexpr size_t payload_alignment = 64;
+
+struct NativeHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t index_offset;
+	uint64_t index_size;
+};
+
+//Sets g_tensor_payloads for the lifetime of the object
+struct PayloadScope
+{
+	PayloadScope(TensorPayloads* payloads) { g_tensor_payloads = payloads; }
+	~PayloadScope() { g_tensor_payloads = nullptr; }
+};
+
+static void saveNative(const StateDict& dict, const std::string& path)
+{
+	TensorPayloads payloads;
+	std::stringstream index_stream;
+	{
+		PayloadScope scope(&payloads);
+		cereal::PortableBinaryOutputArchive ar(index_stream);
+		ar(dict);
+	}
+
+	// Write to a temporary file and then replace the original. So tensors currently mapped from the
+	// original file stay valid
+	std::string tmp_path = path + ".tmp";
+	std::ofstream out(tmp_path, std::ios::binary);
+	if(out.good() == false)
+		throw EtError("Cannot open " + tmp_path + " for writing");
+
+	std::vector<uint64_t> offsets;
+	offsets.reserve(payloads.tensors.size());
+	uint64_t pos = native_header_size;
+	out.seekp(pos);
+	for(const Tensor& tensor : payloads.tensors) {
+		uint64_t aligned = (pos+payload_alignment-1)/payload_alignment*payload_alignment;
+		out.seekp(aligned);
+		offsets.push_back(aligned);
+
+		Tensor t = ravel(tensor);
+		size_t nbytes = dtypeToBufferSize(t.dtype(), t.size());
+		if(t.data() != nullptr)
+			out.write((const char*)t.data(), nbytes);
+		else {
+			std::vector<char> buffer(nbytes);
+			t.backend()->copyToHost(t.pimpl(), buffer.data());
+			out.write(buffer.data(), nbytes);
+		}
+		pos = aligned + nbytes;
+	}
+
+	std::stringstream table_stream;
+	{
+		cereal::PortableBinaryOutputArchive ar(table_stream);
+		ar(offsets);
+	}
+	std::string index = table_stream.str() + index_stream.str();
+	out.seekp(pos);
+	out.write(index.data(), index.size());
+
+	NativeHeader header;
+	std::copy(std::begin(native_magic), std::end(native_magic), header.magic);
+	header.version = native_version;
+	header.byte_order = native_byte_order;
+	header.index_offset = pos;
+	header.index_size = index.size();
+	out.seekp(0);
+	out.write((const char*)&header, sizeof(header));
+	out.close();
+	if(out.fail())
+		throw EtError("Failed to write " + tmp_path);
+
+	std::filesystem::rename(tmp_path, path);
+}
+
+static StateDict loadNative(const std::string& path)
+{
+	std::ifstream in(path, std::ios::binary);
+	if(in.good() == false)
+		throw EtError("Cannot open " + path);
+
+	NativeHeader header;
+	in.read((char*)&header, sizeof(header));
+	if(in.fail() || std::equal(std::begin(native_magic), std::end(native_magic), header.magic) == false)
+		throw EtError(path + " is not a Etaler model file");
+	if(header.byte_order != native_byte_order)
+		throw EtError(path + " is saved on a machine with a different byte order");
+	if(header.version != native_version)
+		throw EtError(path + " is saved in an unsupported version " + std::to_string(header.version));
+
+	std::string index(header.index_size, '\0');
+	in.seekg(header.index_offset);
+	in.read(index.data(), index.size());
+	if(in.fail())
+		throw EtError(path + " is truncated");
+	const uint64_t file_size = header.index_offset + header.index_size;
+
+	// The index is the payload offsets followed by the StateDict. Each written by it's own archive
+	std::istringstream index_stream(index);
+	std::vector<uint64_t> offsets;
+	{
+		cereal::PortableBinaryInputArchive ar(index_stream);
+		ar(offsets);
+	}
+
+	// On the CPU backend, tensors are backed by a private mapping of the file. Pages are only read when accessed
+	// and modifying them makes a private copy (the file is never written to)
+	std::shared_ptr<void> mapping;
+	auto cpu = dynamic_cast<CPUBackend*>(defaultBackend());
+#ifdef ETALER_HAS_MMAP
+	if(cpu != nullptr && offsets.empty() == false) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if(fd != -1) {
+			void* ptr = mmap(nullptr, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			close(fd);
+			if(ptr != MAP_FAILED)
+				mapping = std::shared_ptr<void>(ptr, [file_size](void* p) { munmap(p, file_size); });
+		}
+	}
+#endif
+
+	TensorPayloads payloads;
+	payloads.load = [&](uint64_t id, const Shape& shape, DType dtype) -> Tensor {
+		if(id >= offsets.size())
+			throw EtError(path + " references a non-existing tensor");
+		size_t nbytes = dtypeToBufferSize(dtype, shape.volume());
+		if(offsets[id] + nbytes > header.index_offset)
+			throw EtError(path + " is corrupted. Tensor data out of range");
+
+		if(mapping)
+			return cpu->wrapTensor(shape, dtype, (char*)mapping.get()+offsets[id], mapping);
+		// Fallback. Read into a new tensor
+		std::vector<char> buffer(nbytes);
+		in.seekg(offsets[id]);
+		in.read(buffer.data(), nbytes);
+		if(in.fail() || in.gcount() != std::streamsize(nbytes))
+			throw EtError(path + " is corrupted. Cannot read tensor data");
+		return defaultBackend()->createTensor(shape, dtype, buffer.data());
+	};
+
+	StateDict dict;
+	PayloadScope scope(&payloads);
+	cereal::PortableBinaryInputArchive ar(index_stream);
+	ar(dict);
+	return dict;
+}
+
+}
+
 void et::save(const StateDict& dict, const std::string& path)
 {
+	std::string ext = fileExtenstion(path);
+	if(ext == "etm") {
+		detail::saveNative(dict, path);
+		return;
+	}
+
 	std::ofstream out(path, std::ios::binary);
 
-	std::string ext = fileExtenstion(path);
 	if(ext == "json") {
 		cereal::JSONOutputArchive ar(out);
 		ar(dict);
@@ -292,10 +538,13 @@ void et::save(const StateDict& dict, const std::string& path)
 
 StateDict et::load(const std::string& path)
 {
+	std::string ext = fileExtenstion(path);
+	if(ext == "etm")
+		return detail::loadNative(path);
+
 	std::ifstream in(path, std::ios::binary);
 	StateDict dict;
 
-	std::string ext = fileExtenstion(path);
 	if(ext == "json") {
 		cereal::JSONInputArchive ar(in);
 		ar(dict);
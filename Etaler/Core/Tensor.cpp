@@ -1,6 +1,7 @@
 #include "Tensor.hpp"
 
 #include <sstream>
+#include <algorithm>
 
 using namespace et;
 using std::size_t; //Surpress VSCode warnings
@@ -136,10 +137,17 @@ std::ostream& et::operator<< (std::ostream& os, const Tensor& t)
 		return os;
 	}
 
+	// Bits are printed as bools
+	if(t.dtype() == DType::Bit)
+		return os << t.cast(DType::Bool);
+	// And fixed point numbers as floats
+	if(t.dtype() == DType::UNorm8)
+		return os << t.cast(DType::Float);
+
 	const Tensor q = ravel(t);
 	const void* ptr = q.data();
 	if(ptr == nullptr) { // If direct access of the values is not possible
-		void* buffer = malloc(q.size()*dtypeToSize(q.dtype()));
+		void* buffer = malloc(dtypeToBufferSize(q.dtype(), q.size()));
 		q.backend()->copyToHost(q.pimpl(), buffer);
 		printTensor(os, buffer, q.shape(), q.dtype());
 		free(buffer);
@@ -259,6 +267,10 @@ Tensor et::zeros(const Shape& shape, DType dtype, Backend* backend)
 		return constant<float>(shape, 0, backend);
 	else if(dtype == DType::Half)
 		return constant<half>(shape, half(0), backend);
+	else if(dtype == DType::UNorm8)
+		return constant<unorm8>(shape, unorm8(0.f), backend);
+	else if(dtype == DType::Bit)
+		return constant<uint8_t>(shape, 0, backend).cast(DType::Bit);
 	else
 		throw EtError("Cannot creatr a tensor of zeros of type " + to_ctype_string(dtype));
 }
@@ -273,45 +285,44 @@ Tensor et::ones(const Shape& shape, DType dtype, Backend* backend)
 		return constant<float>(shape, 1, backend);
 	else if(dtype == DType::Half)
 		return constant<half>(shape, half(1), backend);
+	else if(dtype == DType::UNorm8)
+		return constant<unorm8>(shape, unorm8(1.f), backend);
+	else if(dtype == DType::Bit)
+		return constant<uint8_t>(shape, 1, backend).cast(DType::Bit);
 	else
 		throw EtError("Cannot creatr a tensor of ones of type " + to_ctype_string(dtype));
 }
 
-Tensor Tensor::sum(std::optional<intmax_t> dim_id, DType dtype) const
+Tensor Tensor::reduce(ReduceOp op, const svector<intmax_t>& dims, DType dtype) const
 {
-	// HACK: Special case for 0D tensor
+	// A 0D tensor is reduced as a tensor of 1 element
 	if(dimensions() == 0)
-		return this->cast(this->dtype() == DType::Bool ? DType::Int : this->dtype());
-
-	et_check(dim_id.value_or(0) < (intmax_t)dimensions()
-		, "Dim " + std::to_string(dim_id.value_or(0)) + " is out of range");
-
-	// dim_id has no value means sum the entire tensor
-	if(dim_id.has_value() == false)
-		return backend()->sum(pimpl(), size(), dtype);
-
-	intmax_t dim = dim_id.value();
-	// negative index means counting from back
-	dim = dim < 0 ? dimensions() + dim : dim;
-	if(dim >= (intmax_t)dimensions() || dim < 0)
-		throw EtError("Dimension " + std::to_string(dim_id.value()) + " is out of range.");
-
-	Shape final_shape = shape();
-	final_shape.erase(final_shape.begin() + dim);
-	intmax_t sum_size = shape()[dim];
-	Shape result_shape = shape();
-	result_shape[dim] = result_shape[result_shape.size()-1];
-	result_shape.pop_back();
-
-	if(size_t(dim) == dimensions()-1) { //Special, optimized case for summing the last dim
-		Tensor res = backend()->sum(pimpl(), shape().back(), dtype);
-		res.resize(final_shape);
-		return res;
+		return reshape({1}).reduce(op, {0}, dtype);
+
+	svector<intmax_t> reduced;
+	for(intmax_t d : dims) {
+		// negative index means counting from back
+		intmax_t dim = d < 0 ? dimensions() + d : d;
+		if(dim >= (intmax_t)dimensions() || dim < 0)
+			throw EtError("Dimension " + std::to_string(d) + " is out of range.");
+		reduced.push_back(dim);
+	}
+	std::sort(reduced.begin(), reduced.end());
+	reduced.erase(std::unique(reduced.begin(), reduced.end()), reduced.end());
+
+	// No dims means reducing everything into a {1} tensor
+	if(dims.empty()) {
+		for(size_t d=0;d<dimensions();d++)
+			reduced.push_back(d);
+		return backend()->reduce(pimpl(), reduced, op, dtype);
 	}
 
-	Tensor res = backend()->sum(swapaxis(dimensions()-1, dim).realize().pimpl(), sum_size, dtype);
+	Shape result_shape = shape();
+	for(auto it=reduced.rbegin();it!=reduced.rend();it++)
+		result_shape.erase(result_shape.begin() + *it);
+	Tensor res = backend()->reduce(pimpl(), reduced, op, dtype);
 	res.resize(result_shape);
-	return res.swapaxis(res.shape().size()-1, dim).reshape(final_shape);
+	return res;
 }
 
 Tensor et::sum(const Tensor& x, std::optional<intmax_t> dim, DType dtype)
@@ -319,6 +330,19 @@ Tensor et::sum(const Tensor& x, std::optional<intmax_t> dim, DType dtype)
 	return x.sum(dim, dtype);
 }
 
+void et::sum(const Tensor& x, std::optional<intmax_t> dim, Tensor& out)
+{
+	// The backend sums chunks of consecutive elements into out. Other dimensions are summed with a temporary
+	intmax_t last = intmax_t(x.dimensions())-1;
+	if(x.dimensions() == 0 || (dim.has_value() && dim.value() != last && dim.value() != -1)) {
+		out.assign(x.sum(dim, out.dtype()));
+		return;
+	}
+
+	size_t chunk_size = dim.has_value() ? x.shape().back() : x.size();
+	x.backend()->sum(ravel(x).pimpl(), chunk_size, out.pimpl());
+}
+
 Tensor et::cat(const svector<Tensor>& tensors, intmax_t dim)
 {
 	if(tensors.size() == 0)
@@ -414,13 +438,16 @@ Tensor et::brodcast_to(const Tensor& t, Shape s)
 	return std::make_shared<TensorImpl>(t.shared_pimpl()->buffer(), s, stride, t.pimpl()->offset());
 }
 
-std::pair<Tensor, Tensor> et::brodcast_tensors(const Tensor& a, const Tensor& b)
+Shape et::brodcastShape(const Shape& a, const Shape& b)
 {
-	if(brodcastable(a.shape(), b.shape()) == false)
-		throw EtError("Cannot brodcast " + to_string(a.shape()) + " and " + to_string(b.shape()) + " together.");
-
-	Shape result_shape = brodcast_result_shape(a.shape(), b.shape());
+	if(brodcastable(a, b) == false)
+		throw EtError("Cannot brodcast " + to_string(a) + " and " + to_string(b) + " together.");
+	return brodcast_result_shape(a, b);
+}
 
+std::pair<Tensor, Tensor> et::brodcast_tensors(const Tensor& a, const Tensor& b)
+{
+	Shape result_shape = brodcastShape(a.shape(), b.shape());
         return {brodcast_to(a, result_shape), brodcast_to(b, result_shape)};
 }
 
@@ -428,3 +455,12 @@ std::pair<Tensor, Tensor> Tensor::brodcast(const Tensor& other) const
 {
 	return brodcast_tensors(*this, other);
 }
+
+Tensor Tensor::brodcastInto(const Tensor& other) const
+{
+	if(other.shape() == shape())
+		return other;
+	et_check(brodcastShape(shape(), other.shape()) == shape(), "Cannot brodcast " + to_string(other.shape())
+		+ " into a tensor of shape " + to_string(shape()));
+	return brodcast_to(other, shape());
+}
@@ -116,7 +116,14 @@ struct ETALER_EXPORT Tensor
 
 
 	template <typename ImplType=TensorImpl>
-	const ImplType* pimpl() const {return dynamic_cast<const ImplType*>(pimpl_.get());}
+	const ImplType* pimpl() const
+	{
+		//Skip the dynamic_cast for the common case. It is called for every op
+		if constexpr(std::is_same_v<ImplType, TensorImpl>)
+			return pimpl_.get();
+		else
+			return dynamic_cast<const ImplType*>(pimpl_.get());
+	}
 
 	template <typename ImplType=TensorImpl>
 	TensorImpl* pimpl() {return call_const(pimpl<ImplType>);}
@@ -248,8 +255,23 @@ struct ETALER_EXPORT Tensor
 	Tensor logical_and(const Tensor& other) const { auto [a, b] = brodcast(other); return backend()->logical_and(a.pimpl(), b.pimpl()); }
 	Tensor logical_or(const Tensor& other) const { auto [a, b] = brodcast(other); return backend()->logical_or(a.pimpl(), b.pimpl()); }
 
-	inline bool any() const { return cast(DType::Bool).sum(std::nullopt, DType::Bool).item<uint8_t>(); }
-	inline bool all() const { return cast(DType::Bool).sum(std::nullopt).item<int32_t>() == int32_t(size()); }
+	//In-place operations. The result is written into the buffer of this tensor (converted to it's dtype) instead of a new
+	//tensor. Unlike operator+= and friends, which rebind to a new tensor and leave other handles to the old data untouched
+	Tensor& add_(const Tensor& other) { backend()->add(pimpl(), brodcastInto(other).pimpl(), pimpl()); return *this; }
+	Tensor& subtract_(const Tensor& other) { backend()->subtract(pimpl(), brodcastInto(other).pimpl(), pimpl()); return *this; }
+	Tensor& mul_(const Tensor& other) { backend()->mul(pimpl(), brodcastInto(other).pimpl(), pimpl()); return *this; }
+	Tensor& div_(const Tensor& other) { backend()->div(pimpl(), brodcastInto(other).pimpl(), pimpl()); return *this; }
+
+	//Casts to the dtype of out and writes the result into it. out must have the same shape
+	void cast_into(Tensor& out) const
+	{
+		if(iscontiguous() == false)
+			return realize().cast_into(out);
+		backend()->cast(pimpl(), out.pimpl());
+	}
+
+	inline bool any() const { return reduce(ReduceOp::Any).item<uint8_t>(); }
+	inline bool all() const { return reduce(ReduceOp::All).item<uint8_t>(); }
 
 	// Neumeric operations
 	Tensor operator+= (const Tensor& other) { *this = *this + other; return *this; }
@@ -282,7 +304,15 @@ struct ETALER_EXPORT Tensor
 	template <typename ... Args>
 	Tensor operator () (Args ... args) { return view({args ...}); }
 
-	Tensor sum(std::optional<intmax_t> dim=std::nullopt, DType dtype=DType::Unknown) const;
+	//Reduces along dims, or every dimension when empty. Negative dims count from the back
+	Tensor reduce(ReduceOp op, const svector<intmax_t>& dims={}, DType dtype=DType::Unknown) const;
+	Tensor sum(std::optional<intmax_t> dim=std::nullopt, DType dtype=DType::Unknown) const { return reduce(ReduceOp::Sum, reduceDims(dim), dtype); }
+	Tensor mean(std::optional<intmax_t> dim=std::nullopt, DType dtype=DType::Unknown) const { return reduce(ReduceOp::Mean, reduceDims(dim), dtype); }
+	Tensor max(std::optional<intmax_t> dim=std::nullopt) const { return reduce(ReduceOp::Max, reduceDims(dim)); }
+	Tensor min(std::optional<intmax_t> dim=std::nullopt) const { return reduce(ReduceOp::Min, reduceDims(dim)); }
+	Tensor argmax(std::optional<intmax_t> dim=std::nullopt) const { return reduce(ReduceOp::ArgMax, reduceDims(dim)); }
+	Tensor any(intmax_t dim) const { return reduce(ReduceOp::Any, {dim}); }
+	Tensor all(intmax_t dim) const { return reduce(ReduceOp::All, {dim}); }
 	Tensor abs() const { return backend()->abs(pimpl()); }
 	bool isSame (const Tensor& other) const;
 
@@ -302,34 +332,54 @@ struct ETALER_EXPORT Tensor
 	bool has_value() const {return (bool)pimpl_ && size() > 0;}
 
 	std::pair<Tensor, Tensor> brodcast(const Tensor& other) const;
+	//other brodcasted to the shape of this tensor. For in-place operations
+	Tensor brodcastInto(const Tensor& other) const;
 
 protected:
+	static svector<intmax_t> reduceDims(std::optional<intmax_t> dim) { return dim.has_value() ? svector<intmax_t>{*dim} : svector<intmax_t>{}; }
+
 	std::shared_ptr<TensorImpl> pimpl_;
 };
 
+//Operations with scalars are computed by the backend of the tensor directly. Without creating a tensor holding the scalar
 template <typename ScalarType>
-inline Tensor operator+ (ScalarType v, const Tensor& t)
-{
-	return Tensor(v)+t;
-}
+using enable_if_scalar_t = std::enable_if_t<std::is_arithmetic_v<ScalarType>, Tensor>;
 
 template <typename ScalarType>
-inline Tensor operator- (ScalarType v, const Tensor& t)
-{
-	return Tensor(v)-t;
-}
-
+inline enable_if_scalar_t<ScalarType> operator+ (const Tensor& t, ScalarType v) { return t.backend()->add_scalar(t.pimpl(), v); }
 template <typename ScalarType>
-inline Tensor operator* (ScalarType v, const Tensor& t)
-{
-	return Tensor(v)*t;
-}
+inline enable_if_scalar_t<ScalarType> operator- (const Tensor& t, ScalarType v) { return t.backend()->subtract_scalar(t.pimpl(), v); }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator* (const Tensor& t, ScalarType v) { return t.backend()->mul_scalar(t.pimpl(), v); }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator/ (const Tensor& t, ScalarType v) { return t.backend()->div_scalar(t.pimpl(), v); }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator== (const Tensor& t, ScalarType v) { return t.backend()->equal_scalar(t.pimpl(), v); }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator> (const Tensor& t, ScalarType v) { return t.backend()->greater_scalar(t.pimpl(), v); }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator< (const Tensor& t, ScalarType v) { return t.backend()->lesser_scalar(t.pimpl(), v); }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator<= (const Tensor& t, ScalarType v) { return t.backend()->lesser_equal_scalar(t.pimpl(), v); }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator>= (const Tensor& t, ScalarType v) { return t.backend()->greater_equal_scalar(t.pimpl(), v); }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator!= (const Tensor& t, ScalarType v) { return t.backend()->not_equal_scalar(t.pimpl(), v); }
 
 template <typename ScalarType>
-inline Tensor operator/ (ScalarType v, const Tensor& t)
-{
-	return Tensor(v)/t;
-}
+inline enable_if_scalar_t<ScalarType> operator+ (ScalarType v, const Tensor& t) { return t + v; }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator- (ScalarType v, const Tensor& t) { return t.backend()->subtract_scalar(t.pimpl(), v, true); }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator* (ScalarType v, const Tensor& t) { return t * v; }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator/ (ScalarType v, const Tensor& t) { return t.backend()->div_scalar(t.pimpl(), v, true); }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator== (ScalarType v, const Tensor& t) { return t == v; }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator> (ScalarType v, const Tensor& t) { return t < v; }
+template <typename ScalarType>
+inline enable_if_scalar_t<ScalarType> operator< (ScalarType v, const Tensor& t) { return t > v; }
 
 //Procedural  APIs
 template <typename T>
@@ -355,15 +405,95 @@ inline Tensor ravel(const Tensor& t)
 	return t.realize();
 }
 
+// x as an input to the cellActivity() family. Bool and Bit tensors are used as is, anything else is casted to Bool
+inline Tensor binaryInput(const Tensor& x)
+{
+	if(x.dtype() == DType::Bool || x.dtype() == DType::Bit)
+		return x;
+	return x.cast(DType::Bool);
+}
+
 inline Tensor cellActivity(const Tensor& x, const Tensor& connections, const Tensor& permeances
 	, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse=true)
 {
-	const Tensor& input = [&](){
-		if(x.dtype() == DType::Bool)
+	Tensor input = binaryInput(x);
+	return x.backend()->cellActivity(input.pimpl(), connections.pimpl(), permeances.pimpl(), connected_permeance, active_threshold, has_unconnected_synapse);
+}
+
+// Out variant of cellActivity(). Writes the result into out, reusing it's buffer
+inline void cellActivity(const Tensor& x, const Tensor& connections, const Tensor& permeances
+	, float connected_permeance, size_t active_threshold, Tensor& out, bool has_unconnected_synapse=true)
+{
+	Tensor input = binaryInput(x);
+	x.backend()->cellActivity(input.pimpl(), connections.pimpl(), permeances.pimpl(), connected_permeance, active_threshold
+		, has_unconnected_synapse, out.pimpl());
+}
+
+inline Tensor flatnonzero(const Tensor& x)
+{
+	return x.backend()->flatnonzero(ravel(x).pimpl());
+}
+
+// Builds a presynaptic to postsynaptic index of the synapses. Each row lists the (flat) indices of
+// the synapses connecting to that input bit, padded with -1
+inline Tensor reverseSynapseIndex(const Tensor& connections, const Shape& input_shape)
+{
+	return connections.backend()->reverseSynapseIndex(connections.pimpl(), input_shape);
+}
+
+// Same as cellActivity(). But only visits synapses connected to the active bits. x can be either
+// a Bool SDR or a list of active indices (as returned by flatnonzero())
+inline Tensor invertedCellActivity(const Tensor& x, const Tensor& reverse_index, const Tensor& permeances
+	, float connected_permeance, size_t active_threshold)
+{
+	const Tensor& active_bits = [&](){
+		if(x.dtype() == DType::Int32)
 			return x;
-		return x.cast(DType::Bool);
+		return flatnonzero(x);
 	}();
-	return x.backend()->cellActivity(input.pimpl(), connections.pimpl(), permeances.pimpl(), connected_permeance, active_threshold, has_unconnected_synapse);
+	return x.backend()->invertedCellActivity(active_bits.pimpl(), reverse_index.pimpl(), permeances.pimpl()
+		, connected_permeance, active_threshold);
+}
+
+// Updates overlaps (the cellActivity() of the last input before thresholding) in place for the input bits that turned
+// on or off since. The bits are lists of indices. Returns the new activity
+inline Tensor updateOverlaps(const Tensor& turned_on, const Tensor& turned_off, const Tensor& reverse_index, const Tensor& permeances
+	, float connected_permeance, size_t active_threshold, Tensor& overlaps)
+{
+	return overlaps.backend()->updateOverlaps(turned_on.pimpl(), turned_off.pimpl(), reverse_index.pimpl(), permeances.pimpl()
+		, connected_permeance, active_threshold, overlaps.pimpl());
+}
+
+// Recomputes the overlaps of the cells set in cells from input x. Used after the permanences of those cells are changed
+inline void recomputeOverlaps(const Tensor& x, const Tensor& cells, const Tensor& connections, const Tensor& permeances
+	, float connected_permeance, Tensor& overlaps)
+{
+	Tensor input = binaryInput(x);
+	Tensor mask = binaryInput(cells);
+	overlaps.backend()->recomputeOverlaps(input.pimpl(), mask.pimpl(), connections.pimpl(), permeances.pimpl()
+		, connected_permeance, overlaps.pimpl());
+}
+
+// cellActivity() of frozen models. masks is a Bit tensor holding the input bits each cell is connected to, padded to a
+// multiple of 64 bits per cell. The overlap is a popcount of the input AND the mask
+inline Tensor maskCellActivity(const Tensor& x, const Tensor& masks, size_t active_threshold)
+{
+	Tensor input = binaryInput(x);
+	return x.backend()->maskCellActivity(input.pimpl(), masks.pimpl(), active_threshold);
+}
+
+// maskCellActivity() of every sample in a batch. x is of shape [batch] + input_shape
+inline Tensor batchMaskCellActivity(const Tensor& x, const Tensor& masks, size_t active_threshold)
+{
+	Tensor input = binaryInput(x);
+	return x.backend()->batchMaskCellActivity(input.pimpl(), masks.pimpl(), active_threshold);
+}
+
+// Same as maskCellActivity(). But the connected input bits of each cell are listed in indices, sliced by rows ({offset, size})
+inline Tensor indexCellActivity(const Tensor& x, const Tensor& rows, const Tensor& indices, size_t active_threshold)
+{
+	Tensor input = binaryInput(x);
+	return x.backend()->indexCellActivity(input.pimpl(), rows.pimpl(), indices.pimpl(), active_threshold);
 }
 
 inline void learnCorrilation(const Tensor& x, const Tensor& learn, const Tensor& connection
@@ -377,6 +507,36 @@ inline Tensor globalInhibition(const Tensor& x, float fraction)
 	return x.backend()->globalInhibition(x.pimpl(), fraction);
 }
 
+// cellActivity() for a batch of inputs. x has the shape [batch] + input_shape
+inline Tensor batchCellActivity(const Tensor& x, const Tensor& connections, const Tensor& permeances
+	, float connected_permeance, size_t active_threshold, bool has_unconnected_synapse=true)
+{
+	Tensor input = ravel(binaryInput(x));
+	return x.backend()->batchCellActivity(input.pimpl(), connections.pimpl(), permeances.pimpl(), connected_permeance, active_threshold, has_unconnected_synapse);
+}
+
+// globalInhibition() on every x[i]
+inline Tensor batchGlobalInhibition(const Tensor& x, float fraction)
+{
+	return x.backend()->batchGlobalInhibition(ravel(x).pimpl(), fraction);
+}
+
+// Like globalInhibition(). But each cell only competes with the cells within radius of it (along every axis)
+inline Tensor localInhibition(const Tensor& x, float fraction, size_t radius)
+{
+	return x.backend()->localInhibition(x.pimpl(), fraction, radius);
+}
+
+// cellActivity -> boost (if average_activity is given) -> globalInhibition -> learnCorrilation (if learn is true)
+// in a single call. Returns the active cells
+inline Tensor spatialPoolerStep(const Tensor& x, const Tensor& connections, Tensor& permeances, const Tensor& average_activity
+	, float connected_permeance, size_t active_threshold, float density, float boost_factor, bool learn, float perm_inc, float perm_dec)
+{
+	return x.backend()->spatialPoolerStep(x.pimpl(), connections.pimpl(), permeances.pimpl()
+		, average_activity.has_value() ? average_activity.pimpl() : nullptr, connected_permeance, active_threshold
+		, density, boost_factor, learn, perm_inc, perm_dec);
+}
+
 Tensor inline cast(const Tensor& x, DType dtype)
 {
 	return x.cast(dtype);
@@ -402,6 +562,17 @@ inline Tensor reverseBurst(const Tensor& x)
 	return x.backend()->reverseBurst(x.pimpl());
 }
 
+// Out variants of burst() and reverseBurst(). Writes the result into out, reusing it's buffer. out can be s (or x) itself
+inline void burst(const Tensor& x, const Tensor& s, Tensor& out)
+{
+	x.backend()->burst(x.pimpl(), s.pimpl(), out.pimpl());
+}
+
+inline void reverseBurst(const Tensor& x, Tensor& out)
+{
+	x.backend()->reverseBurst(x.pimpl(), out.pimpl());
+}
+
 inline void growSynapses(const Tensor& x, const Tensor& y, Tensor& connections, Tensor& permeances, float init_perm)
 {
 	x.backend()->growSynapses(x.pimpl(), y.pimpl(), connections.pimpl(), permeances.pimpl(), init_perm);
@@ -425,10 +596,14 @@ inline void swap(Tensor x, Tensor y)
 }
 
 Tensor ETALER_EXPORT sum(const Tensor& x, std::optional<intmax_t> dim=std::nullopt, DType dtype=DType::Unknown);
+inline Tensor mean(const Tensor& x, std::optional<intmax_t> dim=std::nullopt, DType dtype=DType::Unknown) { return x.mean(dim, dtype); }
+inline Tensor argmax(const Tensor& x, std::optional<intmax_t> dim=std::nullopt) { return x.argmax(dim); }
 Tensor ETALER_EXPORT cat(const svector<Tensor>& tensors, intmax_t dim=0);
 inline Tensor concat(const svector<Tensor>& tensors, intmax_t dim=0) { return cat(tensors, dim); }
 inline Tensor concatenate(const svector<Tensor>& tensors, intmax_t dim=0) { return cat(tensors, dim); }
 std::pair<Tensor, Tensor> brodcast_tensors(const Tensor& a, const Tensor& b);
+//The shape a and b brodcast to. Throws if they are not brodcastable
+Shape ETALER_EXPORT brodcastShape(const Shape& a, const Shape& b);
 
 inline Tensor abs(const Tensor& x) { return x.abs(); }
 inline Tensor exp(const Tensor& x) { return x.exp(); }
@@ -448,6 +623,25 @@ inline Tensor lesser(const Tensor& x1, const Tensor& x2) { return x1.lesser(x2);
 inline Tensor logical_and(const Tensor& x1, const Tensor& x2) { return x1.logical_and(x2); }
 inline Tensor logical_or(const Tensor& x1, const Tensor& x2) { return x1.logical_or(x2); }
 
+// Out variants. Write the result into out (converted to it's dtype), reusing it's buffer. out may be one of the inputs
+inline void abs(const Tensor& x, Tensor& out) { x.backend()->abs(x.pimpl(), out.pimpl()); }
+inline void exp(const Tensor& x, Tensor& out) { x.backend()->exp(x.pimpl(), out.pimpl()); }
+inline void negate(const Tensor& x, Tensor& out) { x.backend()->negate(x.pimpl(), out.pimpl()); }
+inline void inverse(const Tensor& x, Tensor& out) { x.backend()->inverse(x.pimpl(), out.pimpl()); }
+inline void log(const Tensor& x, Tensor& out) { x.backend()->log(x.pimpl(), out.pimpl()); }
+inline void logical_not(const Tensor& x, Tensor& out) { x.backend()->logical_not(x.pimpl(), out.pimpl()); }
+
+inline void add(const Tensor& x1, const Tensor& x2, Tensor& out) { auto [a, b] = x1.brodcast(x2); x1.backend()->add(a.pimpl(), b.pimpl(), out.pimpl()); }
+inline void subtract(const Tensor& x1, const Tensor& x2, Tensor& out) { auto [a, b] = x1.brodcast(x2); x1.backend()->subtract(a.pimpl(), b.pimpl(), out.pimpl()); }
+inline void mul(const Tensor& x1, const Tensor& x2, Tensor& out) { auto [a, b] = x1.brodcast(x2); x1.backend()->mul(a.pimpl(), b.pimpl(), out.pimpl()); }
+inline void div(const Tensor& x1, const Tensor& x2, Tensor& out) { auto [a, b] = x1.brodcast(x2); x1.backend()->div(a.pimpl(), b.pimpl(), out.pimpl()); }
+inline void equal(const Tensor& x1, const Tensor& x2, Tensor& out) { auto [a, b] = x1.brodcast(x2); x1.backend()->equal(a.pimpl(), b.pimpl(), out.pimpl()); }
+inline void greater(const Tensor& x1, const Tensor& x2, Tensor& out) { auto [a, b] = x1.brodcast(x2); x1.backend()->greater(a.pimpl(), b.pimpl(), out.pimpl()); }
+inline void lesser(const Tensor& x1, const Tensor& x2, Tensor& out) { auto [a, b] = x1.brodcast(x2); x1.backend()->lesser(a.pimpl(), b.pimpl(), out.pimpl()); }
+inline void logical_and(const Tensor& x1, const Tensor& x2, Tensor& out) { auto [a, b] = x1.brodcast(x2); x1.backend()->logical_and(a.pimpl(), b.pimpl(), out.pimpl()); }
+inline void logical_or(const Tensor& x1, const Tensor& x2, Tensor& out) { auto [a, b] = x1.brodcast(x2); x1.backend()->logical_or(a.pimpl(), b.pimpl(), out.pimpl()); }
+void ETALER_EXPORT sum(const Tensor& x, std::optional<intmax_t> dim, Tensor& out);
+
 inline bool all(const Tensor& t) { return t.all(); }
 inline bool any(const Tensor& t) { return t.any(); }
 
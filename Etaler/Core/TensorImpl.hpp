@@ -6,8 +6,18 @@
 #include "Backend.hpp"
 #include "TypeHelpers.hpp"
 
+#include <atomic>
 #include <memory>
 #include <numeric>
+#include <array>
+
+#if defined(__GNUC__) || defined(__clang__)
+	#define ET_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+	#define ET_NOINLINE __declspec(noinline)
+#else
+	#define ET_NOINLINE
+#endif
 
 namespace et
 {
@@ -90,15 +100,27 @@ bool checkProperty(const TensorImpl* x, const T& value)
 	return false;
 }
 
+//Where a requireProperties() is called. Only turned into a string when a check fails
+struct PropertyCallSite
+{
+	const char* file;
+	int line;
+	const char* func;
+};
+
+//Checking properties is on by default. With checks off, requireProperties() trusts the caller and does nothing. Building
+//with ETALER_UNCHECKED removes the checks entirely. It is only defined when building the library, so requireProperties()
+//must not be used in inline code of the public headers (it would differ between the library and it's users)
+extern ETALER_EXPORT std::atomic<bool> g_property_checks_enabled;
+inline void enablePropertyChecks(bool enable) {g_property_checks_enabled.store(enable, std::memory_order_relaxed);}
+inline bool propertyChecksEnabled() {return g_property_checks_enabled.load(std::memory_order_relaxed);}
+
+//The failure path. Kept out of line so the passing checks stay small
 template <typename T>
-void requireProperty(const TensorImpl* x, const T& value, const std::string_view line, const std::string_view v_name)
+[[noreturn]] ET_NOINLINE void propertyError(const T& value, const PropertyCallSite& site, const char* v_name)
 {
-	if(checkProperty(x, value) == true)
-		return;
-	
-	// Otherwise assertion failed
-	// Workarround string_view limitations
-	const std::string msg = (std::string(line) + " Tensor property requirment not match. Expecting ").append(v_name);
+	const std::string msg = std::string(site.file) + ":" + std::to_string(site.line) + ":" + site.func
+		+ "(): Tensor property requirment not match. Expecting " + v_name;
 	if constexpr(std::is_base_of_v<Backend, std::remove_pointer_t<std::decay_t<T>>>)
 		throw EtError(msg + ".backend() == " + value->name());
 	else if constexpr(std::is_same_v<T, DType>)
@@ -113,6 +135,15 @@ void requireProperty(const TensorImpl* x, const T& value, const std::string_view
 		throw EtError(msg + ".dtype() is in {" + std::accumulate(value.types.begin(), value.types.end(), std::string()
 			, [](auto v, auto a){return v + to_ctype_string(a) + ", ";}));
 	}
+	else
+		throw EtError(msg);
+}
+
+template <typename T>
+inline void requireProperty(const TensorImpl* x, const T& value, const PropertyCallSite& site, const char* v_name)
+{
+	if(checkProperty(x, value) == false)
+		propertyError(value, site, v_name);
 }
 
 template <typename ... Args>
@@ -122,12 +153,17 @@ bool checkProperties(const TensorImpl* x, const Args& ... args)
 }
 
 template <typename ... Args>
-void requirePropertiesInternal(const TensorImpl* x, const std::string_view line, const std::string_view v_name, const Args& ... args)
+inline void requirePropertiesInternal(const TensorImpl* x, const PropertyCallSite& site, const char* v_name, const Args& ... args)
 {
-	(requireProperty(x, args, line, v_name), ...);
+	if(propertyChecksEnabled() == false)
+		return;
+	(requireProperty(x, args, site, v_name), ...);
 }
 
 }
 
-#define requireProperties(x, ...) (requirePropertiesInternal(x, std::string(__FILE__)+":"+std::to_string(__LINE__)\
-	+":"+std::string(__func__)+"():", #x, __VA_ARGS__))
+#ifdef ETALER_UNCHECKED
+	#define requireProperties(x, ...) ((void)(x))
+#else
+	#define requireProperties(x, ...) (requirePropertiesInternal(x, et::PropertyCallSite{__FILE__, __LINE__, __func__}, #x, __VA_ARGS__))
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+namespace et
+{
+
+//An unsigned normalized 8 bit fixed point number. Stores value/255, covering [0, 1] in 256 steps. Meant for permanences,
+//which never leave [0, 1], at a quarter of the size of float. Converting from float rounds to the nearest step and saturates
+struct unorm8
+{
+	static constexpr float scale = 255.f;
+
+	unorm8() = default;
+	unorm8(float v) : value(uint8_t(std::lround(std::clamp(v, 0.f, 1.f)*scale))) {}
+	operator float() const {return value/scale;}
+
+	//The largest raw value that is not greater than t. So x > t is the same as x.value > threshold(t)
+	static int32_t threshold(float t) {return int32_t(std::floor(std::clamp(t*scale, -1.f, scale)));}
+	//t in raw steps. Non-zero steps are at least one step, so small increments don't round to nothing
+	static int32_t step(float t)
+	{
+		int32_t s = int32_t(std::lround(std::clamp(t, 0.f, 1.f)*scale));
+		return (s == 0 && t > 0) ? 1 : s;
+	}
+
+	//Compare with floats without going through division
+	friend bool operator> (unorm8 a, float b) {return a.value > b*scale;}
+	friend bool operator< (unorm8 a, float b) {return a.value < b*scale;}
+
+	uint8_t value;
+};
+
+static_assert(sizeof(unorm8) == 1);
+
+}
@@ -31,7 +31,7 @@ namespace decoder
 
 std::vector<size_t> category(const Tensor& t, size_t num_categories)
 {
-	requireProperties(t.pimpl(), DType::Bool);
+	et_check(t.dtype() == DType::Bool, "decoder::category expects a Bool tensor");
 	et_check(t.size()%num_categories == 0);
 
 	std::vector<uint8_t> vec = t.toHost<uint8_t>();
@@ -5,4 +5,6 @@
 #include <Etaler/Core/DType.hpp>
 #include <Etaler/Core/Backend.hpp>
 #include <Etaler/Core/Tensor.hpp>
+#include <Etaler/Core/Expression.hpp>
 #include <Etaler/Core/DefaultBackend.hpp>
+#include <Etaler/Core/Profiler.hpp>
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <benchmark/benchmark.h>
+
+#include <Etaler/Etaler.hpp>
+
+#include <memory>
+#include <random>
+#include <string>
+
+namespace et
+{
+namespace bench
+{
+
+// Benchmark arguments are integers. DTypes are passed as their enum value
+inline DType argDType(int64_t v) { return DType(v); }
+inline int64_t dtypeArg(DType dtype) { return (int64_t)dtype; }
+
+inline Tensor randomSDR(const Shape& shape, float density, size_t seed=42)
+{
+	std::mt19937 rng(seed);
+	std::bernoulli_distribution dist(density);
+	std::unique_ptr<bool[]> data(new bool[shape.volume()]);
+	for(intmax_t i=0;i<shape.volume();i++)
+		data[i] = dist(rng);
+	return Tensor(shape, data.get());
+}
+
+// Uniform values in [0, 1) casted to dtype
+inline Tensor randomTensor(const Shape& shape, DType dtype, size_t seed=42)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> dist(0, 1);
+	std::vector<float> data(shape.volume());
+	for(auto& v : data)
+		v = dist(rng);
+	return Tensor(shape, data.data()).cast(dtype);
+}
+
+// A non-contiguous view of n elements. Every other element of a 2n long tensor
+inline Tensor stridedView(const Tensor& x)
+{
+	intmax_t n = x.size();
+	Tensor t = cat({x.reshape({n, 1}), x.reshape({n, 1})}, 1);
+	return t.view({all(), 0});
+}
+
+// Tensors of n elements. Either plain or a strided view, per the contiguous argument. Numbers are in [1, 100). So integer
+// division doesn't divide by zero
+inline Tensor makeOperand(intmax_t n, DType dtype, bool contiguous, size_t seed=42)
+{
+	Tensor x = [&](){
+		if(dtype == DType::Bool)
+			return randomSDR({n}, 0.5, seed);
+		if(dtype == DType::UNorm8)
+			return randomTensor({n}, dtype, seed);
+		return (randomTensor({n}, DType::Float, seed)*99.f + 1.f).cast(dtype);
+	}();
+	return contiguous ? x : stridedView(x);
+}
+
+inline std::string label(DType dtype, bool contiguous)
+{
+	return to_string(dtype) + (contiguous ? "/contiguous" : "/strided");
+}
+
+// The backend may run asynchronously. Wait for the work to finish before the timer stops
+inline void finish(const Tensor& t)
+{
+	benchmark::DoNotOptimize(t.data());
+	t.backend()->sync();
+}
+
+}
+}
@@ -0,0 +1,164 @@
+#include "BenchUtils.hpp"
+
+#include <Etaler/Algorithms/Synapse.hpp>
+#include <Etaler/Algorithms/SpatialPooler.hpp>
+
+using namespace et;
+using namespace et::bench;
+
+// HTM primitives. Densities are in percent
+
+static constexpr intmax_t input_size = 1024;
+static constexpr intmax_t cells_per_column = 16;
+static constexpr intmax_t max_synapses_per_cell = 64;
+
+static std::vector<int64_t> permTypes()
+{
+	return {dtypeArg(DType::Float), dtypeArg(DType::Half), dtypeArg(DType::UNorm8)};
+}
+
+static void spatialPoolerArgs(benchmark::internal::Benchmark* b)
+{
+	b->ArgNames({"cells", "density", "perm_type"});
+	b->ArgsProduct({{1024, 8192}, {2, 15}, permTypes()});
+}
+
+static void BM_CellActivity(benchmark::State& state)
+{
+	intmax_t cells = state.range(0);
+	DType perm_type = argDType(state.range(2));
+	auto [connections, permanences] = F::gusianRandomSynapse({input_size}, {cells});
+	permanences = permanences.cast(perm_type);
+	Tensor x = randomSDR({input_size}, state.range(1)/100.f);
+
+	for(auto _ : state)
+		finish(cellActivity(x, connections, permanences, 0.21, 5, false));
+	state.SetItemsProcessed(state.iterations()*connections.size());
+	state.SetLabel(to_string(perm_type));
+}
+BENCHMARK(BM_CellActivity)->Apply(spatialPoolerArgs);
+
+// cellActivity of a frozen SP. Items are the synapses the unfrozen one visits
+static void BM_MaskCellActivity(benchmark::State& state)
+{
+	intmax_t cells = state.range(0);
+	SpatialPooler sp({input_size}, {cells});
+	Tensor masks = sp.freeze().masks();
+	Tensor x = randomSDR({input_size}, state.range(1)/100.f);
+
+	for(auto _ : state)
+		finish(maskCellActivity(x, masks, 5));
+	state.SetItemsProcessed(state.iterations()*sp.connections().size());
+}
+BENCHMARK(BM_MaskCellActivity)->ArgNames({"cells", "density"})->ArgsProduct({{1024, 8192}, {2, 15}});
+
+static void BM_LearnCorrilation(benchmark::State& state)
+{
+	intmax_t cells = state.range(0);
+	DType perm_type = argDType(state.range(2));
+	auto [connections, permanences] = F::gusianRandomSynapse({input_size}, {cells});
+	permanences = permanences.cast(perm_type);
+	Tensor x = randomSDR({input_size}, state.range(1)/100.f);
+	Tensor learn = randomSDR({cells}, 0.02, 1);
+
+	for(auto _ : state) {
+		learnCorrilation(x, learn, connections, permanences, 0.1, 0.1, false);
+		finish(permanences);
+	}
+	state.SetItemsProcessed(state.iterations()*connections.size());
+	state.SetLabel(to_string(perm_type));
+}
+BENCHMARK(BM_LearnCorrilation)->Apply(spatialPoolerArgs);
+
+static void BM_GlobalInhibition(benchmark::State& state)
+{
+	intmax_t cells = state.range(0);
+	float fraction = state.range(1)/100.f;
+	Tensor x = (randomTensor({cells}, DType::Float)*64.f).cast(DType::Int32);
+
+	for(auto _ : state)
+		finish(globalInhibition(x, fraction));
+	state.SetItemsProcessed(state.iterations()*cells);
+}
+BENCHMARK(BM_GlobalInhibition)->ArgNames({"cells", "density"})->ArgsProduct({{1024, 1<<16}, {2, 15}});
+
+static void temporalMemoryArgs(benchmark::internal::Benchmark* b)
+{
+	b->ArgNames({"columns", "density"});
+	b->ArgsProduct({{1024, 4096}, {2, 15}});
+}
+
+static void BM_Burst(benchmark::State& state)
+{
+	intmax_t columns = state.range(0);
+	float density = state.range(1)/100.f;
+	Tensor x = randomSDR({columns}, density);
+	Tensor s = randomSDR({columns, cells_per_column}, density/cells_per_column, 1);
+
+	for(auto _ : state)
+		finish(burst(x, s));
+	state.SetItemsProcessed(state.iterations()*s.size());
+}
+BENCHMARK(BM_Burst)->Apply(temporalMemoryArgs);
+
+static void BM_ReverseBurst(benchmark::State& state)
+{
+	intmax_t columns = state.range(0);
+	float density = state.range(1)/100.f;
+	Tensor x = burst(randomSDR({columns}, density), zeros({columns, cells_per_column}, DType::Bool));
+
+	for(auto _ : state)
+		finish(reverseBurst(x));
+	state.SetItemsProcessed(state.iterations()*x.size());
+}
+BENCHMARK(BM_ReverseBurst)->Apply(temporalMemoryArgs);
+
+// Empty synapses of a TemporalMemory. Padded with -1
+static std::pair<Tensor, Tensor> emptySynapses(intmax_t columns)
+{
+	Shape s = {columns, cells_per_column, max_synapses_per_cell};
+	return {constant(s, -1), zeros(s, DType::Float)};
+}
+
+// Growing changes the synapses. So each iteration starts from a fresh copy made outside the timer
+static void BM_GrowSynapses(benchmark::State& state)
+{
+	intmax_t columns = state.range(0);
+	float density = state.range(1)/100.f;
+	auto [init_connections, init_permanences] = emptySynapses(columns);
+	Tensor x = randomSDR({columns, cells_per_column}, density/cells_per_column, 1);
+	Tensor y = randomSDR({columns, cells_per_column}, density/cells_per_column, 2);
+
+	for(auto _ : state) {
+		state.PauseTiming();
+		Tensor connections = init_connections.copy();
+		Tensor permanences = init_permanences.copy();
+		state.ResumeTiming();
+		growSynapses(x, y, connections, permanences, 0.21);
+		finish(connections);
+	}
+	state.SetItemsProcessed(state.iterations()*init_connections.size());
+}
+BENCHMARK(BM_GrowSynapses)->Apply(temporalMemoryArgs);
+
+static void BM_DecaySynapses(benchmark::State& state)
+{
+	intmax_t columns = state.range(0);
+	float density = state.range(1)/100.f;
+	auto [init_connections, init_permanences] = emptySynapses(columns);
+	// Fill the synapses then give them random strength. So about half of them decay
+	Tensor all_cells = ones({columns, cells_per_column}, DType::Bool);
+	growSynapses(randomSDR({columns, cells_per_column}, density, 1), all_cells, init_connections, init_permanences, 0.21);
+	init_permanences = randomTensor(init_permanences.shape(), DType::Float, 2);
+
+	for(auto _ : state) {
+		state.PauseTiming();
+		Tensor connections = init_connections.copy();
+		Tensor permanences = init_permanences.copy();
+		state.ResumeTiming();
+		decaySynapses(connections, permanences, 0.5);
+		finish(connections);
+	}
+	state.SetItemsProcessed(state.iterations()*init_connections.size());
+}
+BENCHMARK(BM_DecaySynapses)->Apply(temporalMemoryArgs);
@@ -0,0 +1,195 @@
+#include "BenchUtils.hpp"
+
+using namespace et;
+using namespace et::bench;
+
+// Elementwise and reduction primitives. Arguments are {size, dtype, contiguous}
+
+static void sizeDTypeContiguity(benchmark::internal::Benchmark* b, std::vector<int64_t> dtypes)
+{
+	b->ArgNames({"size", "dtype", "contiguous"});
+	b->ArgsProduct({{1<<10, 1<<16, 1<<20}, dtypes, {1, 0}});
+}
+
+static void arithmeticArgs(benchmark::internal::Benchmark* b)
+{
+	sizeDTypeContiguity(b, {dtypeArg(DType::Int32), dtypeArg(DType::Float), dtypeArg(DType::Half)});
+}
+
+static void storageArgs(benchmark::internal::Benchmark* b)
+{
+	sizeDTypeContiguity(b, {dtypeArg(DType::Bool), dtypeArg(DType::Int32), dtypeArg(DType::Float), dtypeArg(DType::Half)
+		, dtypeArg(DType::UNorm8)});
+}
+
+template <typename Op>
+static void BM_Binary(benchmark::State& state, Op op)
+{
+	intmax_t n = state.range(0);
+	DType dtype = argDType(state.range(1));
+	bool contiguous = state.range(2);
+	Tensor a = makeOperand(n, dtype, contiguous, 1);
+	Tensor b = makeOperand(n, dtype, contiguous, 2);
+
+	for(auto _ : state)
+		finish(op(a, b));
+	state.SetItemsProcessed(state.iterations()*n);
+	state.SetBytesProcessed(state.iterations()*n*dtypeToSize(dtype)*2);
+	state.SetLabel(label(dtype, contiguous));
+}
+BENCHMARK_CAPTURE(BM_Binary, add, [](const Tensor& a, const Tensor& b) { return a + b; })->Apply(arithmeticArgs);
+BENCHMARK_CAPTURE(BM_Binary, mul, [](const Tensor& a, const Tensor& b) { return a * b; })->Apply(arithmeticArgs);
+BENCHMARK_CAPTURE(BM_Binary, div, [](const Tensor& a, const Tensor& b) { return a / b; })->Apply(arithmeticArgs);
+BENCHMARK_CAPTURE(BM_Binary, greater, [](const Tensor& a, const Tensor& b) { return a > b; })->Apply(arithmeticArgs);
+BENCHMARK_CAPTURE(BM_Binary, logical_and, [](const Tensor& a, const Tensor& b) { return a && b; })->Apply([](auto b) {
+	sizeDTypeContiguity(b, {dtypeArg(DType::Bool)});
+});
+
+static void BM_Sum(benchmark::State& state)
+{
+	intmax_t n = state.range(0);
+	DType dtype = argDType(state.range(1));
+	bool contiguous = state.range(2);
+	Tensor x = makeOperand(n, dtype, contiguous);
+
+	for(auto _ : state)
+		finish(x.sum());
+	state.SetItemsProcessed(state.iterations()*n);
+	state.SetLabel(label(dtype, contiguous));
+}
+BENCHMARK(BM_Sum)->Apply([](auto b) {
+	sizeDTypeContiguity(b, {dtypeArg(DType::Bool), dtypeArg(DType::Int32), dtypeArg(DType::Float), dtypeArg(DType::Half)});
+});
+
+// Reduces a {rows, 64} Float tensor along one axis
+template <typename Op>
+static void BM_Reduce(benchmark::State& state, Op op)
+{
+	intmax_t rows = state.range(0);
+	intmax_t dim = state.range(1);
+	Tensor x = ones({rows, 64}, DType::Float);
+
+	for(auto _ : state)
+		finish(op(x, dim));
+	state.SetItemsProcessed(state.iterations()*x.size());
+}
+static void reduceArgs(benchmark::internal::Benchmark* b)
+{
+	b->ArgNames({"rows", "dim"});
+	b->ArgsProduct({{64, 1<<10, 1<<14}, {0, 1}});
+}
+BENCHMARK_CAPTURE(BM_Reduce, sum, [](const Tensor& x, intmax_t dim) { return x.sum(dim); })->Apply(reduceArgs);
+BENCHMARK_CAPTURE(BM_Reduce, max, [](const Tensor& x, intmax_t dim) { return x.max(dim); })->Apply(reduceArgs);
+BENCHMARK_CAPTURE(BM_Reduce, any, [](const Tensor& x, intmax_t dim) { return x.sum(dim, DType::Bool); })->Apply(reduceArgs);
+
+// Cast to Float. Or to Int32 when the source is Float
+static void BM_Cast(benchmark::State& state)
+{
+	intmax_t n = state.range(0);
+	DType dtype = argDType(state.range(1));
+	bool contiguous = state.range(2);
+	DType target = dtype == DType::Float ? DType::Int32 : DType::Float;
+	Tensor x = makeOperand(n, dtype, contiguous);
+
+	for(auto _ : state)
+		finish(x.cast(target));
+	state.SetItemsProcessed(state.iterations()*n);
+	state.SetLabel(label(dtype, contiguous) + "->" + to_string(target));
+}
+BENCHMARK(BM_Cast)->Apply(storageArgs);
+
+// Realizing a strided view gathers it into a new plain tensor. A contiguous tensor is copied instead, as realizing
+// it would be a no-op
+static void BM_Realize(benchmark::State& state)
+{
+	intmax_t n = state.range(0);
+	DType dtype = argDType(state.range(1));
+	bool contiguous = state.range(2);
+	Tensor x = makeOperand(n, dtype, contiguous);
+
+	for(auto _ : state)
+		finish(contiguous ? x.copy() : x.realize());
+	state.SetItemsProcessed(state.iterations()*n);
+	state.SetBytesProcessed(state.iterations()*n*dtypeToSize(dtype));
+	state.SetLabel(label(dtype, contiguous));
+}
+BENCHMARK(BM_Realize)->Apply(storageArgs);
+
+// A fused lazy expression against the same computation done one operation at a time
+static void BM_Expression(benchmark::State& state)
+{
+	intmax_t n = state.range(0);
+	bool fused = state.range(1);
+	Tensor a = randomTensor({n}, DType::Float, 1);
+	Tensor b = randomTensor({n}, DType::Float, 2);
+
+	for(auto _ : state) {
+		if(fused)
+			finish(exp((0.5f - lazy(a)) * 2.f) * b);
+		else
+			finish(exp((0.5f - a) * 2.f) * b);
+	}
+	state.SetItemsProcessed(state.iterations()*n);
+	state.SetLabel(fused ? "fused" : "eager");
+}
+BENCHMARK(BM_Expression)->ArgNames({"size", "fused"})->ArgsProduct({{1<<10, 1<<16, 1<<20}, {1, 0}});
+
+// The fixed cost of an operation. With a single element, the time is all dispatch, argument checks and allocation
+template <typename Op>
+static void BM_OpOverhead(benchmark::State& state, Op op)
+{
+	bool checked = state.range(0);
+	Tensor a = makeOperand(1, DType::Float, true, 1);
+	Tensor b = makeOperand(1, DType::Float, true, 2);
+
+	enablePropertyChecks(checked);
+	for(auto _ : state)
+		finish(op(a, b));
+	enablePropertyChecks(true);
+	state.SetItemsProcessed(state.iterations());
+	state.SetLabel(checked ? "checked" : "unchecked");
+}
+static void overheadArgs(benchmark::internal::Benchmark* b)
+{
+	b->ArgName("checked")->Arg(1)->Arg(0);
+}
+BENCHMARK_CAPTURE(BM_OpOverhead, add, [](const Tensor& a, const Tensor& b) { return a + b; })->Apply(overheadArgs);
+BENCHMARK_CAPTURE(BM_OpOverhead, exp, [](const Tensor& a, const Tensor&) { return exp(a); })->Apply(overheadArgs);
+BENCHMARK_CAPTURE(BM_OpOverhead, sum, [](const Tensor& a, const Tensor&) { return a.sum(); })->Apply(overheadArgs);
+BENCHMARK_CAPTURE(BM_OpOverhead, cast, [](const Tensor& a, const Tensor&) { return a.cast(DType::Int32); })->Apply(overheadArgs);
+BENCHMARK_CAPTURE(BM_OpOverhead, copy, [](const Tensor& a, const Tensor&) { return a.copy(); })->Apply(overheadArgs);
+
+// a += b as an op allocating the result vs writing into a. Arguments are {size, inplace}
+static void BM_InplaceAdd(benchmark::State& state)
+{
+	intmax_t n = state.range(0);
+	bool inplace = state.range(1);
+	Tensor a = makeOperand(n, DType::Float, true, 1);
+	Tensor b = makeOperand(n, DType::Float, true, 2);
+
+	for(auto _ : state) {
+		if(inplace)
+			a.add_(b);
+		else
+			a = a + b;
+		finish(a);
+	}
+	state.SetItemsProcessed(state.iterations()*n);
+	state.SetBytesProcessed(state.iterations()*n*sizeof(float)*3);
+}
+BENCHMARK(BM_InplaceAdd)->ArgNames({"size", "inplace"})->ArgsProduct({{1, 1<<10, 1<<16, 1<<20}, {1, 0}});
+
+static void BM_ScalarMul(benchmark::State& state)
+{
+	intmax_t n = state.range(0);
+	bool scalar = state.range(1);
+	Tensor a = makeOperand(n, DType::Float, true, 1);
+
+	for(auto _ : state) {
+		Tensor c = scalar ? a*0.5f : a*Tensor(0.5f);
+		finish(c);
+	}
+	state.SetItemsProcessed(state.iterations()*n);
+	state.SetBytesProcessed(state.iterations()*n*sizeof(float)*2);
+}
+BENCHMARK(BM_ScalarMul)->ArgNames({"size", "scalar"})->ArgsProduct({{1, 1<<10, 1<<16, 1<<20}, {1, 0}});
@@ -0,0 +1,17 @@
+#include <benchmark/benchmark.h>
+
+#include <Etaler/Core/DefaultBackend.hpp>
+
+int main(int argc, char** argv)
+{
+	et::enableTraceOnException(false); // Don't spend the time generating stack traces
+	// Recorded in the JSON output. So results from different backends are not compared by accident
+	benchmark::AddCustomContext("etaler_backend", et::defaultBackend()->name());
+
+	benchmark::Initialize(&argc, argv);
+	if(benchmark::ReportUnrecognizedArguments(argc, argv))
+		return 1;
+	benchmark::RunSpecifiedBenchmarks();
+	benchmark::Shutdown();
+	return 0;
+}
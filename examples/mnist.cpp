@@ -143,26 +143,33 @@ int main(int argc, char** argv)
 	std::cout << "\n";
 
 	// Test the model. We send testing images into the SP, then to the SDRClassifer. If the classifer
-	// can classify the input correct, we're good!
+	// can classify the input correct, we're good! The images are sent in batches so the SP and the
+	// classifer process many of them per call
 	std::cout << "Testing model" << std::endl;
 	disp = ProgressDisplay(dataset.test_images.size());
+	const size_t batch_size = 256;
 	size_t correct = 0;
-	Tensor confusion_matrix = zeros({10, 10});
-	for(size_t i=0;i<dataset.test_images.size();i++) {
-		Tensor x = Tensor({28, 28}, dataset.test_images[i].data());
+	std::vector<int> confusion(10*10, 0);
+	for(size_t i=0;i<dataset.test_images.size();i+=batch_size) {
+		size_t n = std::min(batch_size, dataset.test_images.size()-i);
+		std::vector<uint8_t> images;
+		for(size_t j=0;j<n;j++)
+			images.insert(images.end(), dataset.test_images[i+j].begin(), dataset.test_images[i+j].end());
+		Tensor x = Tensor({intmax_t(n), 28, 28}, images.data());
 		Tensor y = sp.compute(x);
 
-		intmax_t label = dataset.test_labels[i];
-		intmax_t pred = classifer.compute(y, classifer_density);
-
-		if(label == pred)
-			correct += 1;
-
-		if(i%display_steps == 0)
-				disp.update(i);
+		std::vector<int> preds = classifer.topk(y, classifer_density).first.toHost<int>();
+		for(size_t j=0;j<n;j++) {
+			intmax_t label = dataset.test_labels[i+j];
+			intmax_t pred = preds[j];
+			if(label == pred)
+				correct += 1;
+			confusion[label*10+pred] += 1;
+		}
 
-		confusion_matrix[{label, pred}] = confusion_matrix[{label, pred}] + 1;
+		disp.update(i);
 	}
+	Tensor confusion_matrix = Tensor({10, 10}, confusion.data());
 
 	std::cout << std::endl;
 	// std::cout << confusion_matrix.sum() << std::endl;
@@ -7,10 +7,18 @@
 #include <Etaler/Encoders/GridCell1d.hpp>
 #include <Etaler/Encoders/GridCell2d.hpp>
 #include <Etaler/Core/Serialize.hpp>
+#include <Etaler/Backends/CPUBackend.hpp>
+#include <Etaler/Backends/AsyncCPUBackend.hpp>
 #include <Etaler/Algorithms/SDRClassifer.hpp>
+#include <Etaler/Algorithms/SpatialPooler.hpp>
+#include <Etaler/Algorithms/TemporalMemory.hpp>
 #include <Etaler/Algorithms/Anomaly.hpp>
+#include <Etaler/Algorithms/Pipeline.hpp>
 
 #include <numeric>
+#include <thread>
+#include <atomic>
+#include <filesystem>
 
 using Approx = Catch::Approx;
 
@@ -155,6 +163,31 @@ TEST_CASE("Testing Tensor", "[Tensor]")
 		CHECK_FALSE(t.isSame(r));
 	}
 
+	SECTION("Scalar operands") {
+		int data[] = {1,2,3,4,5};
+		Tensor t = Tensor({5}, data);
+
+		CHECK((t+2).dtype() == DType::Int32);
+		CHECK((t*0.5f).dtype() == DType::Float);
+		CHECK((t>2).dtype() == DType::Bool);
+		CHECK((t+2).isSame(t+Tensor(2)));
+		CHECK((t*0.5f).isSame(t*Tensor(0.5f)));
+		CHECK((0.5f-t).isSame(Tensor(0.5f)-t));
+		CHECK((2/t).isSame(Tensor(2)/t));
+		CHECK((1<t).isSame(t>1));
+		CHECK((t!=3).isSame(t!=Tensor(3)));
+		CHECK((t<=3).isSame(t<=Tensor(3)));
+		CHECK((t>=3).isSame(t>=Tensor(3)));
+
+		Tensor b = cast(t > 2, DType::Bit);
+		CHECK((b==true).isSame(t>2));
+
+		auto backend = std::make_shared<CPUBackend>();
+		Tensor q = t.to(backend.get());
+		CHECK((q*2).backend() == backend.get());
+		CHECK((q*2).isSame((t*2).to(backend.get())));
+	}
+
 	SECTION("Data Transfer") {
 		int data[] = {1,2,3,2,1};
 		Tensor t = Tensor({5}, data);
@@ -198,6 +231,19 @@ TEST_CASE("Testing Tensor", "[Tensor]")
 
 		CHECK_NOTHROW(requireProperties(ones({Shape{4, 4}}).pimpl(), Shape{4, 4}));
 		CHECK_THROWS(requireProperties(ones({Shape{4, 4}}).pimpl(), Shape{4}));
+
+		try {
+			requireProperties(ones(Shape{1}, DType::Float).pimpl(), DType::Int32);
+			FAIL("requireProperties should throw");
+		}
+		catch(const EtError& e) {
+			CHECK(std::string(e.what()).find("common_tests.cpp") != std::string::npos);
+		}
+
+		enablePropertyChecks(false);
+		CHECK_NOTHROW(requireProperties(ones(Shape{1}, DType::Float).pimpl(), DType::Int32));
+		CHECK(realize(ones(Shape{2}) + ones(Shape{2})).isSame(constant(Shape{2}, 2)));
+		enablePropertyChecks(true);
 	}
 
 	SECTION("Views") {
@@ -597,6 +643,90 @@ TEST_CASE("Backend functions", "[Backend]")
 		CHECK(res[1] == 1);
 	}
 
+	SECTION("Cell Activity on long rows") {
+		// Rows that don't fit in a SIMD register and end at different places
+		const size_t num_cells = 8, row_size = 37, input_size = 100;
+		std::vector<int32_t> synapses(num_cells*row_size, -1);
+		std::vector<float> perms(num_cells*row_size, 0);
+		std::vector<uint8_t> in(input_size);
+		for(size_t i=0;i<input_size;i++)
+			in[i] = (i*7)%3 == 0;
+		for(size_t i=0;i<num_cells;i++) {
+			for(size_t j=0;j<row_size-i*4;j++) {
+				synapses[i*row_size+j] = (i*13+j*29)%input_size;
+				perms[i*row_size+j] = ((i+j)%10)/10.f;
+			}
+		}
+
+		std::vector<int32_t> expected(num_cells);
+		for(size_t i=0;i<num_cells;i++) {
+			for(size_t j=0;j<row_size && synapses[i*row_size+j] != -1;j++)
+				expected[i] += in[synapses[i*row_size+j]] && perms[i*row_size+j] > 0.45f;
+		}
+
+		Tensor x = Tensor({intmax_t(input_size)}, in.data());
+		Tensor s = Tensor({intmax_t(num_cells), intmax_t(row_size)}, synapses.data());
+		Tensor p = Tensor({intmax_t(num_cells), intmax_t(row_size)}, perms.data());
+		Tensor pred = Tensor(expected);
+		CHECK(cellActivity(x, s, p, 0.45, 0).isSame(pred));
+		CHECK(cellActivity(x, s, p.cast(DType::Half), 0.45, 0).isSame(pred));
+		CHECK(cellActivity(x, s, p.cast(DType::UNorm8), 0.45, 0).isSame(pred));
+		CHECK(cellActivity(x.cast(DType::Bit), s, p, 0.45, 0).isSame(pred));
+	}
+
+	SECTION("Cell Activity kernels") {
+		// Every kernel the CPU supports counts the same as the scalar one. Including on rows ending mid-vector
+		// and rows padded with -1
+		const size_t input_size = 100;
+		std::vector<uint32_t> bits((input_size+31)/32);
+		for(size_t i=0;i<input_size;i++)
+			bits[i/32] |= uint32_t((i*7)%3 == 0) << (i%32);
+		for(size_t n : {1, 7, 8, 15, 16, 17, 33, 40}) {
+			for(size_t num_valid : {n, n/2, size_t(0)}) {
+				std::vector<int32_t> synapses(n, -1);
+				std::vector<float> perms(n);
+				size_t expected = 0;
+				for(size_t j=0;j<n;j++) {
+					perms[j] = ((j+n)%10)/10.f;
+					if(j >= num_valid)
+						continue;
+					synapses[j] = (j*29+n)%input_size;
+					expected += ((bits[synapses[j]/32] >> (synapses[j]%32)) & 1) && perms[j] > 0.45f;
+				}
+
+				for(DType dtype : {DType::Float, DType::Half, DType::UNorm8}) {
+					Tensor p = Tensor({intmax_t(n)}, perms.data()).cast(dtype);
+					for(std::string kernel : {"scalar", "avx2", "avx512"}) {
+						intmax_t res = detail::rowOverlap(kernel, synapses.data(), p.pimpl()->data(), dtype, n, bits.data(), 0.45f);
+						CHECK((res == intmax_t(expected) || (res == -1 && kernel != "scalar")));
+					}
+				}
+			}
+		}
+	}
+
+	SECTION("flatnonzero") {
+		uint8_t in[6] = {0,1,1,0,0,1};
+		Tensor x = Tensor({2, 3}, in);
+
+		int32_t pred[3] = {1,2,5};
+		CHECK(flatnonzero(x).isSame(Tensor({3}, pred)));
+		CHECK(flatnonzero(zeros({4}, DType::Bool)).size() == 0);
+	}
+
+	SECTION("Inverted Cell Activity") {
+		auto [s, p] = F::gusianRandomSynapse({64}, {32}, 0.5);
+		Tensor x = encoder::scalar(0.3, 0, 1, 64, 8);
+
+		Tensor index = reverseSynapseIndex(s, {64});
+		CHECK(index.shape()[0] == 64);
+
+		Tensor y = invertedCellActivity(x, index, p, 0.21, 1);
+		CHECK(y.shape() == Shape({32}));
+		CHECK(y.isSame(cellActivity(x, s, p, 0.21, 1)));
+		CHECK(invertedCellActivity(flatnonzero(x), index, p, 0.21, 3).isSame(cellActivity(x, s, p, 0.21, 3)));
+	}
+
 	SECTION("Global Inhibition") {
 		int32_t in[8] = {0,0,1,2,7,6,5,3};
 		Tensor t = Tensor({8}, in);
@@ -607,6 +737,32 @@ TEST_CASE("Backend functions", "[Backend]")
 		Tensor should_be = Tensor({8}, pred);
 		CHECK(y.dtype() == DType::Bool);
 		CHECK(y.isSame(should_be));
+
+		// Ties with the threshold all win
+		int32_t in2[8] = {0,3,1,3,7,3,5,3};
+		uint8_t pred2[8] = {0,1,0,1,1,1,1,1};
+		CHECK(globalInhibition(Tensor({8}, in2), 0.375).isSame(Tensor({8}, pred2)));
+
+		// Values too spread out for counting
+		int32_t in3[4] = {-100000000, 0, 100000000, 5};
+		uint8_t pred3[4] = {0,0,1,1};
+		CHECK(globalInhibition(Tensor({4}, in3), 0.5).isSame(Tensor({4}, pred3)));
+
+		CHECK(globalInhibition(zeros({8}, DType::Int32), 0.5).sum().item<int32_t>() == 0);
+	}
+
+	SECTION("Local Inhibition") {
+		int32_t in[8] = {0,0,1,2,7,6,5,3};
+		Tensor t = Tensor({8}, in);
+
+		// A large enough radius is the same as global inhibition
+		CHECK(localInhibition(t, 0.5, 8).isSame(globalInhibition(t, 0.5)));
+
+		uint8_t pred[8] = {0,0,1,1,1,1,1,0};
+		CHECK(localInhibition(t, 0.67, 1).isSame(Tensor({8}, pred)));
+
+		Tensor t2 = t.reshape({2, 4});
+		CHECK(localInhibition(t2, 0.5, 4).isSame(globalInhibition(t2, 0.5)));
 	}
 
 	SECTION("Sort synapse") {
@@ -663,6 +819,52 @@ TEST_CASE("Backend functions", "[Backend]")
 		Tensor p = Tensor({5}, pred_sum.data());
 
 		CHECK(y.sum(1).isSame(p));
+
+		// Reproducible for a seed. And Bit tensors choose the same cells
+		auto backend = std::make_shared<CPUBackend>();
+		Tensor bursting = ones({64, 16}, DType::Bool).to(backend.get());
+		backend->setRandomSeed(7);
+		Tensor a = reverseBurst(bursting);
+		Tensor b = reverseBurst(bursting);
+		backend->setRandomSeed(7);
+		CHECK(reverseBurst(bursting).isSame(a));
+		CHECK(reverseBurst(bursting.cast(DType::Bit)).cast(DType::Bool).isSame(b));
+		CHECK_FALSE(a.isSame(b));
+
+		// Ops queued on an async backend finish with the seed they were called with
+		auto async = std::make_shared<AsyncCPUBackend>();
+		Tensor queued = bursting.to(async.get());
+		async->setRandomSeed(7);
+		Tensor c = reverseBurst(queued);
+		async->setRandomSeed(7);
+		Tensor d = reverseBurst(queued);
+		CHECK(c.toHost<uint8_t>() == d.toHost<uint8_t>());
+		CHECK(c.toHost<uint8_t>() == a.toHost<uint8_t>());
+	}
+
+	SECTION("Bit tensors") {
+		// 3 columns of 40 cells. So columns cross word boundaries
+		Tensor state = cast(encoder::scalar(0.4, 0, 1, 120, 30).reshape({3, 40}), DType::Bool);
+		state.view({0}) = zeros({40}, DType::Bool);
+		Tensor packed = state.cast(DType::Bit);
+		CHECK(packed.dtype() == DType::Bit);
+		CHECK(packed.cast(DType::Bool).isSame(state));
+
+		CHECK(packed.sum().item<int32_t>() == state.sum().item<int32_t>());
+		CHECK(packed.sum(1).isSame(state.sum(1)));
+		CHECK((!packed).cast(DType::Bool).isSame(!state));
+		CHECK((packed && !packed).sum().item<int32_t>() == 0);
+		CHECK((packed || !packed).sum().item<int32_t>() == 120);
+
+		uint8_t in[] = {1, 0, 1};
+		Tensor x = Tensor({3}, in);
+		Tensor y = burst(x, packed);
+		CHECK(y.dtype() == DType::Bit);
+		CHECK(y.cast(DType::Bool).isSame(burst(x, state)));
+
+		Tensor z = reverseBurst(y);
+		CHECK(z.dtype() == DType::Bit);
+		CHECK(z.sum(1).isSame(reverseBurst(burst(x, state)).sum(1)));
 	}
 
 	SECTION("Grow Synapses") {
@@ -711,6 +913,12 @@ TEST_CASE("Backend functions", "[Backend]")
 		CHECK(s1.dtype() == DType::Int32);
 		int32_t pred1[] = {6, 22, 38, 54};
 		CHECK(s1.isSame(Tensor({4}, pred1)));
+
+		// Views work too
+		Tensor col = t.view({all(), 1});
+		CHECK(sum(col).item<int32_t>() == 28);
+		int32_t pred2[] = {6, 38};
+		CHECK(sum(t.view({range(0, 4, 2), all()}), 1).isSame(Tensor({2}, pred2)));
 	}
 
 	SECTION("sum with negative index") {
@@ -722,6 +930,49 @@ TEST_CASE("Backend functions", "[Backend]")
 		CHECK_THROWS(sum(a, -4).shape());
 	}
 
+	SECTION("reductions") {
+		int v[] = {3, -1, 6, 2,
+			-2, 5, 1, 7,
+			5, 5, 0, -3};
+		Tensor t = Tensor({3,4}, v);
+
+		int32_t max0[] = {5, 5, 6, 7};
+		int32_t min1[] = {-1, -2, -3};
+		int32_t argmax0[] = {2, 1, 0, 1};
+		float mean1[] = {2.5f, 2.75f, 1.75f};
+		CHECK(t.max(0).isSame(Tensor({4}, max0)));
+		CHECK(t.min(1).isSame(Tensor({3}, min1)));
+		CHECK(t.argmax(0).isSame(Tensor({4}, argmax0)));
+		CHECK(t.argmax().item<int32_t>() == 7);
+		CHECK(t.max().item<int32_t>() == 7);
+		CHECK(t.mean(1).isSame(Tensor({3}, mean1)));
+		CHECK(t.reduce(ReduceOp::Sum, {0, 1}).isSame(t.sum(0).sum(0)));
+
+		// Strided views are reduced without copying
+		Tensor u = t.swapaxis(0, 1);
+		CHECK(u.sum(1).isSame(t.sum(0)));
+		CHECK(u.max(0).isSame(t.max(1)));
+
+		CHECK(t.any() == true);
+		CHECK(t.all() == false);
+		CHECK((t > 0).all(1).isSame(zeros({3}, DType::Bool)));
+		CHECK(t.any(0).isSame(ones({4}, DType::Bool)));
+		CHECK(t.sum(0, DType::Bool).isSame(t.any(0)));
+
+		Tensor b = cast(t > 0, DType::Bit);
+		CHECK(b.sum(0).isSame((t > 0).sum(0)));
+		CHECK(b.any(1).isSame((t > 0).any(1)));
+
+		// The generic implementation, for backends without their own, gives the same results
+		Backend* backend = t.backend();
+		Tensor f = u.cast(DType::Float);
+		for(ReduceOp op : {ReduceOp::Max, ReduceOp::Min, ReduceOp::ArgMax}) {
+			CHECK(Tensor(backend->Backend::reduce(u.pimpl(), {0}, op)).isSame(u.reduce(op, {0})));
+			CHECK(Tensor(backend->Backend::reduce(f.pimpl(), {1}, op)).isSame(f.reduce(op, {1})));
+			CHECK(Tensor(backend->Backend::reduce(b.pimpl(), {0, 1}, op)).isSame(b.reduce(op)));
+		}
+	}
+
 	SECTION("decay synapses") {
 		int a[] = {0,1,0,1};
 		Tensor c({2,2}, a);
@@ -739,6 +990,160 @@ TEST_CASE("Backend functions", "[Backend]")
 		// Only values from good synapses are defined. The others can be erases, set
 		// to 0, etc. Depending on implementation.
 	}
+
+	SECTION("Fixed point permanences") {
+		float v[] = {-1, 0, 0.5, 1, 2};
+		Tensor q = Tensor({5}, v).cast(DType::UNorm8);
+		CHECK(q.dtype() == DType::UNorm8);
+		std::vector<float> res = q.cast(DType::Float).toHost<float>();
+		CHECK(res[0] == 0);
+		CHECK(res[1] == 0);
+		CHECK(res[2] == Approx(128/255.f));
+		CHECK(res[3] == 1);
+		CHECK(res[4] == 1);
+
+		// Learning takes saturating integer steps
+		int32_t conns[] = {0, 1, -1};
+		float perms[] = {0.98, 0.02, 0};
+		uint8_t in[] = {1, 0};
+		Tensor c = Tensor({1, 3}, conns);
+		Tensor p = Tensor({1, 3}, perms).cast(DType::UNorm8);
+		learnCorrilation(Tensor({2}, in), ones({1}, DType::Bool), c, p, 0.1, 0.1);
+		std::vector<unorm8> r = p.toHost<unorm8>();
+		CHECK(r[0].value == 255);
+		CHECK(r[1].value == 0);
+	}
+
+	SECTION("CPU allocator") {
+		auto backend = std::make_shared<CPUBackend>();
+		CPUAllocator& allocator = backend->allocator();
+		void* first = backend->createTensor({100}, DType::Float)->data();
+		CHECK((uintptr_t)first % CPUAllocator::alignment == 0);
+		CHECK(allocator.stats().bytes_cached >= 400);
+
+		// The freed buffer is recycled for a request of the same size
+		auto x = backend->createTensor({10, 10}, DType::Int32);
+		CHECK(x->data() == first);
+		CHECK(allocator.stats().hits == 1);
+		CHECK(allocator.stats().bytes_cached == 0);
+
+		// Bit tensors are still zeroed when recycled
+		x = nullptr;
+		auto b = backend->createTensor({100}, DType::Bit);
+		CHECK(Tensor(b).sum().item<int32_t>() == 0);
+		b = nullptr;
+
+		allocator.emptyCache();
+		CHECK(allocator.stats().bytes_cached == 0);
+		allocator.setCacheLimit(0);
+		backend->createTensor({100}, DType::Float);
+		CHECK(allocator.stats().bytes_cached == 0);
+	}
+
+	SECTION("Profiling") {
+		auto backend = std::make_shared<CPUBackend>();
+		Tensor a = ones({4, 4}, DType::Float, backend.get());
+		clearProfile();
+		a + a;
+		CHECK(profileEvents().size() == 0);
+
+		enableProfiling(true);
+		a + a;
+		enableProfiling(false);
+		auto events = profileEvents();
+		REQUIRE(events.size() == 1);
+		CHECK(std::string(events[0].name) == "add");
+		CHECK(events[0].shape == Shape({4, 4}));
+		CHECK(events[0].dtype == DType::Float);
+		CHECK(events[0].bytes_allocated >= 64);
+		CHECK(chromeTrace().find("\"name\": \"add\"") != std::string::npos);
+		CHECK(profileSummary().find("add") != std::string::npos);
+		clearProfile();
+		CHECK(profileEvents().size() == 0);
+	}
+
+	SECTION("Async CPU backend") {
+		auto async = std::make_shared<AsyncCPUBackend>(2);
+		SpatialPooler sp({128}, {64});
+		SpatialPooler async_sp = sp.to(async.get());
+		for(float v : {0.1f, 0.3f, 0.5f}) {
+			Tensor x = encoder::scalar(v, 0, 1, 128, 12);
+			Tensor y = sp.compute(x);
+			sp.learn(x, y);
+
+			Tensor async_x = x.to(async.get());
+			Tensor async_y = async_sp.compute(async_x);
+			async_sp.learn(async_x, async_y);
+			CHECK(async_y.toHost<uint8_t>() == y.toHost<uint8_t>());
+		}
+		async->sync();
+		CHECK(async_sp.permanences().toHost<float>() == sp.permanences().toHost<float>());
+
+		// Errors show up when the result is needed
+		Tensor bad = cellActivity(ones({128}, DType::Bool, async.get()), zeros({64, 4}, DType::Float, async.get())
+			, ones({64, 4}, DType::Float, async.get()), 0.1, 1);
+		CHECK(bad.shape() == Shape({64}));
+		CHECK_THROWS(bad.toHost<int32_t>());
+		CHECK_THROWS(async->sync());
+		CHECK_NOTHROW(async->sync());
+	}
+
+	SECTION("Out and in-place variants") {
+		Tensor a = Tensor({4}, std::vector<float>{1, 2, 3, 4}.data());
+		Tensor b = Tensor({4}, std::vector<float>{4, 3, 2, 1}.data());
+		Tensor out = zeros({4}, DType::Float);
+		const void* buffer = out.data();
+		add(a, b, out);
+		CHECK(out.isSame(a+b));
+		exp(a, out);
+		CHECK(out.isSame(exp(a)));
+		CHECK(out.data() == buffer);
+
+		// In-place and with brodcasting. The result is converted to the dtype of the tensor written to
+		Tensor c = a.copy();
+		Tensor alias = c;
+		c.add_(b).mul_(2.f);
+		CHECK(alias.isSame((a+b)*2.f));
+		Tensor i = ones({4}, DType::Int32);
+		i.add_(a);
+		CHECK(i.isSame(Tensor({4}, std::vector<int>{2, 3, 4, 5}.data())));
+		CHECK_THROWS(i.add_(ones({3})));
+
+		// Writing into a view goes through a temporary
+		Tensor m = zeros({4, 4}, DType::Float);
+		Tensor column = m.view({all(), 1});
+		mul(a, b, column);
+		CHECK(m.view({all(), 1}).isSame(a*b));
+		CHECK(m.sum().item<float>() == (a*b).sum().item<float>());
+
+		Tensor bools = zeros({4}, DType::Bool);
+		b.cast_into(bools);
+		CHECK(bools.isSame(b.cast(DType::Bool)));
+
+		Tensor sums = zeros({2}, DType::Int32);
+		sum(ones({2, 3}), 1, sums);
+		CHECK(sums.isSame(constant({2}, 3)));
+
+		// Bursting into the state itself
+		for(DType dtype : {DType::Bool, DType::Bit}) {
+			Tensor x = Tensor({4}, std::vector<uint8_t>{1, 0, 1, 1}.data()).cast(dtype);
+			Tensor state = Tensor({4, 4}, std::vector<uint8_t>{0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 1, 1, 0}.data()).cast(dtype);
+			Tensor expected = burst(x, state);
+			burst(x, state, state);
+			CHECK(state.isSame(expected));
+			reverseBurst(state, state);
+			CHECK(state.sum(1).isSame(Tensor({4}, std::vector<int>{1, 0, 1, 2}.data())));
+		}
+
+		Tensor activity = zeros({2}, DType::Int32);
+		cellActivity(ones({2}, DType::Bool), Tensor({2, 2}, std::vector<int>{0, 1, 1, -1}.data())
+			, Tensor({2, 2}, std::vector<float>{0.5, 0.4, 0.7, 0.0}.data()), 0.1, 1, activity);
+		CHECK(activity.isSame(Tensor({2}, std::vector<int>{2, 1}.data())));
+
+		Tensor ema = a.copy();
+		(lazy(ema)*0.5f + lazy(b)*0.5f).realize(ema);
+		CHECK(ema.isSame(constant({4}, 2.5f)));
+	}
 }
 
 TEST_CASE("StateDict", "[StateDict]")
@@ -882,6 +1287,62 @@ TEST_CASE("Tensor operations")
 		CHECK(s.reshape({1, 1, 1, 1}).dimensions() == 4);
 		CHECK(s.reshape({1, 1, -1, 1, 1}).dimensions() == 5);
 	}
+
+	SECTION("Strided operations") {
+		std::vector<int> v(2*3*4);
+		std::iota(v.begin(), v.end(), 0);
+		Tensor t = Tensor({2, 3, 4}, v.data());
+
+		// Reordered views are read in the right order
+		Tensor s = t.swapaxis(0, 2);
+		std::vector<int> pred;
+		for(int k=0;k<4;k++) for(int j=0;j<3;j++) for(int i=0;i<2;i++)
+			pred.push_back(v[i*12+j*4+k]);
+		CHECK(realize(s).toHost<int>() == pred);
+		CHECK((s+0).toHost<int>() == pred);
+		CHECK((s*s).isSame(realize(s)*realize(s)));
+		CHECK((t.view({all(), range(1, 3), range(1, 3)}) - brodcast_to(Tensor({2}, std::vector<int>{1, 2}.data()), {2, 2, 2})).toHost<int>()
+			== std::vector<int>{4, 4, 8, 8, 16, 16, 20, 20});
+
+		// Writing through a strided view
+		Tensor u = t.copy();
+		u.swapaxis(0, 2).view({range(1, 3)}) = zeros({2, 3, 2}, DType::Int32);
+		CHECK(u.sum().item<int>() == 138);
+		CHECK(realize(u.view({all(), all(), range(1, 3)})).sum().item<int>() == 0);
+	}
+
+	SECTION("Lazy expressions") {
+		Tensor a = ones({4, 3}, DType::Float) * 1.5f;
+		Tensor b = Tensor({3}, std::vector<float>{0.25f, -2.f, 8.f}.data());
+		Tensor x = Tensor({4, 3}, std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11}.data());
+		Tensor y = x > 4;
+
+		// Fused expressions give the same result as computing them one by one
+		CHECK(Tensor(lazy(a)*0.9f + lazy(y)*0.1f).isSame(a*0.9f + y*0.1f));
+		CHECK(Tensor(exp((0.5f - lazy(b)) * 2.f) * x).isSame(exp((0.5f - b) * 2.f) * x));
+		CHECK(Tensor(cast(lazy(a)*x, DType::Int32)).isSame(cast(a*x, DType::Int32)));
+		CHECK(Tensor(lazy(a.view({range(2)})) > b || !lazy(y.view({range(2)}))).isSame(a.view({range(2)}) > b || !y.view({range(2)})));
+
+		// Expressions not computable in float fall back to the individual operations
+		Tensor z = lazy(x) + x*2;
+		CHECK(z.dtype() == DType::Int32);
+		CHECK(z.isSame(x + x*2));
+		// Including Int32 values float can't hold
+		Tensor big = Tensor({2}, std::vector<int>{16777217, -16777219}.data());
+		CHECK(Tensor(lazy(big) + 1).isSame(big + 1));
+		CHECK(Tensor(cast(lazy(big), DType::Int32)).isSame(big));
+		CHECK(Tensor(cast(lazy(big) * 1.f, DType::Int32) + 1).isSame(cast(big * 1.f, DType::Int32) + 1));
+
+		CHECK(lazy(a).realize().isSame(a));
+		CHECK_THROWS(lazy(a) + ones({4}, DType::Float));
+
+		// Scalars are created on the backend of the tensors when the expression isn't fused
+		auto backend = std::make_shared<CPUBackend>();
+		Tensor h = a.cast(DType::Half).to(backend.get());
+		Tensor w = (lazy(h) > 1.f) && true;
+		CHECK(w.backend() == backend.get());
+		CHECK(w.to(defaultBackend()).isSame(ones({4, 3}, DType::Bool)));
+	}
 }
 
 TEST_CASE("brodcast")
@@ -949,6 +1410,46 @@ TEST_CASE("SDRClassifer")
 	
 	for(size_t i=0;i<num_category;i++)
 		CHECK(classifer.compute(encoder::category(i, num_category, num_bits),0) == i);
+
+	SECTION("Top k") {
+		svector<Tensor> samples;
+		for(size_t i=0;i<num_category;i++)
+			samples.push_back(encoder::category(i, num_category, num_bits).reshape({1, intmax_t(num_bits*num_category)}));
+		auto [ids, scores] = classifer.topk(cat(samples, 0), 0.1, 3);
+		CHECK(ids.shape() == Shape({intmax_t(num_category), 3}));
+		for(size_t i=0;i<num_category;i++) {
+			CHECK(ids[{intmax_t(i), 0}].item<int>() == int(i));
+			CHECK(ids[{intmax_t(i), 0}].item<int>() == (int)classifer.compute(samples[i], 0.1));
+			CHECK(scores[{intmax_t(i), 0}].item<int>() >= scores[{intmax_t(i), 1}].item<int>());
+		}
+		CHECK(classifer.topk(encoder::category(2, num_category, num_bits), 0.1).first.item<int>() == 2);
+		CHECK_THROWS(classifer.topk(samples[0], 0.1, num_category+1));
+	}
+
+	SECTION("Concurrent use") {
+		SDRClassifer concurrent({(intmax_t)(num_bits*num_category)}, num_category);
+		std::vector<std::thread> threads;
+		std::atomic<size_t> wrong = 0;
+		for(size_t t=0;t<4;t++) {
+			threads.emplace_back([&, t]() {
+				for(size_t i=0;i<num_category;i++) {
+					concurrent.addPattern(encoder::category(i, num_category, num_bits), i);
+					if(t == 0 && concurrent.compute(encoder::category(i, num_category, num_bits), 0) != i)
+						wrong++;
+				}
+			});
+		}
+		for(auto& t : threads)
+			t.join();
+		CHECK(wrong == 0);
+		CHECK(concurrent.numPatterns() == std::vector<int>(num_category, 4));
+		CHECK(concurrent.reference().isSame(classifer.reference()*4));
+
+		SDRClassifer loaded;
+		loaded.loadState(concurrent.copy().states());
+		for(size_t i=0;i<num_category;i++)
+			CHECK(loaded.compute(encoder::category(i, num_category, num_bits), 0.1) == i);
+	}
 }
 
 TEST_CASE("Type system")
@@ -958,6 +1459,7 @@ TEST_CASE("Type system")
 		STATIC_REQUIRE(dtypeToSize(DType::Int32) == 4);
 		STATIC_REQUIRE(dtypeToSize(DType::Float) == 4);
 		STATIC_REQUIRE(dtypeToSize(DType::Half) == 2);
+		STATIC_REQUIRE(dtypeToBufferSize(DType::Bit, 65) == 16);
 	}
 
 	SECTION("type to dtype") {
@@ -1090,6 +1592,235 @@ TEST_CASE("Type system")
 	}
 }
 
+TEST_CASE("SpatialPooler")
+{
+	SpatialPooler sp({128}, {64});
+	Tensor x = encoder::scalar(0.5, 0, 1, 128, 12);
+
+	SECTION("Sparse input") {
+		Tensor y = sp.compute(x);
+		sp.setSparseInput(true);
+		CHECK(sp.compute(x).isSame(y));
+
+		// The cached index survives learning
+		sp.learn(x, y);
+		Tensor z = sp.compute(x);
+
+		// The index is built up front. So compute() only reads the SP and can run on several threads at once
+		std::vector<Tensor> results(4);
+		std::vector<std::thread> threads;
+		for(auto& res : results)
+			threads.emplace_back([&sp, &x, &res]() { res = sp.compute(x); });
+		for(auto& t : threads)
+			t.join();
+		for(auto& res : results)
+			CHECK(res.isSame(z));
+		sp.setSparseInput(false);
+		CHECK(sp.compute(x).isSame(z));
+	}
+
+	SECTION("Fused step") {
+		sp.setBoostingFactor(0.5);
+		SpatialPooler sp2 = sp.copy();
+		for(float v : {0.1f, 0.5f, 0.7f}) {
+			Tensor in = encoder::scalar(v, 0, 1, 128, 12);
+			Tensor y = sp.compute(in);
+			sp.learn(in, y);
+			CHECK(sp2.step(in).isSame(y));
+		}
+		CHECK(sp2.permanences().isSame(sp.permanences()));
+		CHECK(sp2.step(x, false).isSame(sp.compute(x)));
+	}
+
+	SECTION("Incremental overlap") {
+		SpatialPooler sp2 = sp.copy();
+		OverlapCache cache;
+		for(int i=0;i<12;i++) {
+			Tensor in = encoder::scalar(0.3f+i*0.01f, 0, 1, 128, 12);
+			Tensor y = sp.compute(in);
+			sp.learn(in, y);
+			CHECK(sp2.step(in, cache).isSame(y));
+		}
+		CHECK(sp2.permanences().isSame(sp.permanences()));
+
+		// Every stream has it's own cache. Interleaving them doesn't mix up their last inputs
+		OverlapCache other;
+		Tensor far = encoder::scalar(0.9f, 0, 1, 128, 12);
+		for(int i=0;i<3;i++) {
+			CHECK(sp2.compute(far, other).isSame(sp2.compute(far)));
+			CHECK(sp2.compute(x, cache).isSame(sp2.compute(x)));
+		}
+	}
+
+	SECTION("Freeze") {
+		sp.setBoostingFactor(0.5);
+		sp.learn(x, sp.compute(x));
+		sp.setPermanenceType(DType::UNorm8);
+		FrozenSpatialPooler frozen = sp.freeze();
+		CHECK(frozen.masks().dtype() == DType::Bit);
+		CHECK(frozen.masks().shape() == Shape({64, 128}));
+		for(float v : {0.1f, 0.5f, 0.7f}) {
+			Tensor in = encoder::scalar(v, 0, 1, 128, 12);
+			CHECK(frozen.compute(in).isSame(sp.compute(in)));
+		}
+		Tensor batch = cat({encoder::scalar(0.1, 0, 1, 128, 12).reshape({1, 128}), x.reshape({1, 128})}, 0);
+		CHECK(frozen.compute(batch).isSame(sp.compute(batch)));
+
+		FrozenSpatialPooler loaded;
+		loaded.loadState(frozen.states());
+		CHECK(loaded.compute(x).isSame(sp.compute(x)));
+	}
+
+	SECTION("Batched compute") {
+		sp.setBoostingFactor(0.5);
+		Tensor batch = cat({encoder::scalar(0.1, 0, 1, 128, 12).reshape({1, 128}), x.reshape({1, 128})}, 0);
+		Tensor y = sp.compute(batch);
+		CHECK(y.shape() == Shape({2, 64}));
+		CHECK(realize(y.view({0})).isSame(sp.compute(encoder::scalar(0.1, 0, 1, 128, 12))));
+		CHECK(realize(y.view({1})).isSame(sp.compute(x)));
+		CHECK_THROWS(sp.compute(zeros({2, 127}, DType::Bool)));
+	}
+}
+
+TEST_CASE("TemporalMemory")
+{
+	TemporalMemory tm({32}, 4);
+	Tensor a = encoder::scalar(0.2, 0, 1, 32, 4);
+	Tensor b = encoder::scalar(0.6, 0, 1, 32, 4);
+	for(int i=0;i<4;i++) {
+		auto [pred, active] = tm.compute(a, Tensor());
+		tm.learn(tm.compute(b, active).second, active);
+	}
+
+	SECTION("Batched compute") {
+		Tensor last = tm.compute(a, Tensor()).second;
+		Tensor batch = cat({a.reshape({1, 32}), b.reshape({1, 32})}, 0);
+		Tensor state = cat({last.reshape({1, 32, 4}), zeros({1, 32, 4}, DType::Bool)}, 0);
+		auto [pred, active] = tm.compute(batch, state);
+		CHECK(pred.shape() == Shape({2, 32, 4}));
+
+		auto [pred0, active0] = tm.compute(a, last);
+		auto [pred1, active1] = tm.compute(b, zeros({32, 4}, DType::Bool));
+		CHECK(realize(pred.view({0})).isSame(pred0));
+		CHECK(realize(pred.view({1})).isSame(pred1));
+		CHECK(realize(active.view({1})).isSame(active1));
+	}
+
+	SECTION("Freeze") {
+		FrozenTemporalMemory frozen = tm.freeze();
+		CHECK(frozen.numSynapses() == (size_t)((tm.connections() != -1) && (tm.permanences() > 0.15f)).sum().item<int32_t>());
+		Tensor last = tm.compute(a, Tensor()).second;
+		for(const Tensor& state : {Tensor(), last}) {
+			auto [pred, active] = tm.compute(b, state);
+			auto [frozen_pred, frozen_active] = frozen.compute(b, state);
+			CHECK(frozen_pred.isSame(pred));
+			CHECK(frozen_active.isSame(active));
+		}
+
+		FrozenTemporalMemory loaded;
+		loaded.loadState(frozen.states());
+		CHECK(loaded.compute(b, last).first.isSame(tm.compute(b, last).first));
+	}
+
+	SECTION("Sparse synapses") {
+		Tensor connections = tm.connections().copy();
+		Tensor permanences = tm.permanences().copy();
+		SparseSynapses synapses = SparseSynapses::fromDense(connections, permanences);
+		CHECK(synapses.numSynapses() == (size_t)(connections != -1).sum().item<int32_t>());
+
+		Tensor x = tm.compute(a, Tensor()).second;
+		Tensor learning = reverseBurst(tm.compute(b, x).second);
+		learnCorrilation(x, learning, connections, permanences, 0.1, 0.1);
+		growSynapses(x, learning, connections, permanences, 0.21);
+		synapses.learnCorrilation(x, learning, 0.1, 0.1);
+		synapses.growSynapses(x, learning, 0.21);
+		auto [c, p] = synapses.toDense();
+		CHECK(c.isSame(connections));
+		CHECK(((p == permanences) || (c == -1)).all());
+		CHECK(synapses.cellActivity(x, 0.15, 2).isSame(cellActivity(x, connections, permanences, 0.15, 2)));
+
+		decaySynapses(connections, permanences, 0.25f);
+		synapses.decaySynapses(0.25f);
+		CHECK(synapses.toDense().first.isSame(connections));
+
+		TemporalMemory sparse_tm({32}, 4, 64, defaultBackend(), true);
+		for(int i=0;i<4;i++) {
+			auto [pred, active] = sparse_tm.compute(a, Tensor());
+			sparse_tm.learn(sparse_tm.compute(b, active).second, active);
+		}
+		CHECK(sparse_tm.sparseSynapses().numSynapses() != 0);
+
+		// Only the existing synapses are saved
+		StateDict states = sparse_tm.states();
+		CHECK(std::any_cast<Tensor>(states["sparse_indices"]).size() == sparse_tm.sparseSynapses().numSynapses());
+		TemporalMemory loaded_tm;
+		loaded_tm.loadState(states);
+		CHECK(loaded_tm.compute(b, x).first.isSame(sparse_tm.compute(b, x).first));
+		CHECK(loaded_tm.sparseSynapses().toDense().first.isSame(sparse_tm.sparseSynapses().toDense().first));
+		Tensor pred = sparse_tm.compute(b, x).first;
+		Tensor activity = cellActivity(burst(b, x), sparse_tm.connections(), sparse_tm.permanences(), 0.15, 2);
+		CHECK(pred.isSame(cast(activity, DType::Bool)));
+	}
+}
+
+TEST_CASE("Pipeline")
+{
+	SpatialPooler sp({128}, {64});
+	TemporalMemory tm({64}, 4);
+	std::vector<std::vector<Tensor>> inputs(2);
+	for(int i=0;i<8;i++) {
+		inputs[0].push_back(Tensor(0.1f*i));
+		inputs[1].push_back(Tensor(0.9f-0.1f*i));
+	}
+	auto encode = [](const Tensor& x) { return encoder::scalar(x.item<float>(), 0, 1, 128, 12); };
+
+	std::vector<std::vector<Tensor>> expected(2);
+	for(size_t s=0;s<2;s++) {
+		SpatialPooler sp2 = sp.copy();
+		Tensor last_active;
+		for(const auto& v : inputs[s]) {
+			Tensor x = encode(v);
+			Tensor y = sp2.compute(x);
+			sp2.learn(x, y);
+			auto [pred, active] = tm.compute(y, last_active);
+			last_active = active;
+			expected[s].push_back(pred);
+		}
+	}
+
+	std::vector<SpatialPooler> sps = {sp.copy(), sp.copy()};
+	std::vector<Pipeline> pipelines(2);
+	for(size_t s=0;s<2;s++) {
+		pipelines[s].addStage("encoder", encode)
+			.addSpatialPooler("sp", sps[s])
+			.addTemporalMemory("tm", tm, false);
+	}
+	auto results = runPipelines({&pipelines[0], &pipelines[1]}, inputs);
+	for(size_t s=0;s<2;s++) {
+		REQUIRE(results[s].size() == expected[s].size());
+		for(size_t i=0;i<expected[s].size();i++)
+			CHECK(results[s][i].isSame(expected[s][i]));
+		CHECK(pipelines[s].stats().size() == 3);
+		CHECK(pipelines[s].stats()[1].name == "sp");
+		CHECK(pipelines[s].stats()[1].calls == 8);
+		CHECK(pipelines[s].totalStats().calls == 8);
+		CHECK(pipelines[s].totalStats().throughput() > 0);
+	}
+
+	SDRClassifer clf({64}, 2);
+	clf.addPattern(cast(expected[0][3].sum(1), DType::Bool), 0);
+	CHECK(pipelines[0].addClassifier("clf", clf, 0.1).run({inputs[0][3]}).front().item<int>() >= 0);
+	CHECK_THROWS(runPipelines({&pipelines[0], &pipelines[0]}, inputs));
+
+	// Regions that learn can't be shared between stages. Read only ones can
+	Pipeline learning;
+	learning.addStage("encoder", encode).addSpatialPooler("sp", sps[0]);
+	CHECK_THROWS(runPipelines({&pipelines[0], &learning}, inputs));
+	Pipeline reading;
+	reading.addStage("encoder", encode).addSpatialPooler("sp", sps[1], false).addTemporalMemory("tm", tm, false);
+	CHECK_NOTHROW(runPipelines({&pipelines[0], &reading}, inputs));
+}
+
 TEST_CASE("Anomaly")
 {
 	Tensor real = zeros({256}, DType::Bool);
@@ -1183,8 +1914,69 @@ TEST_CASE("Complex Tensor operations")
 	}
 }
 
-// TEST_CASE("Serealize")
-// {
-// 	using namespace et;
+TEST_CASE("Serealize")
+{
+	using namespace et;
+	std::string path = (std::filesystem::temp_directory_path() / "etaler_test_model.etm").string();
+
+	SECTION("Native format") {
+		Tensor a = ones({3, 5}, DType::Float) * 0.25f;
+		Tensor b = Tensor({4}, std::vector<int>{1, -1, 7, 42}.data());
+		Tensor c = Tensor({70}, DType::Bool) = zeros({70}, DType::Bool);
+		Tensor bits = cast(b > 0, DType::Bit);
+		StateDict inner = {{"b", b}, {"name", std::string("inner")}};
+		StateDict dict = {{"a", a}, {"c", c}, {"bits", bits}, {"inner", inner}
+			, {"list", std::vector<Tensor>{a, b}}, {"value", 3.5f}};
+		save(dict, path);
+
+		StateDict loaded = load(path);
+		CHECK(std::any_cast<Tensor>(loaded["a"]).isSame(a));
+		CHECK(std::any_cast<Tensor>(loaded["c"]).isSame(c));
+		CHECK(std::any_cast<Tensor>(loaded["bits"]).isSame(bits));
+		CHECK(std::any_cast<float>(loaded["value"]) == 3.5f);
+		StateDict loaded_inner = std::any_cast<StateDict>(loaded["inner"]);
+		CHECK(std::any_cast<Tensor>(loaded_inner["b"]).isSame(b));
+		CHECK(std::any_cast<std::string>(loaded_inner["name"]) == "inner");
+		auto list = std::any_cast<std::vector<Tensor>>(loaded["list"]);
+		REQUIRE(list.size() == 2);
+		CHECK(list[1].isSame(b));
+
+		// Writing to a loaded tensor doesn't change the file. And saving over the file keeps loaded tensors valid
+		Tensor la = std::any_cast<Tensor>(loaded["a"]);
+		la.view({0}) = zeros({5}, DType::Float);
+		CHECK(std::any_cast<Tensor>(load(path)["a"]).isSame(a));
+		save(StateDict{{"a", b}}, path);
+		CHECK(la.view({1}).isSame(a.view({1})));
+		CHECK(std::any_cast<Tensor>(load(path)["a"]).isSame(b));
+
+		CHECK_THROWS(load(path + ".missing.etm"));
+	}
 
-// }
+	SECTION("Loading onto the async backend") {
+		SpatialPooler sp({128}, {64});
+		save(StateDict{{"connections", sp.connections()}, {"permanences", sp.permanences()}}, path);
+
+		auto async = std::make_shared<AsyncCPUBackend>(2);
+		Backend* backend = defaultBackend();
+		setDefaultBackend(async.get());
+		StateDict loaded = load(path);
+		setDefaultBackend(backend);
+		Tensor connections = std::any_cast<Tensor>(loaded["connections"]);
+		Tensor permanences = std::any_cast<Tensor>(loaded["permanences"]);
+		CHECK(permanences.backend() == async.get());
+		CHECK(dynamic_cast<AsyncCPUBuffer*>(permanences.pimpl()->buffer().get()) != nullptr);
+
+		// Queued in-place updates of the loaded tensors are ordered
+		Tensor expected = sp.permanences().copy();
+		for(float v : {0.1f, 0.3f, 0.5f, 0.7f}) {
+			Tensor x = encoder::scalar(v, 0, 1, 128, 12);
+			Tensor y = sp.compute(x);
+			learnCorrilation(x, y, sp.connections(), expected, 0.1f, 0.02f);
+			learnCorrilation(x.to(async.get()), y.to(async.get()), connections, permanences, 0.1f, 0.02f);
+		}
+		CHECK(permanences.toHost<float>() == expected.toHost<float>());
+		async->sync();
+	}
+
+	std::filesystem::remove(path);
+}